@@ -0,0 +1,35 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "BtnResponse.h"
+#include "Server.h"
+#include "Stats.h"
+
+BtnResponse::BtnResponse(ServerMFD * mfd, const std::string & key) : _mfd(mfd), _key(key)
+{
+	// Count the pending response
+	Stats::opened(Stats::BTN_PENDING);
+}
+
+
+BtnResponse::~BtnResponse()
+{
+	// Count the end of the pending response
+	Stats::closed(Stats::BTN_PENDING);
+
+	// Close the MFD, once the press has been processed or when the connection has been closed before
+	// The unregistration of the MFD is queued after the press, so the main thread never presses a button of an unregistered MFD
+	Server::Instance().closeMFD(_key);
+}
+
+
+void BtnResponse::respond(SoConnection & connection, SoHTTP::Request & request)
+{
+	// Send a 200 HTTP code with the buttons status in JSON
+	// The response has a Content-Length, so that the next button press can reuse the connection
+	std::string JSON = _mfd->getJSON();
+	SoHTTP::sendResponse(connection, request, "200 OK", "", JSON.data(), JSON.length());
+}
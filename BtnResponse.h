@@ -0,0 +1,42 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __BTNRESPONSE_H
+#define __BTNRESPONSE_H
+
+#include "SoHTTP/SoHTTP.h"
+#include "ServerMFD.h"
+
+#include <string>
+
+/// The response to a button classic HTTP request, written once the main Orbiter thread has processed the button press.
+/// The press is queued with the connection as its completion token (see Server::pressButton):
+/// the main thread wakes the connection once the MFD has processed the press and has been refreshed, and the new button labels are then sent.
+/// No thread waits for the press meanwhile.
+class BtnResponse : public SoPendingResponse
+{
+public:
+	/// Constructor
+	/// \param[in]	mfd		The opened MFD. Will be closed when the response is destroyed.
+	/// \param[in]	key		The key on which the MFD was opened.
+	BtnResponse(ServerMFD * mfd, const std::string & key);
+
+	/// Destructor
+	/// Closes the MFD.
+	virtual ~BtnResponse();
+
+	/// Sends the button labels in JSON.
+	virtual void	respond(SoConnection & connection, SoHTTP::Request & request);
+
+private:
+	/// The MFD whose button has been pressed
+	ServerMFD *		_mfd;
+
+	/// The key on which the MFD was opened
+	std::string		_key;
+};
+
+#endif // __BTNRESPONSE_H
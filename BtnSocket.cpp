@@ -0,0 +1,96 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "BtnSocket.h"
+#include "Server.h"
+#include "Stats.h"
+
+#include <stdlib.h>
+
+BtnSocket::BtnSocket(SoConnection & connection, ServerMFD * mfd, const std::string & key) :
+	_mfd(mfd), _key(key), _labelsId(0)
+{
+	// Be woken by the MFD each time it is refreshed
+	_mfd->addListener(&connection);
+
+	// Count the WebSocket
+	Stats::opened(Stats::BTN_SOCKET);
+}
+
+
+BtnSocket::~BtnSocket()
+{
+	// Count the end of the WebSocket
+	Stats::closed(Stats::BTN_SOCKET);
+}
+
+
+void BtnSocket::onWake(SoConnection & connection)
+{
+	// If the close button has been pressed, close the WebSocket
+	if (_mfd->getClose())
+	{
+		close(connection, 1000);
+		return ;
+	}
+
+	// Send the button labels if they have changed
+	_sendLabels(connection);
+}
+
+
+void BtnSocket::onClose(SoConnection & connection)
+{
+	// Stop being woken by the MFD
+	_mfd->remListener(&connection);
+
+	// Close the MFD
+	Server::Instance().closeMFD(_key);
+}
+
+
+void BtnSocket::onMessage(SoConnection & connection, int opcode, const char * data, size_t len)
+{
+	// The id of the button: a signed byte in a binary message, or a number in a text message
+	int btnId;
+	if (opcode == SoWebSocketParser::BINARY)
+	{
+		if (len != 1)
+			return ;
+		btnId = (signed char)data[0];
+	}
+	else
+		btnId = atoi(std::string(data, len).c_str());
+
+	// If the given button Id is a correct number, queue the button press
+	// The main Orbiter thread will process it at its next step, and the MFD refresh that follows will wake the WebSocket with the new labels
+	if (btnId >= 0)
+	{
+		Server::Instance().pressButton(_mfd, btnId);
+
+		// If the button pressed was the close one, close the WebSocket
+		if (btnId == 99)
+			close(connection, 1000);
+	}
+
+	// If the given button id is -1, it means that this is just an enquiry and not a button press: send the labels
+	else if (btnId == -1)
+	{
+		_labelsId = 0;
+		_sendLabels(connection);
+	}
+}
+
+
+void BtnSocket::_sendLabels(SoConnection & connection)
+{
+	// Get the JSON string if the button labels have changed
+	std::string JSON = _mfd->getJSONIf(_labelsId);
+
+	// If the JSON string has evolved, send it
+	if (!JSON.empty())
+		sendText(connection, JSON);
+}
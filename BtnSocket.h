@@ -0,0 +1,59 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __BTNSOCKET_H
+#define __BTNSOCKET_H
+
+#include "SoHTTP/SoWebSocket.h"
+#include "ServerMFD.h"
+
+#include <string>
+
+/// Handles the button WebSocket of a MFD.
+/// Does not use any thread: it is called by the SoHTTP I/O threads.
+/// The client sends the id of the pressed buttons as text messages ("-1" asks for the button labels),
+/// or as one byte binary messages. The button labels are sent in JSON text messages each time they change:
+/// the MFD wakes the connection each time it is refreshed.
+class BtnSocket : public SoWebSocketHandler
+{
+public:
+	/// Constructor
+	/// Registers the connection as a listener of the MFD.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	mfd			The opened MFD. Will be closed when the connection closes.
+	/// \param[in]	key			The key on which the MFD was opened.
+	BtnSocket(SoConnection & connection, ServerMFD * mfd, const std::string & key);
+
+	/// Destructor
+	virtual ~BtnSocket();
+
+	/// Called when the MFD has been refreshed: sends the button labels if they have changed.
+	/// Closes the WebSocket if the close button of the MFD has been pressed.
+	virtual void	onWake(SoConnection & connection);
+
+	/// Unregisters from the MFD and closes it.
+	virtual void	onClose(SoConnection & connection);
+
+protected:
+	/// Handles a button press or a labels enquiry.
+	virtual void	onMessage(SoConnection & connection, int opcode, const char * data, size_t len);
+
+private:
+	/// Sends the button labels if they have changed since they were last sent.
+	/// \param[in]	connection	The connection of the WebSocket.
+	void			_sendLabels(SoConnection & connection);
+
+	/// The MFD
+	ServerMFD *		_mfd;
+
+	/// The key on which the MFD was opened
+	std::string		_key;
+
+	/// Id of the last button labels sent, used to check if the button labels have changed
+	unsigned int	_labelsId;
+};
+
+#endif // __BTNSOCKET_H
@@ -0,0 +1,342 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "CockpitSocket.h"
+#include "Server.h"
+#include "Stats.h"
+
+#include <sstream>
+#include <stdlib.h>
+
+/// Writes a big endian integer.
+/// \param[out]	dest	Where to write the integer.
+/// \param[in]	value	The integer.
+/// \param[in]	bytes	The number of bytes of the integer.
+static void putBigEndian(char * dest, unsigned int value, int bytes)
+{
+	for (int i = bytes - 1; i >= 0; --i, value >>= 8)
+		dest[i] = (char)(value & 0xFF);
+}
+
+
+CockpitSocket::CockpitSocket()
+{
+	// Count the WebSocket
+	Stats::opened(Stats::COCKPIT_SOCKET);
+}
+
+
+CockpitSocket::~CockpitSocket()
+{
+	// Release the frames that were never sent
+	for (SubscriptionMap::iterator i = _subscriptions.begin(); i != _subscriptions.end(); ++i)
+		if (i->second.mailbox)
+			i->second.mailbox->Release();
+
+	// Count the end of the WebSocket
+	Stats::closed(Stats::COCKPIT_SOCKET);
+}
+
+
+void CockpitSocket::onSent(SoConnection & connection)
+{
+	// Trace the sending of the previous frames, which have fully left the socket
+	LONGLONG now = TimingStats::Now();
+	for (SubscriptionMap::iterator i = _subscriptions.begin(); i != _subscriptions.end(); ++i)
+		if (i->second.sendStart)
+		{
+			Server::Instance().Trace().record(FrameTrace::SEND, i->first, i->second.sentId, i->second.sendStart, now);
+			i->second.sendStart = 0;
+		}
+
+	// The socket can take more data: send the frames that have been published while the previous ones were being sent
+	_deliverFrames(connection);
+}
+
+
+void CockpitSocket::onWake(SoConnection & connection)
+{
+	// A MFD has changed: send its labels, keep its latest frame, and send the frames if the connection is not busy
+	_collect(connection);
+	_deliverFrames(connection);
+}
+
+
+void CockpitSocket::onTimer(SoConnection & connection)
+{
+	// Wether there still are images to wait for
+	bool images = false;
+
+	// Force the refresh of the MFDs that have not given any image for a refreshing interval, which will wake the socket
+	for (SubscriptionMap::iterator i = _subscriptions.begin(); i != _subscriptions.end(); ++i)
+		if (!i->second.format.empty())
+		{
+			if (!i->second.fresh)
+				Server::Instance().forceRefresh(i->second.mfd);
+			i->second.fresh = false;
+			images = true;
+		}
+
+	// Wait for another refreshing interval
+	if (images)
+		connection.setTimer((DWORD)(WEBMFD_FRAME_TIMEOUT_MS));
+}
+
+
+void CockpitSocket::onClose(SoConnection & connection)
+{
+	// Unsubscribe from all MFDs
+	while (!_subscriptions.empty())
+		_unsubscribe(connection, _subscriptions.begin());
+}
+
+
+void CockpitSocket::onMessage(SoConnection & connection, int opcode, const char * data, size_t len)
+{
+	// The commands are text messages
+	if (opcode != SoWebSocketParser::TEXT)
+		return ;
+
+	// Read the command and the key of the MFD
+	std::istringstream command(std::string(data, len));
+	std::string name, key;
+	command >> name >> key;
+	if (key.empty() || key.length() > 255)
+		return ;
+
+	// Subscribe to a MFD
+	if (name == "sub")
+	{
+		std::string format;
+		int window = 0;
+		command >> format >> window;
+		if (format == "none")
+			format = "";
+		if (window < 0 || window > WEBMFD_COCKPIT_MAX_WINDOW)
+			return ;
+		if (format == "" || format == "png" || format == "jpeg" || format == "tiles")
+			_subscribe(connection, key, format, (unsigned int)window);
+		return ;
+	}
+
+	// The other commands are for a subscribed MFD
+	SubscriptionMap::iterator i = _subscriptions.find(key);
+	if (i == _subscriptions.end())
+		return ;
+
+	// Unsubscribe from a MFD
+	if (name == "unsub")
+		_unsubscribe(connection, i);
+
+	// Press a button of a MFD
+	else if (name == "btn")
+	{
+		int btnId = -2;
+		command >> btnId;
+
+		// If the given button Id is a correct number, queue the button press
+		// The main Orbiter thread will process it at its next step, and the MFD refresh that follows will wake the socket with the new labels and image
+		if (btnId >= 0)
+			Server::Instance().pressButton(i->second.mfd, btnId);
+
+		// If the given button id is -1, it means that this is just an enquiry and not a button press: send the labels
+		// The labels id is never 0, so resetting it makes _collect send the current labels
+		else if (btnId == -1)
+		{
+			i->second.labelsId = 0;
+			_collect(connection);
+		}
+	}
+
+	// Acknowledge the images the client has displayed, and send the next one if it was waiting for it
+	else if (name == "ack")
+	{
+		Subscription & sub = i->second;
+		unsigned int frameId = 0;
+		command >> frameId;
+
+		// The last sent image acknowledges all the others: the client may only display the latest image it has received
+		if (frameId == sub.sentId)
+			sub.inFlight = 0;
+		else if (sub.inFlight > 0)
+			--sub.inFlight;
+
+		_deliverFrames(connection);
+	}
+}
+
+
+void CockpitSocket::_subscribe(SoConnection & connection, const std::string & key, const std::string & format, unsigned int window)
+{
+	// Subscribing again to a MFD replaces its subscription
+	SubscriptionMap::iterator previous = _subscriptions.find(key);
+	if (previous != _subscriptions.end())
+		_unsubscribe(connection, previous);
+
+	// Limit the number of MFDs of a client
+	if (_subscriptions.size() >= WEBMFD_COCKPIT_MAX_MFDS)
+		return ;
+
+	// Open the MFD
+	ServerMFD * mfd = Server::Instance().openMFD(key, format);
+	if (!mfd)
+		return ;
+
+	// Register the subscription
+	Subscription & sub = _subscriptions[key];
+	sub.mfd = mfd;
+	sub.format = format;
+	sub.type = (format == "jpeg") ? 1 : (format == "tiles") ? 2 : 0;
+	sub.window = window;
+	sub.inFlight = 0;
+	sub.id = 0;
+	sub.sentId = 0;
+	sub.labelsId = 0;
+	sub.mailbox = 0;
+	sub.time = 0;
+	sub.fresh = true;
+	sub.sendStart = 0;
+	sub.counters = FollowerCounters("cockpit", format.empty() ? "none" : format);
+
+	// Be woken by the MFD each time its image or its labels change, and wake now to send the current ones
+	// The counters of the subscription are reported with those of the MFD, the node of the map that holds them never moves
+	mfd->addListener(&connection);
+	mfd->addFollower(&sub.counters);
+	connection.wake();
+
+	// If the MFD has images, force its refresh if no image comes
+	if (!format.empty())
+		connection.setTimer((DWORD)(WEBMFD_FRAME_TIMEOUT_MS));
+}
+
+
+void CockpitSocket::_unsubscribe(SoConnection & connection, SubscriptionMap::iterator i)
+{
+	Subscription & sub = i->second;
+
+	// Stop being woken by the MFD, and reporting the counters of the subscription
+	sub.mfd->remListener(&connection);
+	sub.mfd->remFollower(&sub.counters);
+
+	// Release the frame that will never be sent
+	if (sub.mailbox)
+		sub.mailbox->Release();
+
+	// Close the MFD
+	Server::Instance().closeMFD(i->first, sub.format);
+
+	_subscriptions.erase(i);
+}
+
+
+void CockpitSocket::_collect(SoConnection & connection)
+{
+	for (SubscriptionMap::iterator i = _subscriptions.begin(); i != _subscriptions.end(); )
+	{
+		Subscription & sub = i->second;
+
+		// If the close button has been pressed, end the subscription
+		if (sub.mfd->getClose())
+		{
+			sendText(connection, "closed " + i->first);
+			_unsubscribe(connection, i++);
+			continue ;
+		}
+
+		// Send the button labels if they have changed: getJSONIf updates labelsId, so the labels are only sent once per change
+		std::string JSON = sub.mfd->getJSONIf(sub.labelsId);
+		if (!JSON.empty())
+			sendText(connection, "labels " + i->first + " " + JSON);
+
+		// Get the current frame if, and only if, it is newer than the one in the mailbox or than the last one sent
+		// A tiles frame must apply on top of the last frame sent, not of the frame waiting in the mailbox, which may never be sent
+		if (!sub.format.empty())
+		{
+			unsigned int id = (sub.format == "tiles") ? sub.sentId : sub.id;
+			DWORD time = 0;
+			SoBuffer * frame = (sub.format == "tiles") ? sub.mfd->getTilesIf(id, &time) : sub.mfd->getFrameIf(sub.format, id, 0, &time);
+
+			// The frame is already in the mailbox
+			if (frame && id == sub.id)
+				frame->Release();
+
+			// The newer frame replaces the one that has not been sent yet
+			else if (frame)
+			{
+				if (sub.mailbox)
+				{
+					sub.mailbox->Release();
+					sub.mfd->countDropped(sub.counters);
+				}
+				sub.mailbox = frame;
+				sub.id = id;
+				sub.time = time;
+				sub.fresh = true;
+			}
+		}
+
+		++i;
+	}
+}
+
+
+void CockpitSocket::_deliverFrames(SoConnection & connection)
+{
+	// The previous frames are still being sent: onSent will be called once they have been sent
+	if (connection.isSending())
+		return ;
+
+	// Send the frame of each mailbox in a binary message, after its header
+	// The frames are shared with all other followers and are sent without being copied
+	for (SubscriptionMap::iterator i = _subscriptions.begin(); i != _subscriptions.end(); ++i)
+	{
+		Subscription & sub = i->second;
+		if (!sub.mailbox)
+			continue ;
+
+		// The client has not displayed enough of the previous images: keep the frame, its acknowledgement will send it
+		if (sub.window && sub.inFlight >= sub.window)
+			continue ;
+
+		// The sending is traced from now until the connection has sent everything
+		SoBuffer * header = _buildFrameHeader(i->first, sub);
+		SoBuffer * parts[2] = { header, sub.mailbox };
+		sub.sendStart = TimingStats::Now();
+		bool sent = sendBinary(connection, parts, 2);
+
+		// Count the frame with its header, unless the WebSocket is closing
+		if (sent)
+			sub.mfd->countDelivered(sub.counters, header->Size() + sub.mailbox->Size());
+		header->Release();
+
+		// Empty the mailbox, the connection holds its own reference on the frame until it has been sent
+		sub.mailbox->Release();
+		sub.mailbox = 0;
+		sub.sentId = sub.id;
+		if (sub.window)
+			++sub.inFlight;
+	}
+}
+
+
+SoBuffer * CockpitSocket::_buildFrameHeader(const std::string & key, const Subscription & sub)
+{
+	SoBuffer * header = SoBuffer::Create(WEBMFD_COCKPIT_HEADER_SIZE + key.length());
+	char * data = header->Data();
+
+	// The frame id, the capture time, the dimensions of the MFD, the format and the length of the key
+	putBigEndian(data, sub.id, 4);
+	putBigEndian(data + 4, sub.time, 4);
+	putBigEndian(data + 8, sub.mfd->Width(), 2);
+	putBigEndian(data + 10, sub.mfd->Height(), 2);
+	data[12] = (char)sub.type;
+	data[13] = (char)key.length();
+
+	// The key of the MFD
+	memcpy(data + WEBMFD_COCKPIT_HEADER_SIZE, key.data(), key.length());
+
+	return header;
+}
@@ -0,0 +1,146 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __COCKPITSOCKET_H
+#define __COCKPITSOCKET_H
+
+#include "SoHTTP/SoWebSocket.h"
+#include "ServerMFD.h"
+
+#include <map>
+#include <string>
+
+/// The maximum number of MFDs a cockpit WebSocket can subscribe to
+#define WEBMFD_COCKPIT_MAX_MFDS	32
+
+/// The maximum number of images a client can ask to receive before acknowledging them
+#define WEBMFD_COCKPIT_MAX_WINDOW	16
+
+/// The size of the fixed part of the header of the binary messages, before the key
+#define WEBMFD_COCKPIT_HEADER_SIZE	14
+
+/// Handles the cockpit WebSocket: one WebSocket that carries all the MFDs of a client.
+/// Does not use any thread: it is called by the SoHTTP I/O threads, and is woken by the MFDs it subscribed to.
+/// The client sends text commands, whose words are separated by a space:
+///   - "sub <key> <format> [<window>]" subscribes to a MFD, opening it. The format is "png", "jpeg", "tiles" or "none" for the labels only.
+///     The window is the maximum number of images sent to the client and not yet acknowledged. 0 (the default) disables the acknowledgements.
+///     Subscribing again to the same key changes the format and the window.
+///   - "unsub <key>" unsubscribes from a MFD, closing it.
+///   - "btn <key> <id>" presses a button of a MFD. The id -1 asks for the button labels.
+///   - "ack <key> <id>" acknowledges that the image whose frame id is given has been displayed, which allows the next one to be sent.
+///     Acknowledging the last sent image acknowledges all the previous ones.
+/// The server sends:
+///   - "labels <key> <JSON>" text messages each time the button labels of a MFD change.
+///   - "closed <key>" text messages when the close button of a MFD has been pressed: the subscription has ended.
+///   - binary messages, one per image, made of a header whose integers are big endian, then the image (or the tiles frame, see ServerMFD::getTilesIf):
+///     the frame id on 32 bits, the capture time in milliseconds (server tick count) on 32 bits, the width and the height of the MFD on 16 bits each,
+///     the format on 8 bits (0 for png, 1 for jpeg, 2 for tiles), the length of the key on 8 bits, then the key.
+/// As for a MFDStream, each subscription has a one slot mailbox: a slow client skips images instead of falling behind.
+/// The images are sent when the socket has sent the previous ones and, if the subscription has a window, when the client has acknowledged enough images,
+/// so that they are sent at the rate the client can decode them.
+class CockpitSocket : public SoWebSocketHandler
+{
+public:
+	/// Constructor
+	CockpitSocket();
+
+	/// Destructor
+	/// Releases the frames left in the mailboxes.
+	virtual ~CockpitSocket();
+
+	/// Called when the previous images have been sent: traces their sending, then sends the frames waiting in the mailboxes.
+	virtual void	onSent(SoConnection & connection);
+
+	/// Called when a MFD has a new image or new button labels: sends them.
+	virtual void	onWake(SoConnection & connection);
+
+	/// Called when a MFD has not sent any image for a refreshing interval: forces its refresh.
+	virtual void	onTimer(SoConnection & connection);
+
+	/// Unsubscribes from all MFDs.
+	virtual void	onClose(SoConnection & connection);
+
+protected:
+	/// Handles a command of the client.
+	virtual void	onMessage(SoConnection & connection, int opcode, const char * data, size_t len);
+
+private:
+	/// The subscription to a MFD
+	struct Subscription
+	{
+		/// The MFD
+		ServerMFD *		mfd;
+
+		/// The format of the images: "png", "jpeg", "tiles" or "" for no image
+		std::string		format;
+
+		/// The code of the format in the header of the binary messages
+		unsigned char	type;
+
+		/// The maximum number of images sent and not yet acknowledged, 0 if the client does not acknowledge the images
+		unsigned int	window;
+
+		/// The number of images sent and not yet acknowledged
+		unsigned int	inFlight;
+
+		/// Id of the frame in the mailbox, or of the last sent frame if the mailbox is empty
+		unsigned int	id;
+
+		/// Id of the last sent frame, against which the tiles frames are fetched
+		unsigned int	sentId;
+
+		/// Id of the last button labels sent
+		unsigned int	labelsId;
+
+		/// The frame waiting to be sent, 0 if there is none. The socket holds a reference on it.
+		SoBuffer *		mailbox;
+
+		/// The capture time of the frame in the mailbox
+		DWORD			time;
+
+		/// Wether a frame has been received since the last timer
+		bool			fresh;
+
+		/// The performance counter at which the frame being sent has been queued on the connection, 0 if no frame is being sent
+		LONGLONG		sendStart;
+
+		/// The counters of the frames delivered to and dropped for the subscription, registered to the MFD
+		FollowerCounters	counters;
+	};
+
+	typedef std::map<std::string, Subscription> SubscriptionMap;
+
+	/// Subscribes to a MFD, replacing the previous subscription to the same key.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	key			The key of the MFD.
+	/// \param[in]	format		The format of the images.
+	/// \param[in]	window		The maximum number of images sent and not yet acknowledged, 0 for no acknowledgement.
+	void			_subscribe(SoConnection & connection, const std::string & key, const std::string & format, unsigned int window);
+
+	/// Unsubscribes from a MFD.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	i			The subscription, which is removed.
+	void			_unsubscribe(SoConnection & connection, SubscriptionMap::iterator i);
+
+	/// Sends the new button labels, puts the new frames in the mailboxes, and ends the subscriptions to the closed MFDs.
+	/// \param[in]	connection	The connection of the WebSocket.
+	void			_collect(SoConnection & connection);
+
+	/// Sends the frames of the mailboxes if the previous ones have been sent, and if their client has acknowledged enough of the previous ones.
+	/// \param[in]	connection	The connection of the WebSocket.
+	void			_deliverFrames(SoConnection & connection);
+
+	/// Builds the header of the binary message of a frame.
+	/// \param[in]	key			The key of the MFD.
+	/// \param[in]	sub			The subscription to the MFD, whose mailbox frame is sent.
+	/// \return The header, on which the caller holds the only reference.
+	static SoBuffer *	_buildFrameHeader(const std::string & key, const Subscription & sub);
+
+	/// The subscriptions, by MFD key
+	SubscriptionMap	_subscriptions;
+};
+
+#endif // __COCKPITSOCKET_H
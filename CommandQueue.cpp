@@ -0,0 +1,77 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "CommandQueue.h"
+#include "TimingStats.h"
+#include "SoHTTP/SoConnection.h"
+
+CommandQueue::CommandQueue()
+{
+	// The list starts with a stub node, so that the producers never have to handle an empty list
+	Node * stub = new Node;
+	stub->next = 0;
+	_head = stub;
+	_tail = stub;
+
+	// No command is queued
+	for (int i = 0; i < Command::TYPE_COUNT; ++i)
+		_pending[i] = 0;
+}
+
+
+CommandQueue::~CommandQueue()
+{
+	// Free every node, including the stub
+	// The commands of the nodes after the stub have not been popped: release the completion tokens they hold
+	// The command of the stub has already been popped, so its token belongs to the consumer
+	for (bool stub = true; _tail; stub = false)
+	{
+		Node * next = _tail->next;
+		if (!stub && _tail->command.completion)
+			_tail->command.completion->Release();
+		delete _tail;
+		_tail = next;
+	}
+}
+
+
+void CommandQueue::push(const Command & command)
+{
+	// Create the node, which is the last one of the list
+	Node * node = new Node;
+	node->next = 0;
+	node->command = command;
+	node->command.queued = TimingStats::Now();
+
+	// Count the command before it can be popped, so that the count never goes below 0
+	InterlockedIncrement(&_pending[command.type]);
+
+	// Make the node the head of the list: from now on, the next producers link their nodes after it
+	// The exchange is a full memory barrier, so the node is fully written before it can be reached
+	Node * prev = (Node *)InterlockedExchangePointer((PVOID volatile *)&_head, node);
+
+	// Link the previous head to the node, which makes it reachable by the consumer
+	prev->next = node;
+}
+
+
+bool CommandQueue::pop(Command & command)
+{
+	// The node holding the oldest command
+	Node * next = _tail->next;
+
+	// The queue is empty, or the producer of the next node has not linked it yet
+	if (!next)
+		return false;
+
+	// Take the command, the node becomes the new stub
+	command = next->command;
+	delete _tail;
+	_tail = next;
+	InterlockedDecrement(&_pending[command.type]);
+
+	return true;
+}
@@ -0,0 +1,116 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __COMMANDQUEUE_H
+#define __COMMANDQUEUE_H
+
+#include <Windows.h>
+
+class ServerMFD;
+class SoConnection;
+
+/// An order given to the main Orbiter thread, as the Orbiter API can only be used in that thread.
+struct Command
+{
+	/// The different orders
+	enum Type
+	{
+		/// Registers a newly created MFD in Orbiter
+		REGISTER,
+
+		/// Unregisters a MFD that has no followers anymore
+		UNREGISTER,
+
+		/// Forces the refresh of a MFD
+		REFRESH,
+
+		/// Presses a button of a MFD, then refreshes it unless the button closed it
+		BUTTON,
+
+		/// The number of orders
+		TYPE_COUNT
+	};
+
+	/// Constructor
+	/// \param[in]	t		The order.
+	/// \param[in]	m		The MFD the order is for.
+	/// \param[in]	btn		The id of the button, for the button orders.
+	/// \param[in]	c		The completion token, if any.
+	Command(Type t = REFRESH, ServerMFD * m = 0, int btn = 0, SoConnection * c = 0) : type(t), mfd(m), btnId(btn), completion(c), queued(0) {}
+
+	/// The order
+	Type		type;
+
+	/// The MFD the order is for
+	ServerMFD *	mfd;
+
+	/// The id of the button, for the button orders
+	int			btnId;
+
+	/// The completion token: the connection to wake once the command has been executed, 0 if nobody waits for it.
+	/// The command holds a reference on it.
+	SoConnection *	completion;
+
+	/// The performance counter (see TimingStats::Now) at which the command has been queued. Set by CommandQueue::push.
+	LONGLONG		queued;
+};
+
+/// Lock-free multiple producers / single consumer queue of the commands sent to the main Orbiter thread.
+/// Any thread can push a command without ever blocking on a lock held by another thread,
+/// and the main thread pops them, in the order they were pushed, without ever waiting.
+/// The queue is a linked list whose last node is swapped atomically by the producers (the Dmitry Vyukov intrusive MPSC queue),
+/// and whose first node is a stub that only the consumer reads and frees.
+class CommandQueue
+{
+public:
+	/// Constructor
+	CommandQueue();
+
+	/// Destructor
+	/// Frees the commands that have not been popped, releasing their completion tokens.
+	~CommandQueue();
+
+	/// Queues a command, stamping it with the time at which it has been queued.
+	/// Can be called from any thread, never blocks on another producer nor on the consumer.
+	/// \param[in]	command		The command.
+	void			push(const Command & command);
+
+	/// Gets the oldest command of the queue.
+	/// Must only be called from one thread at a time: the main Orbiter thread.
+	/// A producer that has been interrupted in the middle of push hides its command and the following ones until it resumes:
+	/// they are then popped at the next call, usually at the next Orbiter step.
+	/// \param[out]	command		Receives the command.
+	/// \return Wether there was a command.
+	bool			pop(Command & command);
+
+	/// Gets the number of commands of a type that are waiting in the queue.
+	/// Can be called from any thread. A command being pushed may already be counted before it can be popped.
+	/// \param[in]	type	The type of the commands.
+	/// \return the number of queued commands
+	unsigned int	Pending(Command::Type type) const { return (unsigned int)_pending[type]; }
+
+private:
+	/// A node of the list
+	struct Node
+	{
+		/// The next node, set by the producer that pushed it
+		Node * volatile	next;
+
+		/// The command
+		Command			command;
+	};
+
+	/// The last node pushed, swapped by the producers
+	Node * volatile	_head;
+
+	/// The node whose command has already been popped, whose next node holds the oldest command. Only accessed by the consumer.
+	Node *			_tail;
+
+	/// The number of queued commands, by type. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	_pending[Command::TYPE_COUNT];
+};
+
+#endif // __COMMANDQUEUE_H
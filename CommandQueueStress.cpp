@@ -0,0 +1,174 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+/// Standalone stress test of the CommandQueue, not part of the plugin.
+/// Several producer threads push commands while the main thread pops them, then the test checks that:
+/// the commands of each producer are popped in the order they were pushed, no command is lost or popped twice,
+/// and the pending counts of every type are back to 0 once the queue is empty.
+/// Build it as a console program, from the plugin directory:
+///     cl /EHsc /O2 CommandQueueStress.cpp CommandQueue.cpp TimingStats.cpp
+/// Usage: CommandQueueStress [producers] [commands per producer]
+
+#include "CommandQueue.h"
+#include "SoHTTP/SoConnection.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+/// The test never queues completion tokens, so the queue must never release one.
+/// Defined here so that the test does not have to link the whole SoHTTP library.
+void SoConnection::Release()
+{
+	fprintf(stderr, "FAIL: a completion token has been released\n");
+	exit(1);
+}
+
+/// The parameters of a producer thread
+struct Producer
+{
+	/// The queue to push to
+	CommandQueue *	queue;
+
+	/// The index of the producer, written in the commands as their MFD
+	unsigned int	index;
+
+	/// The number of commands to push
+	int				count;
+
+	/// The event on which all the producers wait, so that they start together
+	HANDLE			go;
+};
+
+/// Producer thread start function.
+/// Pushes the commands of the producer: each command carries the producer index as its MFD and its sequence number as its button,
+/// and the types are cycled so that every pending count is used.
+DWORD WINAPI produce(LPVOID lpParameter)
+{
+	Producer * p = (Producer*)lpParameter;
+
+	// Wait for all the producers to be ready
+	WaitForSingleObject(p->go, INFINITE);
+
+	// Push the commands
+	for (int i = 0; i < p->count; ++i)
+		p->queue->push(Command((Command::Type)(i % Command::TYPE_COUNT), (ServerMFD*)(size_t)(p->index + 1), i));
+
+	// Thread return value
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	// Read the parameters
+	unsigned int nbProducers = (argc > 1) ? (unsigned int)atoi(argv[1]) : 8;
+	int count = (argc > 2) ? atoi(argv[2]) : 1000000;
+	if (nbProducers == 0 || nbProducers > MAXIMUM_WAIT_OBJECTS || count <= 0)
+	{
+		fprintf(stderr, "Usage: %s [producers (1-%d)] [commands per producer]\n", argv[0], MAXIMUM_WAIT_OBJECTS);
+		return 2;
+	}
+
+	CommandQueue * queue = new CommandQueue;
+
+	// Create the producers, waiting for the start signal
+	HANDLE go = CreateEvent(NULL, TRUE, FALSE, NULL);
+	std::vector<Producer> producers(nbProducers);
+	std::vector<HANDLE> threads(nbProducers);
+	for (unsigned int p = 0; p < nbProducers; ++p)
+	{
+		producers[p].queue = queue;
+		producers[p].index = p;
+		producers[p].count = count;
+		producers[p].go = go;
+		threads[p] = CreateThread(NULL, 0, produce, (LPVOID)&producers[p], 0, NULL);
+	}
+
+	// The next sequence number expected from each producer
+	std::vector<int> expected(nbProducers, 0);
+
+	// The number of commands popped, by type
+	unsigned int popped[Command::TYPE_COUNT] = { 0 };
+
+	// Start the producers and pop all their commands
+	LONGLONG total = (LONGLONG)nbProducers * count;
+	LONGLONG received = 0;
+	DWORD start = GetTickCount();
+	SetEvent(go);
+	while (received < total)
+	{
+		Command command;
+		if (!queue->pop(command))
+		{
+			// A producer may hide the following commands until it resumes: let it run
+			SwitchToThread();
+			continue ;
+		}
+
+		// The command must come from a known producer
+		unsigned int p = (unsigned int)((size_t)command.mfd - 1);
+		if (p >= nbProducers)
+		{
+			fprintf(stderr, "FAIL: command from an unknown producer %u\n", p);
+			return 1;
+		}
+
+		// The command must be the next one of its producer: a lost command leaves a gap, a duplicated one comes back
+		if (command.btnId != expected[p])
+		{
+			fprintf(stderr, "FAIL: producer %u: got command %d, expected %d\n", p, command.btnId, expected[p]);
+			return 1;
+		}
+
+		// The command must have kept its type and have been stamped
+		if (command.type != (Command::Type)(command.btnId % Command::TYPE_COUNT) || command.queued == 0 || command.completion != 0)
+		{
+			fprintf(stderr, "FAIL: producer %u: command %d has been altered\n", p, command.btnId);
+			return 1;
+		}
+
+		++expected[p];
+		++popped[command.type];
+		++received;
+	}
+	DWORD elapsed = GetTickCount() - start;
+
+	// Wait for the producers to end
+	WaitForMultipleObjects((DWORD)nbProducers, &threads[0], TRUE, INFINITE);
+	for (unsigned int p = 0; p < nbProducers; ++p)
+		CloseHandle(threads[p]);
+	CloseHandle(go);
+
+	// Every command has been popped: the queue must be empty
+	Command extra;
+	if (queue->pop(extra))
+	{
+		fprintf(stderr, "FAIL: the queue has more commands than pushed\n");
+		return 1;
+	}
+
+	// The pending counts must be back to 0
+	for (int t = 0; t < Command::TYPE_COUNT; ++t)
+		if (queue->Pending((Command::Type)t) != 0)
+		{
+			fprintf(stderr, "FAIL: %u commands of type %d still pending\n", queue->Pending((Command::Type)t), t);
+			return 1;
+		}
+
+	// Destroying the queue with commands left must free them
+	for (int i = 0; i < 1000; ++i)
+		queue->push(Command(Command::REFRESH, (ServerMFD*)1));
+	if (queue->Pending(Command::REFRESH) != 1000)
+	{
+		fprintf(stderr, "FAIL: %u refreshes pending, expected 1000\n", queue->Pending(Command::REFRESH));
+		return 1;
+	}
+	delete queue;
+
+	printf("OK: %u producers, %I64d commands in %lu ms (register %u, unregister %u, refresh %u, button %u)\n",
+		nbProducers, total, elapsed, popped[Command::REGISTER], popped[Command::UNREGISTER], popped[Command::REFRESH], popped[Command::BUTTON]);
+	return 0;
+}
@@ -0,0 +1,217 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "EncoderPool.h"
+
+#include <limits.h>
+
+/// Worker thread start function.
+/// Just launch the _loop method on the given EncoderPool object pointer.
+DWORD WINAPI encoderLoop(LPVOID lpParameter)
+{
+	// Launch _loop
+	((EncoderPool*)lpParameter)->_loop();
+
+	// Thread return value
+	return 0;
+}
+
+
+EncoderPool::EncoderPool() : _queueDepth(0), _cancelling(0), _stopping(false), _queued(0), _rejected(0)
+{
+	// Create the mutex
+	_mutex = CreateMutex(NULL, FALSE, NULL);
+
+	// Create the cancellation event, automatically reset when cancel has waited for it
+	_cancelled = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	// Create the semaphore, with no job queued
+	_jobs = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+}
+
+
+EncoderPool::~EncoderPool()
+{
+	// Destroy the mutex, the semaphore and the event
+	CloseHandle(_mutex);
+	CloseHandle(_jobs);
+	CloseHandle(_cancelled);
+}
+
+
+bool	EncoderPool::start(unsigned int nbThreads, unsigned int queueDepth)
+{
+	// There must be at least one worker and one queued job
+	if (nbThreads == 0 || queueDepth == 0)
+		return false;
+
+	_queueDepth = queueDepth;
+	_stopping = false;
+
+	// Create the worker threads
+	for (unsigned int i = 0; i < nbThreads; ++i)
+		_threads.push_back(CreateThread(NULL, 0, encoderLoop, (LPVOID*)this, 0, NULL));
+
+	// The starting of the pool has succeeded
+	return true;
+}
+
+
+void	EncoderPool::stop()
+{
+	// Drop the queued jobs
+	WaitForSingleObject(_mutex, INFINITE);
+	_queue.clear();
+	_updateQueued();
+	_stopping = true;
+	ReleaseMutex(_mutex);
+
+	// Wake all the workers so that they see that the pool is stopping
+	if (!_threads.empty())
+		ReleaseSemaphore(_jobs, (LONG)_threads.size(), NULL);
+
+	// Wait for the workers to finish their current job and to end
+	if (!_threads.empty())
+		WaitForMultipleObjects((DWORD)_threads.size(), &_threads[0], TRUE, INFINITE);
+	for (std::vector<HANDLE>::iterator i = _threads.begin(); i != _threads.end(); ++i)
+		CloseHandle(*i);
+	_threads.clear();
+
+	// Consume the semaphore counts left by the dropped jobs
+	while (WaitForSingleObject(_jobs, 0) == WAIT_OBJECT_0)
+		;
+}
+
+
+bool	EncoderPool::push(ServerMFD * mfd, ServerMFD::Format format)
+{
+	// Wether a new job has been queued
+	bool queued = false;
+
+	// Wether the job is queued, either by this call or by a previous one
+	bool ret = false;
+
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// The jobs of a MFD being cancelled are refused, as the MFD is about to be destroyed
+	if (!_stopping && !_threads.empty() && mfd != _cancelling)
+	{
+		// Look for the same job in the queue
+		for (std::deque<Job>::iterator i = _queue.begin(); i != _queue.end(); ++i)
+			if (i->mfd == mfd && i->format == format)
+			{
+				ret = true;
+				break ;
+			}
+
+		// If the job is not already queued and there is room for it, queue it
+		if (!ret && _queue.size() < _queueDepth)
+		{
+			Job job;
+			job.mfd = mfd;
+			job.format = format;
+			_queue.push_back(job);
+			_updateQueued();
+			queued = ret = true;
+		}
+
+		// The queue is full: the MFD will be encoded at one of its next refreshes
+		else if (!ret)
+			InterlockedIncrement(&_rejected);
+	}
+
+	ReleaseMutex(_mutex);
+
+	// Wake a worker
+	if (queued)
+		ReleaseSemaphore(_jobs, 1, NULL);
+
+	return ret;
+}
+
+
+void	EncoderPool::cancel(ServerMFD * mfd)
+{
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// Refuse the jobs of the MFD from now on
+	// The refreshes of the MFD are pushed by the main Orbiter thread, which is the one cancelling,
+	// but its tiles keyframes are pushed by the I/O threads of its followers (see ServerMFD::getTilesIf)
+	_cancelling = mfd;
+
+	// Remove the queued jobs of the MFD
+	// The semaphore counts of the removed jobs only make workers find an empty queue
+	for (std::deque<Job>::iterator i = _queue.begin(); i != _queue.end(); )
+		if (i->mfd == mfd)
+			i = _queue.erase(i);
+		else
+			++i;
+	_updateQueued();
+
+	// If a worker is still encoding the MFD, the last one signals the end of its job
+	bool running = _running.find(mfd) != _running.end();
+
+	ReleaseMutex(_mutex);
+
+	// Wait for the running jobs of the MFD to end
+	if (running)
+		WaitForSingleObject(_cancelled, INFINITE);
+
+	// Accept the jobs of other MFDs that may later be allocated at the same address
+	// No follower can push a job for this MFD anymore: they all have closed it before the unregistration that destroys it was queued
+	WaitForSingleObject(_mutex, INFINITE);
+	_cancelling = 0;
+	ReleaseMutex(_mutex);
+}
+
+
+void	EncoderPool::_loop()
+{
+	for (;;)
+	{
+		// Wait for a job to be queued
+		WaitForSingleObject(_jobs, INFINITE);
+
+		WaitForSingleObject(_mutex, INFINITE);
+
+		// If the pool is stopping, stop the thread
+		if (_stopping)
+		{
+			ReleaseMutex(_mutex);
+			break ;
+		}
+
+		// The job may have been cancelled
+		if (_queue.empty())
+		{
+			ReleaseMutex(_mutex);
+			continue ;
+		}
+
+		// Take the first job, registering its MFD as being encoded so that it is not destroyed meanwhile
+		Job job = _queue.front();
+		_queue.pop_front();
+		_updateQueued();
+		std::multiset<ServerMFD*>::iterator running = _running.insert(job.mfd);
+
+		ReleaseMutex(_mutex);
+
+		// Encode the MFD image in the job format, timing the encodings that have produced a frame
+		LONGLONG start = TimingStats::Now();
+		if (job.mfd->_encode(job.format))
+			_timings[job.format].record(TimingStats::ToMicroseconds(TimingStats::Now() - start));
+
+		// The MFD is no longer being encoded by this worker
+		WaitForSingleObject(_mutex, INFINITE);
+		_running.erase(running);
+
+		// If the MFD is being cancelled and this was its last running job, wake cancel
+		if (_cancelling == job.mfd && _running.find(job.mfd) == _running.end())
+			SetEvent(_cancelled);
+
+		ReleaseMutex(_mutex);
+	}
+}
@@ -0,0 +1,128 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __ENCODERPOOL_H
+#define __ENCODERPOOL_H
+
+#include "ServerMFD.h"
+#include "TimingStats.h"
+
+#include <deque>
+#include <set>
+#include <vector>
+
+/// Pool of threads that encode the MFD images.
+/// When a MFD is refreshed, it pushes one job per image format that has followers.
+/// Each worker encodes one format of one MFD at a time, so the PNG and JPEG images of the same frame are encoded in parallel,
+/// and the encoding cost of all MFDs is spread across the cores.
+/// The job queue is bounded: a MFD whose job cannot be queued is simply encoded at one of its next refreshes.
+class EncoderPool
+{
+public:
+	/// Constructor
+	EncoderPool();
+
+	/// Destructor
+	~EncoderPool();
+
+	/// Starts the worker threads.
+	/// \param[in]	nbThreads	The number of worker threads.
+	/// \param[in]	queueDepth	The maximum number of jobs waiting to be encoded.
+	/// \return Wether the starting has succeeded or not.
+	bool			start(unsigned int nbThreads, unsigned int queueDepth);
+
+	/// Stops the worker threads, dropping the jobs that are still queued.
+	void			stop();
+
+	/// Queues the encoding of a format of a MFD.
+	/// Never blocks: this is called from the main Orbiter thread.
+	/// A job that is already queued for the same MFD and format is not queued twice,
+	/// as a job always encodes the latest MFD image.
+	/// \param[in]	mfd		The MFD to encode.
+	/// \param[in]	format	The format in which to encode it.
+	/// \return Wether the job is queued. False if the pool is not running, if the queue is full, or if the MFD is being cancelled.
+	bool			push(ServerMFD * mfd, ServerMFD::Format format);
+
+	/// Removes all the jobs of a MFD from the queue and waits for its running jobs to end.
+	/// Must be called before the MFD is destroyed, from the main Orbiter thread, which is the only one that destroys MFDs.
+	/// The jobs pushed for the MFD while it is being cancelled are refused.
+	/// The MFD cannot be kept alive by its jobs as Orbiter deletes it when it is unregistered,
+	/// so the wait is done on an event that the last worker encoding the MFD sets when it finishes its job.
+	/// \param[in]	mfd		The MFD.
+	void			cancel(ServerMFD * mfd);
+
+	/// Gets the number of jobs waiting to be encoded.
+	/// Is read without lock.
+	/// \return the number of queued jobs
+	unsigned int	QueueDepth() const { return (unsigned int)_queued; }
+
+	/// Gets the number of jobs that could not be queued because the queue was full.
+	/// \return the number of rejected jobs
+	unsigned int	Rejected() const { return (unsigned int)_rejected; }
+
+	/// Gets the timings of the encodings that have published a new frame in a format.
+	/// \param[in]	format	The format.
+	/// \return the timings
+	const TimingStats &	Timings(ServerMFD::Format format) const { return _timings[format]; }
+
+private:
+	/// The loop of each worker thread.
+	void			_loop();
+
+	/// Publishes the size of the queue for QueueDepth.
+	/// Must be called while holding _mutex, after each change of the queue.
+	void			_updateQueued() { InterlockedExchange(&_queued, (LONG)_queue.size()); }
+
+	/// An encoding job.
+	struct Job
+	{
+		/// The MFD to encode
+		ServerMFD *			mfd;
+
+		/// The format in which to encode it
+		ServerMFD::Format	format;
+	};
+
+	/// The worker threads.
+	std::vector<HANDLE>			_threads;
+
+	/// The queued jobs.
+	std::deque<Job>				_queue;
+
+	/// The maximum number of queued jobs.
+	size_t						_queueDepth;
+
+	/// The MFDs being encoded by a worker. A MFD is present once for each of its running jobs.
+	std::multiset<ServerMFD*>	_running;
+
+	/// The mutex to access _queue, _running and _cancelling.
+	HANDLE						_mutex;
+
+	/// The MFD being cancelled, whose jobs are refused and whose running jobs cancel is waiting for, or null.
+	ServerMFD *					_cancelling;
+
+	/// The event set by the last worker encoding _cancelling when it finishes its job.
+	HANDLE						_cancelled;
+
+	/// The semaphore counting the queued jobs, on which the workers wait.
+	HANDLE						_jobs;
+
+	/// Wether the pool is stopping.
+	volatile bool				_stopping;
+
+	/// The number of queued jobs, readable without lock.
+	volatile LONG				_queued;
+
+	/// The number of jobs that could not be queued.
+	volatile LONG				_rejected;
+
+	/// The timings of the encodings, by format.
+	TimingStats					_timings[ServerMFD::FORMAT_COUNT];
+
+	friend DWORD WINAPI encoderLoop(LPVOID lpParameter);
+};
+
+#endif // __ENCODERPOOL_H
@@ -0,0 +1,80 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "FrameTrace.h"
+#include "Stats.h"
+#include "TimingStats.h"
+
+#include <sstream>
+#include <string.h>
+
+/// The names of the stages in the trace, in the order of FrameTrace::Stage
+static const char * stageNames[FrameTrace::STAGE_COUNT] = { "blit", "copy", "encode png", "encode jpeg", "encode tiles", "send" };
+
+FrameTrace::FrameTrace() : _next(0)
+{
+	// No event has been recorded
+	for (int i = 0; i < WEBMFD_TRACE_EVENTS; ++i)
+		_events[i].seq = 0;
+}
+
+
+void FrameTrace::record(Stage stage, const std::string & key, unsigned int frame, LONGLONG start, LONGLONG end)
+{
+	// Take the next position, which is only given to this event
+	ULONG pos = (ULONG)InterlockedIncrement(&_next) - 1;
+	Event & e = _events[pos & (WEBMFD_TRACE_EVENTS - 1)];
+
+	// Mark the event as being written, so that a reader skips it
+	InterlockedExchange(&e.seq, 0);
+
+	// Write the event
+	e.stage = stage;
+	e.frame = frame;
+	e.thread = GetCurrentThreadId();
+	e.start = start;
+	e.end = end;
+	strncpy_s(e.key, WEBMFD_TRACE_KEY_SIZE, key.c_str(), _TRUNCATE);
+
+	// Publish the event: the exchange is a full memory barrier, so the event is fully written before its sequence number
+	InterlockedExchange(&e.seq, (LONG)(pos + 1));
+}
+
+
+std::string FrameTrace::ChromeJSON() const
+{
+	std::ostringstream out;
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	// Read the events from the oldest to the newest
+	// The positions are unsigned so that they keep their order when the counter wraps
+	ULONG next = (ULONG)InterlockedCompareExchange((volatile LONG *)&_next, 0, 0);
+	ULONG first = (next > WEBMFD_TRACE_EVENTS) ? next - WEBMFD_TRACE_EVENTS : 0;
+	bool empty = true;
+	for (ULONG pos = first; pos != next; ++pos)
+	{
+		const Event & e = _events[pos & (WEBMFD_TRACE_EVENTS - 1)];
+
+		// Copy the event, only keeping it if it has not been rewritten meanwhile
+		// The exchanges are full memory barriers, so the copy is read between the two sequence numbers
+		if (InterlockedCompareExchange((volatile LONG *)&e.seq, 0, 0) != (LONG)(pos + 1))
+			continue ;
+		Event copy;
+		memcpy(&copy, (const void *)&e, sizeof(Event));
+		if (InterlockedCompareExchange((volatile LONG *)&e.seq, 0, 0) != (LONG)(pos + 1))
+			continue ;
+		copy.key[WEBMFD_TRACE_KEY_SIZE - 1] = 0;
+
+		// Write a complete event, with the stage as name, the times in microseconds, and the MFD and frame as arguments
+		out << (empty ? "" : ",") << "{\"name\":\"" << stageNames[copy.stage] << "\",\"cat\":\"webmfd\",\"ph\":\"X\",\"pid\":1,\"tid\":" << copy.thread
+			<< ",\"ts\":" << TimingStats::ToMicroseconds(copy.start) << ",\"dur\":" << TimingStats::ToMicroseconds(copy.end - copy.start)
+			<< ",\"args\":{\"mfd\":\"" << Stats::JSONEscape(copy.key) << "\",\"frame\":" << copy.frame << "}}";
+		empty = false;
+	}
+
+	out << "]}";
+	return out.str();
+}
@@ -0,0 +1,105 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __FRAMETRACE_H
+#define __FRAMETRACE_H
+
+#include <Windows.h>
+#include <string>
+
+/// The number of events kept by the frame trace. Must be a power of two.
+#define WEBMFD_TRACE_EVENTS		4096
+
+/// The maximum number of characters of the MFD key kept in a trace event
+#define WEBMFD_TRACE_KEY_SIZE	24
+
+/// The trace of the life of the MFD frames, from the Orbiter refresh to the last byte sent to each follower.
+/// Each stage of a frame is recorded as an event with its start and end time, on the thread that did it:
+/// the blit of the Orbiter surface, the copy of the surface into the image, the encoding in each format, and the sending to each follower.
+/// The events of a frame are linked by the id of its image (see ServerMFD::getFrameIf).
+/// The events are kept in a ring buffer that the threads write without lock, the oldest events being overwritten by the newest ones.
+/// The ring can be rendered in the Chrome trace event format at any time, to be loaded in chrome://tracing or Perfetto.
+class FrameTrace
+{
+public:
+	/// The traced stages of a frame
+	enum Stage
+	{
+		/// The blit of the Orbiter surface into the MFD surface, in the main thread
+		BLIT = 0,
+
+		/// The copy of the MFD surface into the image, by the first encoder worker of the frame
+		COPY,
+
+		/// The encoding of the PNG image, by an encoder worker
+		/// The encoding stages are in the order of ServerMFD::Format
+		ENCODE_PNG,
+
+		/// The encoding of the JPEG image, by an encoder worker
+		ENCODE_JPEG,
+
+		/// The encoding of the tiles frames, by an encoder worker
+		ENCODE_TILES,
+
+		/// The sending of the frame to a follower, from its queuing on the connection to the sending of its last byte, in the I/O threads
+		SEND,
+
+		/// The number of stages
+		STAGE_COUNT
+	};
+
+	/// Constructor
+	FrameTrace();
+
+	/// Records an event.
+	/// Can be called from any thread, never blocks.
+	/// \param[in]	stage	The stage of the frame.
+	/// \param[in]	key		The key of the MFD.
+	/// \param[in]	frame	The id of the image of the frame.
+	/// \param[in]	start	The performance counter (see TimingStats::Now) at the beginning of the stage.
+	/// \param[in]	end		The performance counter at the end of the stage.
+	void			record(Stage stage, const std::string & key, unsigned int frame, LONGLONG start, LONGLONG end);
+
+	/// Renders the events of the ring in the Chrome trace event format (JSON).
+	/// The events being written while rendering are skipped.
+	/// \return the JSON document
+	std::string		ChromeJSON() const;
+
+private:
+	/// A traced event
+	struct Event
+	{
+		/// The sequence number of the event: 0 while it is being written, then its position in the recording order plus 1.
+		/// Is a LONG to be accessed with Interlocked functions.
+		volatile LONG	seq;
+
+		/// The stage
+		Stage			stage;
+
+		/// The id of the image of the frame
+		unsigned int	frame;
+
+		/// The thread that has recorded the event
+		DWORD			thread;
+
+		/// The performance counter at the beginning of the stage
+		LONGLONG		start;
+
+		/// The performance counter at the end of the stage
+		LONGLONG		end;
+
+		/// The key of the MFD, null terminated, truncated to WEBMFD_TRACE_KEY_SIZE - 1 characters
+		char			key[WEBMFD_TRACE_KEY_SIZE];
+	};
+
+	/// The position of the next event in the recording order. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	_next;
+
+	/// The ring of events
+	Event			_events[WEBMFD_TRACE_EVENTS];
+};
+
+#endif // __FRAMETRACE_H
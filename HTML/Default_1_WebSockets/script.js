@@ -1,5 +1,8 @@
 
-var format = "";
+var cockpit = null;
+
+// The number of images the server can send before they are acknowledged
+var imageWindow = 2;
 
 function getRandKey()
 {
@@ -27,7 +30,7 @@ function addMFD(div)
 	+	"	<button onclick=\"processButton('"+key+"', 4)\">.</button>"
 	+	"	<button onclick=\"processButton('"+key+"', 5)\">.</button>"
 	+	"</div>"
-	+	"<img src='/mfd/mfd."+format+"?key="+key+"' alt='MFD' />"
+	+	"<img alt='MFD' />"
 	+	"<div class='RBtn'>"
 	+	"	<button onclick=\"processButton('"+key+"', 6)\">.</button>"
 	+	"	<button onclick=\"processButton('"+key+"', 7)\">.</button>"
@@ -43,31 +46,33 @@ function addMFD(div)
 	+	"</div>"
 	);
 	$(div).appendChild(mfd);
-	createSocket(key);
+	cockpitSend('sub ' + key + ' png ' + imageWindow);
 }
 
 function removeMFD(key)
 {
+	cockpitSend('btn ' + key + ' 99');
+	cockpitSend('unsub ' + key);
+	closeMFD(key);
+}
+
+function closeMFD(key)
+{
+	if (!$(key))
+		return ;
 	$(key).cont.style.width = ($($(key).cont).getWidth() - 435) + 'px';
-	var socket = $(key).socket;
+	var img = $(key).getElementsByTagName('img')[0];
+	if (img.src)
+		URL.revokeObjectURL(img.src);
 	$(key).remove();
 	removeEmptyMFDsDiv();
-	if (socket)
-	{
-		socket.send("99");
-		socket.key = false;
-		delete socket;
-	}
 }
 
 function bodyOnLoad()
 {
-	if (Prototype.Browser.WebKit)
-		format = 'mpng';
-	else if (Prototype.Browser.Gecko)
-		format = 'mjpeg';
-	else
+	if (!window.WebSocket || !window.Blob || !window.URL)
 		return ;
+	openCockpit();
 	$(document.body).update(
 		"<div id='topBar'>"
 	+		"<button id='add' onclick='startAdd()'>+</button>"
@@ -124,52 +129,73 @@ function removeEmptyMFDsDiv()
 
 function processButton(key, id)
 {
-	$(key).socket.send(id.toPaddedString(2));
+	cockpitSend('btn ' + key + ' ' + id);
 }
 
-function createSocket(key)
+function cockpitSend(command)
 {
-	var socket = new WebSocket('ws://' + document.location.host + '/btn/?key=' + key);
-	if (!socket)
-	{
-		createSocket(key);
-		return ;
-	}
-	
-	socket.key = key;
-	$(key).socket = socket;
-	socket.onopen = function ()
+	if (cockpit && cockpit.readyState == 1)
+		cockpit.send(command);
+}
+
+function openCockpit()
+{
+	cockpit = new WebSocket('ws://' + document.location.host + '/ws/');
+	cockpit.binaryType = 'arraybuffer';
+
+	cockpit.onopen = function ()
 	{
-		this.send("-1");
+		$A(document.getElementsByClassName('MFD')).each(function(mfd)
+		{
+			if (mfd.id)
+				cockpitSend('sub ' + mfd.id + ' png ' + imageWindow);
+		});
 	};
-	socket.onmessage = function(evt)
+	cockpit.onmessage = function(evt)
 	{
-		if (evt.data.empty())
-		{
-			this.send("-1");
-			return ;
-		}
-		var btnTxt = evt.data.evalJSON();
-		if (this.key)
+		if (typeof evt.data == 'string')
 		{
-			var LBtns = $(this.key).getElementsByClassName('LBtn')[0].getElementsByTagName('button');
-			var RBtns = $(this.key).getElementsByClassName('RBtn')[0].getElementsByTagName('button');
-			for (var i = 0; i < 6; ++i)
+			var first = evt.data.indexOf(' ');
+			var second = evt.data.indexOf(' ', first + 1);
+			var command = evt.data.substring(0, first);
+			var key = (second < 0) ? evt.data.substring(first + 1) : evt.data.substring(first + 1, second);
+			if (!$(key))
+				return ;
+			if (command == 'closed')
+				closeMFD(key);
+			else if (command == 'labels')
 			{
-				$(LBtns[i]).update(btnTxt.left[i]);
-				$(RBtns[i]).update(btnTxt.right[i]);
+				var btnTxt = evt.data.substring(second + 1).evalJSON();
+				var LBtns = $(key).getElementsByClassName('LBtn')[0].getElementsByTagName('button');
+				var RBtns = $(key).getElementsByClassName('RBtn')[0].getElementsByTagName('button');
+				for (var i = 0; i < 6; ++i)
+				{
+					$(LBtns[i]).update(btnTxt.left[i]);
+					$(RBtns[i]).update(btnTxt.right[i]);
+				}
 			}
+			return ;
 		}
+
+		var header = new DataView(evt.data);
+		var frameId = header.getUint32(0);
+		var keyLength = header.getUint8(13);
+		var bytes = new Uint8Array(evt.data);
+		var key = String.fromCharCode.apply(null, bytes.subarray(14, 14 + keyLength));
+		if (!$(key))
+			return ;
+		var img = $(key).getElementsByTagName('img')[0];
+		if (img.src)
+			URL.revokeObjectURL(img.src);
+		img.onload = function ()
+		{
+			cockpitSend('ack ' + key + ' ' + frameId);
+		};
+		img.onerror = img.onload;
+		img.src = URL.createObjectURL(new Blob([bytes.subarray(14 + keyLength)], {type: 'image/png'}));
 	};
-	socket.onerror = function ()
-	{
-		alert("Error!");
-	};
-	socket.onclose = function ()
+	cockpit.onclose = function ()
 	{
-		if (this.key)
-			socket = createSocket(this.key);
+		setTimeout(openCockpit, 1000);
 	};
-
-	return socket;
 }
@@ -0,0 +1,76 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+/// The hash is inspired from the xxHash32 algorithm (http://code.google.com/p/xxhash/) by Yann Collet.
+
+#include "HashPixels.h"
+
+/// xxHash32 primes
+#define PRIME32_1	2654435761U
+#define PRIME32_2	2246822519U
+#define PRIME32_3	3266489917U
+#define PRIME32_4	668265263U
+#define PRIME32_5	374761393U
+
+/// Rotates a 32 bits integer to the left
+#define ROTL32(x, r)	(((x) << (r)) | ((x) >> (32 - (r))))
+
+UINT32 hashPixels(const void * data, size_t len)
+{
+	const unsigned char * p = (const unsigned char *)data;
+	const unsigned char * end = p + len;
+	UINT32 h;
+
+	// Hash 16 bytes at a time, in four independent lanes
+	if (len >= 16)
+	{
+		const unsigned char * limit = end - 16;
+		UINT32 v1 = PRIME32_1 + PRIME32_2;
+		UINT32 v2 = PRIME32_2;
+		UINT32 v3 = 0;
+		UINT32 v4 = 0 - PRIME32_1;
+
+		do
+		{
+			v1 += *(const UINT32 *)p * PRIME32_2; v1 = ROTL32(v1, 13); v1 *= PRIME32_1; p += 4;
+			v2 += *(const UINT32 *)p * PRIME32_2; v2 = ROTL32(v2, 13); v2 *= PRIME32_1; p += 4;
+			v3 += *(const UINT32 *)p * PRIME32_2; v3 = ROTL32(v3, 13); v3 *= PRIME32_1; p += 4;
+			v4 += *(const UINT32 *)p * PRIME32_2; v4 = ROTL32(v4, 13); v4 *= PRIME32_1; p += 4;
+		}
+		while (p <= limit);
+
+		h = ROTL32(v1, 1) + ROTL32(v2, 7) + ROTL32(v3, 12) + ROTL32(v4, 18);
+	}
+	else
+		h = PRIME32_5;
+
+	h += (UINT32)len;
+
+	// Hash the remaining 4 bytes words
+	while (p + 4 <= end)
+	{
+		h += *(const UINT32 *)p * PRIME32_3;
+		h = ROTL32(h, 17) * PRIME32_4;
+		p += 4;
+	}
+
+	// Hash the remaining bytes
+	while (p < end)
+	{
+		h += (*p) * PRIME32_5;
+		h = ROTL32(h, 11) * PRIME32_1;
+		++p;
+	}
+
+	// Final mix, so that every input bit affects every output bit
+	h ^= h >> 15;
+	h *= PRIME32_2;
+	h ^= h >> 13;
+	h *= PRIME32_3;
+	h ^= h >> 16;
+
+	return h;
+}
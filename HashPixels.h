@@ -0,0 +1,20 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __HASHPIXELS_H
+#define __HASHPIXELS_H
+
+#include <Windows.h>
+
+/// Returns a fast, non cryptographic, hash of the given pixels (inspired from xxHash32).
+/// Uses four independent accumulators over 16 bytes blocks, which keeps the processor pipelines (and the compiler vectorizer) busy.
+/// The hash only depends on the data, so two images with the same hash are considered identical.
+/// \param[in]	data	The pixels to hash.
+/// \param[in]	len		The number of bytes to hash.
+/// \return The hash of the pixels.
+UINT32 hashPixels(const void * data, size_t len);
+
+#endif // __HASHPIXELS_H
@@ -6,6 +6,7 @@
 
 #include "LaunchpadWebMFD.h"
 #include "resource.h"
+#include "SoHTTP/SoDeflate.h"
 #include <sstream>
 #include <atlimage.h>
 #include <stdlib.h>
@@ -13,6 +14,23 @@
 /// The default port value if it has not been configured yet
 #define WEBMFD_DEFAULT_PORT_VALUE	8042
 
+/// The default number of image encoder threads if it has not been configured yet
+#define WEBMFD_DEFAULT_ENCODER_THREADS	2
+
+/// The default image encoder queue depth if it has not been configured yet
+#define WEBMFD_DEFAULT_ENCODER_QUEUE	32
+
+/// The default PNG compression level if it has not been configured yet
+#define WEBMFD_DEFAULT_PNG_LEVEL	SODEFLATE_DEFAULT_LEVEL
+
+/// The default time, in seconds, during which the browsers can use the web interfaces files without revalidating them, if it has not been configured yet
+/// 0 makes the browsers revalidate every file on each load, which is answered by a 304 if the file has not changed
+#define WEBMFD_DEFAULT_WEB_MAX_AGE	0
+
+/// The default time, in microseconds, that the main thread can spend in a simulation step for the MFDs, if it has not been configured yet
+/// The work that does not fit is done at the next steps
+#define WEBMFD_DEFAULT_STEP_BUDGET_US	2000
+
 /// The configuration file path
 #define WEBMFD_CONF_FILE_PATH		"Modules\\WebMFD.cfg"
 
@@ -54,8 +72,13 @@ BOOL CALLBACK DlgProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
 LaunchpadWebMFD::LaunchpadWebMFD(HINSTANCE hDLL) : hModule(hDLL), LaunchpadItem()
 {
-	// Set the port to its default value
+	// Set the port, the encoder pool, the PNG compression level, the web files max-age and the step time budget to their default values
 	_port = WEBMFD_DEFAULT_PORT_VALUE;
+	_encoderThreads = WEBMFD_DEFAULT_ENCODER_THREADS;
+	_encoderQueue = WEBMFD_DEFAULT_ENCODER_QUEUE;
+	_pngLevel = WEBMFD_DEFAULT_PNG_LEVEL;
+	_webMaxAge = WEBMFD_DEFAULT_WEB_MAX_AGE;
+	_stepBudgetUs = WEBMFD_DEFAULT_STEP_BUDGET_US;
 
 	// Open the configuration file on read only
 	FILEHANDLE hFile = oapiOpenFile(WEBMFD_CONF_FILE_PATH, FILE_IN, CONFIG);
@@ -70,6 +93,28 @@ LaunchpadWebMFD::LaunchpadWebMFD(HINSTANCE hDLL) : hModule(hDLL), LaunchpadItem(
 	if (oapiReadItem_int(hFile, "PORT", portTMP))
 		_port = portTMP;
 
+	// Read the encoder pool size and queue depth and set them if they are valid
+	int encoderTMP;
+	if (oapiReadItem_int(hFile, "ENCODER_THREADS", encoderTMP) && encoderTMP > 0)
+		_encoderThreads = encoderTMP;
+	if (oapiReadItem_int(hFile, "ENCODER_QUEUE", encoderTMP) && encoderTMP > 0)
+		_encoderQueue = encoderTMP;
+
+	// Read the PNG compression level and set it if it is valid
+	int levelTMP;
+	if (oapiReadItem_int(hFile, "PNG_LEVEL", levelTMP) && levelTMP >= 0 && levelTMP <= 9)
+		_pngLevel = levelTMP;
+
+	// Read the web files max-age and set it if it is valid
+	int maxAgeTMP;
+	if (oapiReadItem_int(hFile, "WEB_MAX_AGE", maxAgeTMP) && maxAgeTMP >= 0)
+		_webMaxAge = maxAgeTMP;
+
+	// Read the step time budget and set it if it is valid (0 for no limit)
+	int budgetTMP;
+	if (oapiReadItem_int(hFile, "STEP_BUDGET_US", budgetTMP) && budgetTMP >= 0)
+		_stepBudgetUs = budgetTMP;
+
 	// Closes the configuration file
 	oapiCloseFile (hFile, FILE_IN);
 }
@@ -104,6 +149,11 @@ int LaunchpadWebMFD::clbkWriteConfig()
 	
 	// Write the configuration
 	oapiWriteItem_int(hFile, "PORT", _port);
+	oapiWriteItem_int(hFile, "ENCODER_THREADS", _encoderThreads);
+	oapiWriteItem_int(hFile, "ENCODER_QUEUE", _encoderQueue);
+	oapiWriteItem_int(hFile, "PNG_LEVEL", _pngLevel);
+	oapiWriteItem_int(hFile, "WEB_MAX_AGE", _webMaxAge);
+	oapiWriteItem_int(hFile, "STEP_BUDGET_US", _stepBudgetUs);
 
 	// Closes the configuration file
 	oapiCloseFile(hFile, FILE_OUT);
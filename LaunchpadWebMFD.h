@@ -58,12 +58,47 @@ public:
 	/// \return The port on which the server will be running
 	int Port() { return _port; }
 
+	/// Get the number of threads that will encode the MFD images
+	/// \return The number of encoder threads
+	int EncoderThreads() { return _encoderThreads; }
+
+	/// Get the maximum number of MFD images that can wait to be encoded
+	/// \return The encoder queue depth
+	int EncoderQueue() { return _encoderQueue; }
+
+	/// Get the compression level of the PNG images, from 0 (fastest) to 9 (smallest)
+	/// \return The PNG compression level
+	int PngLevel() { return _pngLevel; }
+
+	/// Get the time, in seconds, during which the browsers can use the web interfaces files without revalidating them
+	/// \return The web files max-age
+	int WebMaxAge() { return _webMaxAge; }
+
+	/// Get the time, in microseconds, that the main thread can spend in a simulation step for the MFDs, 0 for no limit
+	/// \return The step time budget
+	int StepBudgetUs() { return _stepBudgetUs; }
+
 private:
 	/// The WebMFD module DLL
 	HINSTANCE	hModule;
 	
 	/// The port on which the server will be running
 	int _port;
+
+	/// The number of threads that will encode the MFD images
+	int _encoderThreads;
+
+	/// The maximum number of MFD images that can wait to be encoded
+	int _encoderQueue;
+
+	/// The compression level of the PNG images
+	int _pngLevel;
+
+	/// The time during which the browsers can use the web interfaces files without revalidating them
+	int _webMaxAge;
+
+	/// The time that the main thread can spend in a simulation step for the MFDs
+	int _stepBudgetUs;
 };
 
 #endif // __LAUNCHPAD_WEB_MFD_H
@@ -0,0 +1,178 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "MFDRegistry.h"
+
+MFDRegistry::MFDRegistry(CommandQueue & commands) : _commands(commands)
+{
+	// Create the lock of each shard
+	for (int i = 0; i < WEBMFD_REGISTRY_SHARDS; ++i)
+		InitializeCriticalSectionAndSpinCount(&_shards[i].lock, WEBMFD_REGISTRY_SPIN);
+}
+
+
+MFDRegistry::~MFDRegistry()
+{
+	// Delete the lock of each shard
+	for (int i = 0; i < WEBMFD_REGISTRY_SHARDS; ++i)
+		DeleteCriticalSection(&_shards[i].lock);
+}
+
+
+ServerMFD * MFDRegistry::open(const std::string & key, const std::string & format, bool create)
+{
+	Shard & shard = _shard(key);
+
+	_lock(shard);
+
+	// Look for the MFD, only once
+	MFDMap::iterator i = shard.mfds.find(key);
+
+	// If the MFD does not exist
+	if (i == shard.mfds.end())
+	{
+		// Return null pointer if not asked to create a MFD
+		if (!create)
+		{
+			LeaveCriticalSection(&shard.lock);
+			return 0;
+		}
+
+		// Create a new MFD
+		i = shard.mfds.insert(MFDMap::value_type(key, new ServerMFD(key))).first;
+
+		// Add the MFD to Orbiter registration queue
+		// We are probably not in the main (Orbiter) thread
+		// Therefore, we cannot use directly the Orbiter API as Orbiter is not thread-safe (Martin Schweiger if you read this...)
+		// It is queued before the lock is released, so that it comes before any command given by the followers of the MFD
+		_commands.push(Command(Command::REGISTER, i->second));
+	}
+
+	// Register the given format, for a new MFD as well as for an existing one, as close will unregister it
+	ServerMFD * mfd = i->second;
+	if (format == "png")
+		mfd->addPng();
+	else if (format == "jpeg")
+		mfd->addJpeg();
+	else if (format == "tiles")
+		mfd->addTiles();
+	else
+		mfd->addNox();
+
+	LeaveCriticalSection(&shard.lock);
+
+	// Return the MFD
+	return mfd;
+}
+
+
+void MFDRegistry::close(const std::string & key, const std::string & format)
+{
+	Shard & shard = _shard(key);
+
+	_lock(shard);
+
+	// If the given key references a registered MFD
+	MFDMap::iterator i = shard.mfds.find(key);
+	if (i != shard.mfds.end())
+	{
+		ServerMFD * mfd = i->second;
+
+		// Unregister the given format
+		if (format == "png")
+			mfd->remPng();
+		else if (format == "jpeg")
+			mfd->remJpeg();
+		else if (format == "tiles")
+			mfd->remTiles();
+		else
+			mfd->remNox();
+
+		// If the MFD has no "followers" any more
+		if (mfd->Followers() == 0)
+		{
+			// Add the MFD to Orbiter unregistration queue
+			// We are probably not in the main (Orbiter) thread
+			// Therefore, we cannot use directly the Orbiter API as Orbiter is not thread-safe (Martin Schweiger if you read this...)
+			_commands.push(Command(Command::UNREGISTER, mfd));
+
+			// Remove the MFD from the registered MFDs map
+			shard.mfds.erase(i);
+		}
+	}
+
+	LeaveCriticalSection(&shard.lock);
+}
+
+
+void MFDRegistry::clear(std::vector<ServerMFD*> & mfds)
+{
+	// Empty each shard, giving its MFDs to the caller
+	for (int s = 0; s < WEBMFD_REGISTRY_SHARDS; ++s)
+	{
+		_lock(_shards[s]);
+		for (MFDMap::iterator i = _shards[s].mfds.begin(); i != _shards[s].mfds.end(); ++i)
+			mfds.push_back(i->second);
+		_shards[s].mfds.clear();
+		LeaveCriticalSection(&_shards[s].lock);
+	}
+}
+
+
+void MFDRegistry::collect(std::vector<MFDStats> & stats)
+{
+	// Copy the counters of the MFDs of each shard
+	// The MFDs cannot be unregistered, and therefore destroyed, while the lock of their shard is held
+	for (int s = 0; s < WEBMFD_REGISTRY_SHARDS; ++s)
+	{
+		_lock(_shards[s]);
+		for (MFDMap::iterator i = _shards[s].mfds.begin(); i != _shards[s].mfds.end(); ++i)
+		{
+			ServerMFD * mfd = i->second;
+			MFDStats mfdStats;
+			mfdStats.key = i->first;
+			mfdStats.png = mfd->PngFollowers();
+			mfdStats.jpeg = mfd->JpegFollowers();
+			mfdStats.tiles = mfd->TilesFollowers();
+			mfdStats.nox = mfd->NoxFollowers();
+			mfdStats.encoded = mfd->EncodedFrames();
+			mfdStats.skipped = mfd->SkippedEncodes();
+			mfdStats.delivered = mfd->DeliveredFrames();
+			mfdStats.dropped = mfd->DroppedFrames();
+			mfdStats.bytesOut = mfd->BytesOut();
+			mfd->collectFollowers(mfdStats.followers);
+			stats.push_back(mfdStats);
+		}
+		LeaveCriticalSection(&_shards[s].lock);
+	}
+}
+
+
+MFDRegistry::Shard & MFDRegistry::_shard(const std::string & key)
+{
+	// Hash the key with FNV-1a, which spreads the random keys given by the clients as well as the short hand-written ones
+	UINT32 hash = 2166136261U;
+	for (std::string::const_iterator i = key.begin(); i != key.end(); ++i)
+		hash = (hash ^ (unsigned char)*i) * 16777619U;
+
+	return _shards[hash & (WEBMFD_REGISTRY_SHARDS - 1)];
+}
+
+
+void MFDRegistry::_lock(Shard & shard)
+{
+	// Most of the time, the lock is free: take it without reading the performance counter
+	if (TryEnterCriticalSection(&shard.lock))
+	{
+		_lockFree.increment();
+		return ;
+	}
+
+	// The lock is held by another thread: time the wait
+	LONGLONG start = TimingStats::Now();
+	EnterCriticalSection(&shard.lock);
+	_lockWaits.record(TimingStats::ToMicroseconds(TimingStats::Now() - start));
+}
@@ -0,0 +1,140 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __MFDREGISTRY_H
+#define __MFDREGISTRY_H
+
+#include "CommandQueue.h"
+#include "ServerMFD.h"
+#include "TimingStats.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// The number of shards of the MFD registry. Must be a power of two.
+#define WEBMFD_REGISTRY_SHARDS	16
+
+/// The spin count of the lock of each shard: opening or closing a MFD is short, so spinning is cheaper than waiting in the kernel
+#define WEBMFD_REGISTRY_SPIN	4000
+
+/// The counters of an opened MFD, read by MFDRegistry::collect
+struct MFDStats
+{
+	/// The key of the MFD
+	std::string		key;
+
+	/// The number of PNG followers
+	unsigned int	png;
+
+	/// The number of JPEG followers
+	unsigned int	jpeg;
+
+	/// The number of tiles followers
+	unsigned int	tiles;
+
+	/// The number of followers with no image interest
+	unsigned int	nox;
+
+	/// The number of frames encoded, in all formats
+	unsigned int	encoded;
+
+	/// The number of refreshes of the MFD surface that have not produced a new image, as its pixels had not changed
+	unsigned int	skipped;
+
+	/// The number of frames sent by the follower streams
+	unsigned int	delivered;
+
+	/// The number of frames dropped by the follower streams
+	unsigned int	dropped;
+
+	/// The number of bytes sent by the follower streams
+	LONGLONG		bytesOut;
+
+	/// The counters of each follower
+	std::vector<FollowerCounters>	followers;
+};
+
+/// The MFDs opened by the followers, by key.
+/// The keys are spread across shards, each with its own map and its own lock:
+/// opening or closing a MFD only contends with the MFDs of the same shard, never with the commands given to the main thread.
+/// The locks are critical sections, which do not enter the kernel when they are not contended.
+/// Can be used from any thread.
+class MFDRegistry
+{
+public:
+	/// Constructor
+	/// \param[in]	commands	The queue in which the registrations and unregistrations of the MFDs in Orbiter are given to the main thread.
+	MFDRegistry(CommandQueue & commands);
+
+	/// Destructor
+	~MFDRegistry();
+
+	/// Opens a MFD, creating it and queuing its registration if it does not exist.
+	/// \param[in]	key		The key of the MFD.
+	/// \param[in]	format	"png", "jpeg", "tiles" or "": the format the follower will be looking at.
+	/// \param[in]	create	Wether to create the MFD if it does not exist.
+	/// \return The MFD, or 0 if it does not exist and create is false.
+	ServerMFD *		open(const std::string & key, const std::string & format, bool create);
+
+	/// Closes a MFD, removing it and queuing its unregistration if it has no followers anymore.
+	/// \param[in]	key		The key of the MFD.
+	/// \param[in]	format	The format given to open.
+	void			close(const std::string & key, const std::string & format);
+
+	/// Removes all the MFDs.
+	/// \param[out]	mfds	Receives the removed MFDs, which have to be unregistered by the caller.
+	void			clear(std::vector<ServerMFD*> & mfds);
+
+	/// Reads the counters of all the opened MFDs.
+	/// Only holds the lock of one shard at a time, while copying the counters of its MFDs.
+	/// \param[out]	stats	Receives the counters of each MFD.
+	void			collect(std::vector<MFDStats> & stats);
+
+	/// Gets the time spent waiting for the lock of a shard, for the locks that were contended.
+	/// \return the timings
+	const TimingStats &	LockWaits() const { return _lockWaits; }
+
+	/// Gets the number of times the lock of a shard has been taken without waiting.
+	/// \return the number of uncontended locks
+	LONGLONG		LockFree() const { return _lockFree.Value(); }
+
+private:
+	typedef std::map<std::string, ServerMFD*> MFDMap;
+
+	/// A part of the registry
+	struct Shard
+	{
+		/// The lock to access the map
+		CRITICAL_SECTION	lock;
+
+		/// The MFDs of the shard, by key
+		MFDMap				mfds;
+	};
+
+	/// Gets the shard of a key.
+	/// \param[in]	key		The key of the MFD.
+	/// \return The shard.
+	Shard &			_shard(const std::string & key);
+
+	/// Takes the lock of a shard, timing the wait if it is held by another thread.
+	/// \param[in]	shard	The shard.
+	void			_lock(Shard & shard);
+
+	/// The queue of the commands given to the main thread
+	CommandQueue &	_commands;
+
+	/// The shards
+	Shard			_shards[WEBMFD_REGISTRY_SHARDS];
+
+	/// The time spent waiting for the contended locks
+	TimingStats		_lockWaits;
+
+	/// The number of locks taken without waiting
+	SoCounter		_lockFree;
+};
+
+#endif // __MFDREGISTRY_H
@@ -0,0 +1,171 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "MFDStream.h"
+#include "Server.h"
+#include "Stats.h"
+
+/// Gets the type of connection of a stream, to count it.
+/// \param[in]	format	The format of the images: "png", "jpeg" or "tiles".
+/// \return the type of connection
+static Stats::Connection streamType(const std::string & format)
+{
+	if (format == "png")
+		return Stats::STREAM_PNG;
+	if (format == "jpeg")
+		return Stats::STREAM_JPEG;
+	return Stats::STREAM_TILES;
+}
+
+MFDStream::MFDStream(SoConnection & connection, ServerMFD * mfd, const std::string & key, const std::string & format) :
+	_mfd(mfd), _key(key), _format(format), _id(0), _sentId(0), _mailbox(0), _mailboxHeader(0), _sendStart(0), _counters("stream", format)
+{
+	// Be woken by the MFD each time its image changes, and report the counters of the follower with those of the MFD
+	_mfd->addListener(&connection);
+	_mfd->addFollower(&_counters);
+
+	// Count the stream
+	Stats::opened(streamType(_format));
+}
+
+
+MFDStream::~MFDStream()
+{
+	// Release the frame that was never sent
+	if (_mailbox)
+		_mailbox->Release();
+	if (_mailboxHeader)
+		_mailboxHeader->Release();
+
+	// Count the end of the stream
+	Stats::closed(streamType(_format));
+}
+
+
+void MFDStream::onSent(SoConnection & connection)
+{
+	// Trace the sending of the previous frame, which has fully left the socket
+	if (_sendStart)
+	{
+		Server::Instance().Trace().record(FrameTrace::SEND, _key, _sentId, _sendStart, TimingStats::Now());
+		_sendStart = 0;
+	}
+
+	// The socket can take more data: send the frame that has been published while the previous one was being sent
+	_deliverFrame(connection);
+}
+
+
+void MFDStream::onWake(SoConnection & connection)
+{
+	// The MFD has changed: keep its latest frame, and send it if the connection is not busy
+	if (_collectFrame(connection))
+		_deliverFrame(connection);
+}
+
+
+void MFDStream::onTimer(SoConnection & connection)
+{
+	// No image has come for a refreshing interval: force the MFD refresh, which will wake the stream
+	Server::Instance().forceRefresh(_mfd);
+
+	// Wait for another refreshing interval
+	connection.setTimer((DWORD)(WEBMFD_FRAME_TIMEOUT_MS));
+}
+
+
+void MFDStream::onClose(SoConnection & connection)
+{
+	// Stop being woken by the MFD, and reporting the counters of the follower
+	_mfd->remListener(&connection);
+	_mfd->remFollower(&_counters);
+
+	// Close the MFD
+	Server::Instance().closeMFD(_key, _format);
+}
+
+
+bool MFDStream::_collectFrame(SoConnection & connection)
+{
+	// If the close button has been pressed, break the stream
+	if (_mfd->getClose())
+	{
+		connection.close();
+		return false;
+	}
+
+	// The id against which the MFD frame is compared
+	// A tiles frame must apply on top of the last frame sent, not of the frame waiting in the mailbox, which may never be sent
+	unsigned int id = (_format == "tiles") ? _sentId : _id;
+
+	// Get the current frame (and the header of an image) if, and only if, it is newer than the given id, which is then updated to the id of the frame
+	SoBuffer * header = 0;
+	SoBuffer * frame = (_format == "tiles") ? _mfd->getTilesIf(id) : _mfd->getFrameIf(_format, id, &header);
+
+	// No new frame
+	if (!frame)
+		return true;
+
+	// The frame is already in the mailbox
+	if (id == _id)
+	{
+		frame->Release();
+		if (header)
+			header->Release();
+		return true;
+	}
+
+	// The newer frame replaces the one that has not been sent yet
+	if (_mailbox)
+	{
+		_mailbox->Release();
+		if (_mailboxHeader)
+			_mailboxHeader->Release();
+		_mfd->countDropped(_counters);
+	}
+	_mailbox = frame;
+	_mailboxHeader = header;
+	_id = id;
+
+	return true;
+}
+
+
+void MFDStream::_deliverFrame(SoConnection & connection)
+{
+	// Nothing to send, or the previous frame is still being sent: onSent will be called once it has been sent
+	if (!_mailbox || connection.isSending())
+		return ;
+
+	// The image frames are sent in the motion image stream after their header
+	// The tiles frames are self delimited binary messages: they are sent as they are
+	// Both buffers are shared with all other followers and are sent in one vectored write, without being copied
+	// The sending is traced from now until the connection has sent everything
+	SoBuffer * parts[2];
+	int nbParts = 0;
+	if (_mailboxHeader)
+		parts[nbParts++] = _mailboxHeader;
+	parts[nbParts++] = _mailbox;
+	_sendStart = TimingStats::Now();
+	connection.send(parts, nbParts);
+
+	// Count the frame with its header
+	size_t bytes = 0;
+	for (int i = 0; i < nbParts; ++i)
+		bytes += parts[i]->Size();
+	_mfd->countDelivered(_counters, bytes);
+
+	// Empty the mailbox, the connection holds its own reference on the buffers until they have been sent
+	_mailbox->Release();
+	_mailbox = 0;
+	if (_mailboxHeader)
+		_mailboxHeader->Release();
+	_mailboxHeader = 0;
+	_sentId = _id;
+
+	// A frame has been sent: restart the time after which the MFD refresh is forced
+	connection.setTimer((DWORD)(WEBMFD_FRAME_TIMEOUT_MS));
+}
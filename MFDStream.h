@@ -0,0 +1,90 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __MFDSTREAM_H
+#define __MFDSTREAM_H
+
+#include "SoHTTP/SoConnection.h"
+#include "ServerMFD.h"
+
+#include <string>
+
+/// Handles the motion image stream (multipart/x-mixed-replace) or the tiles stream (see ServerMFD::getTilesIf) of a MFD on a SoHTTP connection.
+/// Does not use any thread: it is called by the SoHTTP I/O threads.
+/// Does not poll either: the MFD wakes the connection each time its image changes.
+/// Each stream has a one slot mailbox: the latest frame waits there while the previous one is being sent,
+/// and a newer frame replaces it if it has not been sent yet. A slow follower therefore skips frames
+/// instead of falling behind, and never holds anything that a fast follower waits for.
+class MFDStream : public SoConnectionHandler
+{
+public:
+	/// Constructor
+	/// Registers the connection as a listener of the MFD, and its counters as those of a follower.
+	/// \param[in]	connection	The connection on which the stream is sent.
+	/// \param[in]	mfd			The opened MFD to stream. Will be closed when the connection closes.
+	/// \param[in]	key			The key on which the MFD was opened.
+	/// \param[in]	format		The format of the images: "png", "jpeg" or "tiles".
+	MFDStream(SoConnection & connection, ServerMFD * mfd, const std::string & key, const std::string & format);
+
+	/// Destructor
+	/// Releases the frame left in the mailbox.
+	virtual ~MFDStream();
+
+	/// Ignores everything the client sends.
+	virtual bool	onReceive(SoConnection & connection, const char * data, int len) { return true; }
+
+	/// Called when the previous image has been sent: traces its sending, then sends the frame waiting in the mailbox, if any.
+	virtual void	onSent(SoConnection & connection);
+
+	/// Called when the MFD has a new image: puts it in the mailbox and sends it if the connection is not already sending.
+	virtual void	onWake(SoConnection & connection);
+
+	/// Called when no image has been sent for a refreshing interval: forces the MFD refresh.
+	virtual void	onTimer(SoConnection & connection);
+
+	/// Unregisters from the MFD and closes it.
+	virtual void	onClose(SoConnection & connection);
+
+private:
+	/// Puts the latest frame of the MFD in the mailbox, if it is newer than the frame already there or than the last frame sent.
+	/// Closes the connection if the close button of the MFD has been pressed.
+	/// \param[in]	connection	The connection on which the stream is sent.
+	/// \return Wether the connection is still opened.
+	bool			_collectFrame(SoConnection & connection);
+
+	/// Sends the frame of the mailbox if the previous one has been sent.
+	/// \param[in]	connection	The connection on which the stream is sent.
+	void			_deliverFrame(SoConnection & connection);
+
+	/// The streamed MFD
+	ServerMFD *		_mfd;
+
+	/// The key on which the MFD was opened
+	std::string		_key;
+
+	/// The format of the images: "png", "jpeg" or "tiles"
+	std::string		_format;
+
+	/// Id of the frame in the mailbox, or of the last sent frame if the mailbox is empty, used to check if the image has changed
+	unsigned int	_id;
+
+	/// Id of the last sent frame: the tiles frames are deltas that only apply on top of the last frame the follower has received
+	unsigned int	_sentId;
+
+	/// The frame waiting to be sent, 0 if there is none. The stream holds a reference on it.
+	SoBuffer *		_mailbox;
+
+	/// The multipart header of the frame waiting to be sent, 0 for a tiles frame. The stream holds a reference on it.
+	SoBuffer *		_mailboxHeader;
+
+	/// The performance counter at which the frame being sent has been queued on the connection, 0 if no frame is being sent
+	LONGLONG		_sendStart;
+
+	/// The counters of the frames delivered to and dropped for the follower, registered to the MFD
+	FollowerCounters	_counters;
+};
+
+#endif // __MFDSTREAM_H
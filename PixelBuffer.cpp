@@ -0,0 +1,109 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "PixelBuffer.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+PixelBuffer::PixelBuffer() : _data(0), _memory(0), _width(0), _height(0), _stride(0)
+{
+}
+
+
+PixelBuffer::PixelBuffer(int width, int height) : _data(0), _memory(0), _width(0), _height(0), _stride(0)
+{
+	create(width, height);
+}
+
+
+PixelBuffer::~PixelBuffer()
+{
+	_free();
+}
+
+
+void	PixelBuffer::create(int width, int height)
+{
+	// The lines of 32 bits pixels need no padding
+	int stride = width * 4;
+
+	// Keep the current pixels if they can be reused
+	if (_memory && _width == width && _height == height && _stride == stride)
+	{
+		memset(_data, 0, Size());
+		return ;
+	}
+
+	_free();
+
+	// Allocate more than needed so that the first pixel can be aligned
+	size_t size = (size_t)stride * height;
+	_memory = calloc(size + PIXELBUFFER_ALIGN, 1);
+	if (!_memory)
+		return ;
+
+	// Align the first pixel so that the lines can be read by wide loads
+	_data = (unsigned char *)(((size_t)_memory + PIXELBUFFER_ALIGN - 1) & ~(size_t)(PIXELBUFFER_ALIGN - 1));
+	_width = width;
+	_height = height;
+	_stride = stride;
+}
+
+
+void	PixelBuffer::wrap(void * pixels, int width, int height, int stride)
+{
+	_free();
+
+	// Only keep a pointer on the pixels
+	_data = (unsigned char *)pixels;
+	_width = width;
+	_height = height;
+	_stride = stride;
+}
+
+
+void	PixelBuffer::copyFrom(const PixelBuffer & src)
+{
+	// Copying a buffer into itself does nothing
+	if (&src == this || src._data == _data)
+		return ;
+
+	// A view is replaced by owned pixels, and owned pixels are reallocated if their size differs
+	if (!_memory || _width != src._width || _height != src._height)
+		create(src._width, src._height);
+
+	// Copy all the pixels at once if the lines have the same layout, else line by line
+	if (_stride == src._stride)
+		memcpy(_data, src._data, Size());
+	else
+		for (int y = 0; y < _height; ++y)
+			memcpy(Line(y), src.Line(y), _width * 4);
+}
+
+
+void	PixelBuffer::swap(PixelBuffer & other)
+{
+	std::swap(_data, other._data);
+	std::swap(_memory, other._memory);
+	std::swap(_width, other._width);
+	std::swap(_height, other._height);
+	std::swap(_stride, other._stride);
+}
+
+
+void	PixelBuffer::_free()
+{
+	// Only the owned pixels are freed
+	free(_memory);
+
+	_data = 0;
+	_memory = 0;
+	_width = 0;
+	_height = 0;
+	_stride = 0;
+}
@@ -0,0 +1,118 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __PIXELBUFFER_H
+#define __PIXELBUFFER_H
+
+#include <stddef.h>
+
+/// The alignment, in bytes, of the pixels allocated by a PixelBuffer
+#define PIXELBUFFER_ALIGN	16
+
+/// Portable 32 bits image in memory.
+/// Each pixel is 4 bytes: blue, green, red and an ignored byte, which is the layout of a 32 bits top-down DIB section.
+/// The MFD surface is copied once in a pixel buffer, from which every encoder and differ reads directly.
+/// A pixel buffer either owns its pixels (allocated by create) or is a view on pixels it does not own (set by wrap).
+/// It does not depend on any platform API, so the imaging code can be used with any stand-in surface.
+class PixelBuffer
+{
+public:
+	/// Constructor
+	/// Creates an empty pixel buffer.
+	PixelBuffer();
+
+	/// Constructor
+	/// Creates a pixel buffer owning black pixels.
+	/// \param[in]	width	The width of the image in pixels.
+	/// \param[in]	height	The height of the image in pixels.
+	PixelBuffer(int width, int height);
+
+	/// Destructor
+	/// Frees the pixels if they are owned.
+	~PixelBuffer();
+
+	/// Allocates the pixels of an image, all black.
+	/// Keeps the current pixels if they are owned and already have the required size.
+	/// \param[in]	width	The width of the image in pixels.
+	/// \param[in]	height	The height of the image in pixels.
+	void					create(int width, int height);
+
+	/// Makes the buffer a view on pixels it does not own, e.g. the pixels of a DIB section.
+	/// \param[in]	pixels	The first pixel of the image. Must stay valid while the buffer uses it.
+	/// \param[in]	width	The width of the image in pixels.
+	/// \param[in]	height	The height of the image in pixels.
+	/// \param[in]	stride	The number of bytes between the first pixels of two lines.
+	void					wrap(void * pixels, int width, int height, int stride);
+
+	/// Copies the pixels of another buffer, (re)allocating the pixels of this buffer if needed.
+	/// \param[in]	src		The buffer to copy.
+	void					copyFrom(const PixelBuffer & src);
+
+	/// Exchanges the pixels of two buffers, without copying them.
+	/// \param[in,out]	other	The buffer with which to exchange.
+	void					swap(PixelBuffer & other);
+
+	/// Gets the width of the image
+	/// \return the width in pixels
+	int						Width() const { return _width; }
+
+	/// Gets the height of the image
+	/// \return the height in pixels
+	int						Height() const { return _height; }
+
+	/// Gets the number of bytes between the first pixels of two lines
+	/// \return the stride in bytes
+	int						Stride() const { return _stride; }
+
+	/// Gets the number of bytes of the image, from its first pixel to the end of its last line
+	/// \return the size in bytes
+	size_t					Size() const { return (size_t)_stride * _height; }
+
+	/// Gets the first pixel of the image
+	/// \return the pixels, or 0 if the buffer is empty
+	unsigned char *			Data() { return _data; }
+
+	/// Gets the first pixel of the image
+	/// \return the pixels, or 0 if the buffer is empty
+	const unsigned char *	Data() const { return _data; }
+
+	/// Gets the first pixel of a line
+	/// \param[in]	y	The line.
+	/// \return the first pixel of the line
+	unsigned char *			Line(int y) { return _data + y * _stride; }
+
+	/// Gets the first pixel of a line
+	/// \param[in]	y	The line.
+	/// \return the first pixel of the line
+	const unsigned char *	Line(int y) const { return _data + y * _stride; }
+
+private:
+	/// Not copyable: use copyFrom
+	PixelBuffer(const PixelBuffer &);
+
+	/// Not copyable: use copyFrom
+	PixelBuffer &			operator=(const PixelBuffer &);
+
+	/// Frees the owned pixels and empties the buffer.
+	void					_free();
+
+	/// The first pixel, aligned on PIXELBUFFER_ALIGN bytes when the pixels are owned
+	unsigned char *			_data;
+
+	/// The allocated memory, 0 if the pixels are not owned
+	void *					_memory;
+
+	/// The width of the image in pixels
+	int						_width;
+
+	/// The height of the image in pixels
+	int						_height;
+
+	/// The number of bytes between the first pixels of two lines
+	int						_stride;
+};
+
+#endif // __PIXELBUFFER_H
@@ -0,0 +1,286 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "PngEncoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/// The number of entries of the palette hash table (a power of two, at least twice the maximum number of colours)
+#define PNG_PALETTE_HASH_SIZE	1024
+
+/// The maximum number of colours of an indexed image
+#define PNG_MAX_PALETTE			256
+
+/// Appends a 32 bits big endian integer to a string
+/// \param[out]	out		The string.
+/// \param[in]	i		The integer.
+static void putInt(std::string & out, unsigned int i)
+{
+	out += (char)(i >> 24);
+	out += (char)((i >> 16) & 0xFF);
+	out += (char)((i >> 8) & 0xFF);
+	out += (char)(i & 0xFF);
+}
+
+/// Gets the colour of a pixel.
+/// \param[in]	p	The pixel: blue, green, red and an ignored byte.
+/// \return The colour as 0x00RRGGBB.
+static inline unsigned int pixelColor(const unsigned char * p)
+{
+	return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16);
+}
+
+/// Hashes a colour for the palette hash table.
+/// \param[in]	color	The colour.
+/// \return The first entry to look at in the palette hash table.
+static inline unsigned int colorHash(unsigned int color)
+{
+	return (color * 2654435761U) >> 22;
+}
+
+/// The Paeth predictor of the PNG specification
+static inline int paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	if (pb <= pc)
+		return b;
+	return c;
+}
+
+
+PngEncoder::PngEncoder(int level) : _deflate(level)
+{
+}
+
+
+void	PngEncoder::encode(const unsigned char * pixels, int width, int height, int stride, std::string & out)
+{
+	_raw.clear();
+
+	// Get the colours of the image to choose its type: 4 or 8 bits indexed, or 24 bits truecolour
+	bool indexed = _buildPalette(pixels, width, height, stride);
+	int depth = 8;
+	if (indexed)
+	{
+		if (_palette.size() <= 16)
+			depth = 4;
+		_writeIndexed(pixels, width, height, stride, depth);
+	}
+	else
+		_writeTruecolor(pixels, width, height, stride);
+
+	// The PNG signature
+	out.append("\x89PNG\r\n\x1A\n", 8);
+
+	// The header: width, height, bit depth, colour type (3: indexed, 2: truecolour), compression, filter and interlace methods
+	std::string ihdr;
+	putInt(ihdr, width);
+	putInt(ihdr, height);
+	ihdr += (char)depth;
+	ihdr += (char)(indexed ? 3 : 2);
+	ihdr.append(3, '\0');
+	_putChunk(out, "IHDR", ihdr.data(), ihdr.size());
+
+	// The palette of an indexed image
+	if (indexed)
+	{
+		std::string plte;
+		for (std::vector<unsigned int>::iterator i = _palette.begin(); i != _palette.end(); ++i)
+		{
+			plte += (char)((*i >> 16) & 0xFF);
+			plte += (char)((*i >> 8) & 0xFF);
+			plte += (char)(*i & 0xFF);
+		}
+		_putChunk(out, "PLTE", plte.data(), plte.size());
+	}
+
+	// The compressed image data
+	_idat.clear();
+	_deflate.zlib(_raw.empty() ? 0 : &_raw[0], _raw.size(), _idat);
+	_putChunk(out, "IDAT", _idat.data(), _idat.size());
+
+	// The end of the image
+	_putChunk(out, "IEND", 0, 0);
+}
+
+
+bool	PngEncoder::_buildPalette(const unsigned char * pixels, int width, int height, int stride)
+{
+	_palette.clear();
+	_paletteHash.assign(PNG_PALETTE_HASH_SIZE, 0);
+
+	// The last colour found, as consecutive pixels very often have the same colour
+	unsigned int last = 0;
+	bool hasLast = false;
+
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char * p = pixels + y * stride;
+		for (int x = 0; x < width; ++x, p += 4)
+		{
+			unsigned int color = pixelColor(p);
+			if (hasLast && color == last)
+				continue ;
+			last = color;
+			hasLast = true;
+
+			// Look for the colour in the hash table, adding it at the first empty entry if it is not there
+			unsigned int h = colorHash(color);
+			for (;;)
+			{
+				unsigned short entry = _paletteHash[h];
+				if (entry == 0)
+				{
+					// Too many colours for an indexed image
+					if (_palette.size() == PNG_MAX_PALETTE)
+						return false;
+					_palette.push_back(color);
+					_paletteHash[h] = (unsigned short)_palette.size();
+					break ;
+				}
+				if (_palette[entry - 1] == color)
+					break ;
+				h = (h + 1) & (PNG_PALETTE_HASH_SIZE - 1);
+			}
+		}
+	}
+
+	return true;
+}
+
+
+int		PngEncoder::_paletteIndex(unsigned int color) const
+{
+	// The colour is always in the table, as the palette has been built from the same image
+	unsigned int h = colorHash(color);
+	while (_palette[_paletteHash[h] - 1] != color)
+		h = (h + 1) & (PNG_PALETTE_HASH_SIZE - 1);
+	return _paletteHash[h] - 1;
+}
+
+
+void	PngEncoder::_writeIndexed(const unsigned char * pixels, int width, int height, int stride, int depth)
+{
+	// The size of a line: the filter byte, then the indexes
+	size_t lineSize = 1 + (depth == 4 ? (width + 1) / 2 : width);
+	_raw.resize(lineSize * height);
+
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char * p = pixels + y * stride;
+		unsigned char * line = &_raw[y * lineSize];
+
+		// No filter: the indexes of a MFD image already compress well
+		*line++ = 0;
+
+		// The last colour and its index, as consecutive pixels very often have the same colour
+		unsigned int last = pixelColor(p);
+		int index = _paletteIndex(last);
+
+		for (int x = 0; x < width; ++x, p += 4)
+		{
+			unsigned int color = pixelColor(p);
+			if (color != last)
+			{
+				last = color;
+				index = _paletteIndex(color);
+			}
+
+			// 4 bits indexes: two pixels per byte, the first one in the high bits
+			if (depth == 4)
+			{
+				if (x & 1)
+					*line++ |= (unsigned char)index;
+				else
+					*line = (unsigned char)(index << 4);
+			}
+			else
+				*line++ = (unsigned char)index;
+		}
+	}
+}
+
+
+void	PngEncoder::_writeTruecolor(const unsigned char * pixels, int width, int height, int stride)
+{
+	size_t rowSize = width * 3;
+
+	// The previous line is all zeros for the first line
+	_line[0].assign(rowSize, 0);
+	_line[1].resize(rowSize);
+	for (int f = 0; f < 5; ++f)
+		_filtered[f].resize(rowSize);
+
+	_raw.reserve((rowSize + 1) * height);
+
+	for (int y = 0; y < height; ++y)
+	{
+		std::vector<unsigned char> & prev = _line[y & 1];
+		std::vector<unsigned char> & cur = _line[(y + 1) & 1];
+
+		// Convert the line to RGB
+		const unsigned char * p = pixels + y * stride;
+		for (int x = 0; x < width; ++x, p += 4)
+		{
+			cur[x * 3] = p[2];
+			cur[x * 3 + 1] = p[1];
+			cur[x * 3 + 2] = p[0];
+		}
+
+		// Apply the five filters: None, Sub, Up, Average and Paeth
+		// a is the byte of the previous pixel, b the byte above and c the byte of the previous pixel above
+		for (size_t i = 0; i < rowSize; ++i)
+		{
+			int a = (i >= 3) ? cur[i - 3] : 0;
+			int b = prev[i];
+			int c = (i >= 3) ? prev[i - 3] : 0;
+			_filtered[0][i] = cur[i];
+			_filtered[1][i] = (unsigned char)(cur[i] - a);
+			_filtered[2][i] = (unsigned char)(cur[i] - b);
+			_filtered[3][i] = (unsigned char)(cur[i] - ((a + b) >> 1));
+			_filtered[4][i] = (unsigned char)(cur[i] - paeth(a, b, c));
+		}
+
+		// Keep the filter whose bytes, as signed values, have the smallest sum of absolute values
+		int best = 0;
+		unsigned long bestSum = (unsigned long)-1;
+		for (int f = 0; f < 5; ++f)
+		{
+			unsigned long sum = 0;
+			for (size_t i = 0; i < rowSize; ++i)
+				sum += abs((int)(signed char)_filtered[f][i]);
+			if (sum < bestSum)
+			{
+				bestSum = sum;
+				best = f;
+			}
+		}
+
+		// Write the filter byte and the filtered line
+		_raw.push_back((unsigned char)best);
+		_raw.insert(_raw.end(), _filtered[best].begin(), _filtered[best].end());
+	}
+}
+
+
+void	PngEncoder::_putChunk(std::string & out, const char * type, const void * data, size_t len)
+{
+	// The length of the data, then the type and the data
+	putInt(out, (unsigned int)len);
+	size_t start = out.size();
+	out.append(type, 4);
+	if (len)
+		out.append((const char *)data, len);
+
+	// The CRC of the type and the data
+	putInt(out, SoDeflate::crc32(0, out.data() + start, len + 4));
+}
@@ -0,0 +1,97 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __PNGENCODER_H
+#define __PNGENCODER_H
+
+#include "SoHTTP/SoDeflate.h"
+
+#include <string>
+#include <vector>
+
+/// Portable PNG encoder tuned for MFD images.
+/// MFD images only use a handful of colours: when an image has at most 16 colours it is encoded as a 4 bits indexed PNG,
+/// when it has at most 256 colours as a 8 bits indexed PNG, and else as a 24 bits truecolour PNG.
+/// The encoding does not depend on GDI+ nor on any platform API, and the same image always gives the same bytes.
+/// An encoder keeps its working buffers between calls, so it should be reused, but it must not be used by two threads at the same time.
+class PngEncoder
+{
+public:
+	/// Constructor
+	/// \param[in]	level	The Deflate compression level, from 0 to 9.
+	PngEncoder(int level = SODEFLATE_DEFAULT_LEVEL);
+
+	/// Sets the Deflate compression level
+	/// \param[in]	level	The compression level, from 0 (no compression) to 9 (best and slowest compression).
+	void			setLevel(int level) { _deflate.setLevel(level); }
+
+	/// Encodes an image in PNG.
+	/// \param[in]	pixels	The first pixel of the image. Each pixel is 4 bytes: blue, green, red and an ignored byte (as in a 32 bits DIB).
+	/// \param[in]	width	The width of the image in pixels.
+	/// \param[in]	height	The height of the image in pixels.
+	/// \param[in]	stride	The number of bytes between the first pixels of two lines.
+	/// \param[out]	out		The string to which the PNG file is appended.
+	void			encode(const unsigned char * pixels, int width, int height, int stride, std::string & out);
+
+private:
+	/// Builds the palette of the image.
+	/// \param[in]	pixels	The first pixel of the image.
+	/// \param[in]	width	The width of the image in pixels.
+	/// \param[in]	height	The height of the image in pixels.
+	/// \param[in]	stride	The number of bytes between the first pixels of two lines.
+	/// \return Wether the image has at most 256 colours, in which case _palette contains them, in order of appearance.
+	bool			_buildPalette(const unsigned char * pixels, int width, int height, int stride);
+
+	/// Gets the index of a colour in the palette.
+	/// \param[in]	color	The colour, as the 24 low bits of a pixel read as a little endian integer.
+	/// \return The index of the colour in the palette.
+	int				_paletteIndex(unsigned int color) const;
+
+	/// Writes the lines of an indexed image in _raw, unfiltered as recommended for indexed images.
+	/// \param[in]	pixels	The first pixel of the image.
+	/// \param[in]	width	The width of the image in pixels.
+	/// \param[in]	height	The height of the image in pixels.
+	/// \param[in]	stride	The number of bytes between the first pixels of two lines.
+	/// \param[in]	depth	The number of bits per pixel: 4 or 8.
+	void			_writeIndexed(const unsigned char * pixels, int width, int height, int stride, int depth);
+
+	/// Writes the lines of a truecolour image in _raw, each one with the filter that gives the smallest sum of absolute values.
+	/// \param[in]	pixels	The first pixel of the image.
+	/// \param[in]	width	The width of the image in pixels.
+	/// \param[in]	height	The height of the image in pixels.
+	/// \param[in]	stride	The number of bytes between the first pixels of two lines.
+	void			_writeTruecolor(const unsigned char * pixels, int width, int height, int stride);
+
+	/// Appends a PNG chunk.
+	/// \param[out]	out		The string to which the chunk is appended.
+	/// \param[in]	type	The type of the chunk (4 characters).
+	/// \param[in]	data	The data of the chunk.
+	/// \param[in]	len		The number of bytes of data.
+	static void		_putChunk(std::string & out, const char * type, const void * data, size_t len);
+
+	/// The compressor of the image data
+	SoDeflate					_deflate;
+
+	/// The colours of the image, as the 24 low bits of a pixel read as a little endian integer
+	std::vector<unsigned int>	_palette;
+
+	/// The hash table to find a colour in the palette: each entry is the colour index + 1, 0 for an empty entry
+	std::vector<unsigned short>	_paletteHash;
+
+	/// The filtered lines of the image, to be compressed
+	std::vector<unsigned char>	_raw;
+
+	/// The current and the previous truecolour lines, as RGB bytes
+	std::vector<unsigned char>	_line[2];
+
+	/// The current truecolour line filtered with each of the five PNG filters
+	std::vector<unsigned char>	_filtered[5];
+
+	/// The compressed image data
+	std::string					_idat;
+};
+
+#endif // __PNGENCODER_H
@@ -0,0 +1,576 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+/// Standalone test of the PngEncoder, not part of the plugin.
+/// Images of 4, 16, 17, 256 and 257 colours and a gradient are encoded at the levels 0, 1, 3 and 9, then the test checks that:
+/// the encoder chooses the expected bit depth and colour type, encoding the same image again gives the same bytes,
+/// the chunks are well formed, and the zlib stream inflates back to filtered scanlines that give the pixels of the image.
+/// The stream is inflated by the small inflater below, independent of SoDeflate, so that the test does not need zlib.
+/// Build it as a console program, from the plugin directory:
+///     cl /EHsc /O2 PngEncoderTest.cpp PngEncoder.cpp SoHTTP\SoDeflate.cpp
+/// Usage: PngEncoderTest
+
+#include "PngEncoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/// The number of failed checks
+static int failures = 0;
+
+/// An image to encode, as a 32 bits DIB
+struct Image
+{
+	/// The name of the case
+	const char *				name;
+
+	/// The width in pixels
+	int							width;
+
+	/// The height in pixels
+	int							height;
+
+	/// The number of bytes between the first pixels of two lines
+	int							stride;
+
+	/// The pixels: blue, green, red and an ignored byte, then the padding of the line
+	std::vector<unsigned char>	pixels;
+
+	/// The expected bit depth
+	int							depth;
+
+	/// The expected colour type: 3 for indexed, 2 for truecolour
+	int							type;
+
+	/// The expected number of colours of the palette, 0 for a truecolour image
+	unsigned int				colors;
+};
+
+/// Gets the colour of a pixel.
+/// \param[in]	image	The image.
+/// \param[in]	x		The column.
+/// \param[in]	y		The line.
+/// \return The colour as 0x00RRGGBB.
+static unsigned int pixelAt(const Image & image, int x, int y)
+{
+	const unsigned char * p = &image.pixels[y * image.stride + x * 4];
+	return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16);
+}
+
+/// Builds an image with a given number of colours, which all appear.
+/// The lines are padded and the ignored byte of each pixel changes, so that the encoder is checked not to read them.
+/// \param[in]	name	The name of the case.
+/// \param[in]	width	The width in pixels.
+/// \param[in]	height	The height in pixels.
+/// \param[in]	colors	The number of colours, at most width * height. 0 builds a gradient with more than 256 colours.
+/// \param[in]	depth	The expected bit depth.
+/// \param[in]	type	The expected colour type.
+/// \return The image.
+static Image makeImage(const char * name, int width, int height, unsigned int colors, int depth, int type)
+{
+	Image image;
+	image.name = name;
+	image.width = width;
+	image.height = height;
+	image.stride = width * 4 + 12;
+	image.pixels.assign(image.stride * height, 0xCD);
+	image.depth = depth;
+	image.type = type;
+	image.colors = (type == 3) ? colors : 0;
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			unsigned int color;
+			if (colors)
+			{
+				// Runs of the same colour, as on a MFD, and every colour of the set at least once
+				unsigned int i = (unsigned int)(x / 3 + y * ((width + 2) / 3)) % colors;
+				color = ((i & 0xFF) << 16) | ((i >> 8) << 8) | (0xFF - (i & 0xFF));
+			}
+			else
+				color = ((x * 8) & 0xFF) << 16 | ((y * 8) & 0xFF) << 8 | ((x * y) & 0xFF);
+			unsigned char * p = &image.pixels[y * image.stride + x * 4];
+			p[0] = (unsigned char)color;
+			p[1] = (unsigned char)(color >> 8);
+			p[2] = (unsigned char)(color >> 16);
+			p[3] = (unsigned char)(x + y);
+		}
+	return image;
+}
+
+/// Reads a 32 bits big endian integer.
+/// \param[in]	p	The first byte.
+/// \return The integer.
+static unsigned int getInt(const unsigned char * p)
+{
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+/// Computes the CRC-32 of PNG, bit by bit, independently of SoDeflate::crc32.
+/// \param[in]	data	The data.
+/// \param[in]	len		The number of bytes.
+/// \return The CRC.
+static unsigned int crc(const unsigned char * data, size_t len)
+{
+	unsigned int c = 0xFFFFFFFF;
+	for (size_t i = 0; i < len; ++i)
+	{
+		c ^= data[i];
+		for (int k = 0; k < 8; ++k)
+			c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+	}
+	return c ^ 0xFFFFFFFF;
+}
+
+/// A minimal Deflate (RFC 1951) decoder, which reads stored, fixed and dynamic Huffman blocks.
+class Inflater
+{
+public:
+	/// Decodes a raw Deflate stream.
+	/// \param[in]	data	The stream.
+	/// \param[in]	len		The number of bytes of the stream.
+	/// \param[out]	out		Receives the decoded data.
+	/// \return The number of bytes of the stream, or 0 if the stream is invalid.
+	size_t			inflate(const unsigned char * data, size_t len, std::vector<unsigned char> & out)
+	{
+		_in = data;
+		_len = len;
+		_pos = 0;
+		_bitBuf = 0;
+		_bitCount = 0;
+		_error = false;
+		_out = &out;
+		int last;
+		do
+		{
+			last = _bits(1);
+			int type = _bits(2);
+			if (type == 0)
+				_stored();
+			else if (type == 1)
+				_fixed();
+			else if (type == 2)
+				_dynamic();
+			else
+				_error = true;
+		}
+		while (!last && !_error);
+		return _error ? 0 : _pos;
+	}
+
+private:
+	/// A canonical Huffman code
+	struct Huffman
+	{
+		/// The number of codes of each length
+		short	count[16];
+
+		/// The symbols, by code
+		short	symbol[288];
+	};
+
+	/// Reads bits, least significant bit first.
+	/// \param[in]	n	The number of bits.
+	/// \return The bits.
+	int				_bits(int n)
+	{
+		while (_bitCount < n)
+		{
+			if (_pos >= _len)
+			{
+				_error = true;
+				return 0;
+			}
+			_bitBuf |= (unsigned int)_in[_pos++] << _bitCount;
+			_bitCount += 8;
+		}
+		int v = (int)(_bitBuf & ((1U << n) - 1));
+		_bitBuf >>= n;
+		_bitCount -= n;
+		return v;
+	}
+
+	/// Builds a Huffman code from the lengths of its codes.
+	/// \param[out]	h		The code.
+	/// \param[in]	lengths	The length of the code of each symbol, 0 for an unused symbol.
+	/// \param[in]	n		The number of symbols.
+	static void		_build(Huffman & h, const short * lengths, int n)
+	{
+		short offs[16];
+		memset(h.count, 0, sizeof(h.count));
+		for (int s = 0; s < n; ++s)
+			++h.count[lengths[s]];
+		offs[1] = 0;
+		for (int l = 1; l < 15; ++l)
+			offs[l + 1] = offs[l] + h.count[l];
+		for (int s = 0; s < n; ++s)
+			if (lengths[s])
+				h.symbol[offs[lengths[s]]++] = (short)s;
+	}
+
+	/// Decodes a symbol.
+	/// \param[in]	h	The code.
+	/// \return The symbol, or -1 if the code is invalid.
+	int				_decode(const Huffman & h)
+	{
+		int code = 0, first = 0, index = 0;
+		for (int l = 1; l < 16 && !_error; ++l)
+		{
+			code |= _bits(1);
+			int count = h.count[l];
+			if (code - count < first)
+				return h.symbol[index + (code - first)];
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+		_error = true;
+		return -1;
+	}
+
+	/// Decodes a stored block.
+	void			_stored()
+	{
+		_bitBuf = 0;
+		_bitCount = 0;
+		if (_pos + 4 > _len)
+		{
+			_error = true;
+			return ;
+		}
+		unsigned int len = _in[_pos] | (_in[_pos + 1] << 8);
+		unsigned int nlen = _in[_pos + 2] | (_in[_pos + 3] << 8);
+		_pos += 4;
+		if (len != (~nlen & 0xFFFF) || _pos + len > _len)
+		{
+			_error = true;
+			return ;
+		}
+		_out->insert(_out->end(), _in + _pos, _in + _pos + len);
+		_pos += len;
+	}
+
+	/// Decodes a block with the fixed Huffman codes.
+	void			_fixed()
+	{
+		short lengths[288];
+		for (int s = 0; s < 288; ++s)
+			lengths[s] = (short)(s < 144 ? 8 : (s < 256 ? 9 : (s < 280 ? 7 : 8)));
+		Huffman lit, dist;
+		_build(lit, lengths, 288);
+		for (int s = 0; s < 30; ++s)
+			lengths[s] = 5;
+		_build(dist, lengths, 30);
+		_codes(lit, dist);
+	}
+
+	/// Decodes a block with dynamic Huffman codes.
+	void			_dynamic()
+	{
+		static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		int nlen = _bits(5) + 257;
+		int ndist = _bits(5) + 1;
+		int ncode = _bits(4) + 4;
+		short lengths[320] = { 0 };
+		for (int i = 0; i < ncode; ++i)
+			lengths[order[i]] = (short)_bits(3);
+		Huffman lencode;
+		_build(lencode, lengths, 19);
+		int index = 0;
+		while (index < nlen + ndist && !_error)
+		{
+			int symbol = _decode(lencode);
+			if (symbol < 16)
+			{
+				lengths[index++] = (short)symbol;
+				continue ;
+			}
+			short len = 0;
+			int repeat;
+			if (symbol == 16)
+			{
+				if (index == 0)
+				{
+					_error = true;
+					return ;
+				}
+				len = lengths[index - 1];
+				repeat = 3 + _bits(2);
+			}
+			else if (symbol == 17)
+				repeat = 3 + _bits(3);
+			else
+				repeat = 11 + _bits(7);
+			if (index + repeat > nlen + ndist)
+			{
+				_error = true;
+				return ;
+			}
+			while (repeat--)
+				lengths[index++] = len;
+		}
+		Huffman lit, dist;
+		_build(lit, lengths, nlen);
+		_build(dist, lengths + nlen, ndist);
+		_codes(lit, dist);
+	}
+
+	/// Decodes the literals and the matches of a Huffman block.
+	/// \param[in]	lit		The literal/length code.
+	/// \param[in]	dist	The distance code.
+	void			_codes(const Huffman & lit, const Huffman & dist)
+	{
+		static const short lenBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const short lenExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const short distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const short distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		for (;;)
+		{
+			int symbol = _decode(lit);
+			if (_error || symbol == 256)
+				return ;
+			if (symbol < 256)
+			{
+				_out->push_back((unsigned char)symbol);
+				continue ;
+			}
+			symbol -= 257;
+			if (symbol >= 29)
+			{
+				_error = true;
+				return ;
+			}
+			int len = lenBase[symbol] + _bits(lenExtra[symbol]);
+			int d = _decode(dist);
+			if (_error || d >= 30)
+			{
+				_error = true;
+				return ;
+			}
+			size_t distance = distBase[d] + _bits(distExtra[d]);
+			if (distance > _out->size())
+			{
+				_error = true;
+				return ;
+			}
+			while (len--)
+				_out->push_back((*_out)[_out->size() - distance]);
+		}
+	}
+
+	/// The stream
+	const unsigned char *			_in;
+
+	/// The number of bytes of the stream
+	size_t							_len;
+
+	/// The position of the next byte to read
+	size_t							_pos;
+
+	/// The bits read but not consumed
+	unsigned int					_bitBuf;
+
+	/// The number of bits in _bitBuf
+	int								_bitCount;
+
+	/// Wether the stream is invalid
+	bool							_error;
+
+	/// The decoded data
+	std::vector<unsigned char> *	_out;
+};
+
+/// Reports a failed check.
+/// \param[in]	image	The image.
+/// \param[in]	level	The compression level.
+/// \param[in]	what	What is wrong.
+static void fail(const Image & image, int level, const char * what)
+{
+	printf("FAIL: %s at level %d: %s\n", image.name, level, what);
+	++failures;
+}
+
+/// The Paeth predictor of the PNG specification
+static int paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return (pb <= pc) ? b : c;
+}
+
+/// Reads a PNG file and checks it against the image it encodes.
+/// \param[in]	image	The image.
+/// \param[in]	level	The compression level.
+/// \param[in]	png		The PNG file.
+static void checkPng(const Image & image, int level, const std::string & png)
+{
+	const unsigned char * p = (const unsigned char *)png.data();
+	size_t size = png.size();
+	if (size < 8 || memcmp(p, "\x89PNG\r\n\x1A\n", 8) != 0)
+		return fail(image, level, "bad signature");
+
+	// Read the chunks, checking their CRCs: IHDR first, IEND last
+	std::string ihdr, plte, idat;
+	size_t pos = 8;
+	bool end = false;
+	while (pos < size && !end)
+	{
+		if (pos + 12 > size || pos + 12 + getInt(p + pos) > size)
+			return fail(image, level, "truncated chunk");
+		size_t len = getInt(p + pos);
+		std::string type((const char *)p + pos + 4, 4);
+		std::string data((const char *)p + pos + 8, len);
+		if (crc(p + pos + 4, len + 4) != getInt(p + pos + 8 + len))
+			return fail(image, level, "bad chunk CRC");
+		if ((pos == 8) != (type == "IHDR"))
+			return fail(image, level, "IHDR is not the first chunk");
+		if (type == "IHDR")
+			ihdr = data;
+		else if (type == "PLTE")
+			plte = data;
+		else if (type == "IDAT")
+			idat += data;
+		else if (type == "IEND")
+			end = true;
+		pos += 12 + len;
+	}
+	if (!end || pos != size)
+		return fail(image, level, "IEND is not the last chunk");
+
+	// The header: size, bit depth, colour type, then compression, filter and interlace methods 0
+	const unsigned char * h = (const unsigned char *)ihdr.data();
+	if (ihdr.size() != 13 || getInt(h) != (unsigned int)image.width || getInt(h + 4) != (unsigned int)image.height || h[10] || h[11] || h[12])
+		return fail(image, level, "bad IHDR");
+	if (h[8] != image.depth || h[9] != image.type)
+	{
+		printf("FAIL: %s at level %d: bit depth %d and colour type %d, expected %d and %d\n", image.name, level, h[8], h[9], image.depth, image.type);
+		++failures;
+		return ;
+	}
+	if (plte.size() != image.colors * 3)
+		return fail(image, level, "bad palette size");
+
+	// The zlib stream: header, Deflate stream, then the Adler-32 of the scanlines, and nothing after
+	const unsigned char * z = (const unsigned char *)idat.data();
+	if (idat.size() < 6 || (z[0] & 0x0F) != 8 || (z[0] >> 4) > 7 || (z[1] & 0x20) || ((z[0] << 8) | z[1]) % 31 != 0)
+		return fail(image, level, "bad zlib header");
+	std::vector<unsigned char> raw;
+	Inflater inflater;
+	size_t used = inflater.inflate(z + 2, idat.size() - 6, raw);
+	if (used == 0 || used != idat.size() - 6)
+		return fail(image, level, "the zlib stream does not inflate");
+	unsigned int a = 1, b = 0;
+	for (size_t i = 0; i < raw.size(); ++i)
+	{
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	if (getInt(z + idat.size() - 4) != ((b << 16) | a))
+		return fail(image, level, "bad Adler-32");
+
+	// The scanlines: a filter byte, then the filtered bytes of the line
+	int bpp = (image.type == 2) ? 3 : 1;
+	size_t rowSize = (image.type == 2) ? image.width * 3 : (image.width * image.depth + 7) / 8;
+	if (raw.size() != (rowSize + 1) * image.height)
+		return fail(image, level, "bad size of the scanlines");
+
+	// Unfilter each line and compare it to the pixels
+	std::vector<unsigned char> prev(rowSize, 0), cur(rowSize);
+	for (int y = 0; y < image.height; ++y)
+	{
+		const unsigned char * line = &raw[y * (rowSize + 1)];
+		int filter = line[0];
+		if (filter > 4 || (image.type == 3 && filter != 0))
+			return fail(image, level, "bad filter");
+		for (size_t i = 0; i < rowSize; ++i)
+		{
+			int left = (i >= (size_t)bpp) ? cur[i - bpp] : 0;
+			int up = prev[i];
+			int upLeft = (i >= (size_t)bpp) ? prev[i - bpp] : 0;
+			int predictor = (filter == 0) ? 0 : (filter == 1) ? left : (filter == 2) ? up : (filter == 3) ? (left + up) >> 1 : paeth(left, up, upLeft);
+			cur[i] = (unsigned char)(line[1 + i] + predictor);
+		}
+		for (int x = 0; x < image.width; ++x)
+		{
+			unsigned int color;
+			if (image.type == 2)
+				color = (cur[x * 3] << 16) | (cur[x * 3 + 1] << 8) | cur[x * 3 + 2];
+			else
+			{
+				unsigned int index = (image.depth == 4) ? ((cur[x / 2] >> ((x & 1) ? 0 : 4)) & 0x0F) : cur[x];
+				if (index >= image.colors)
+					return fail(image, level, "palette index out of range");
+				const unsigned char * c = (const unsigned char *)plte.data() + index * 3;
+				color = (c[0] << 16) | (c[1] << 8) | c[2];
+			}
+			if (color != pixelAt(image, x, y))
+			{
+				printf("FAIL: %s at level %d: pixel %d,%d differs\n", image.name, level, x, y);
+				++failures;
+				return ;
+			}
+		}
+		prev.swap(cur);
+	}
+}
+
+int main()
+{
+	// Odd widths check the packing of the 4 bits indexes, and the gradient has more than 256 colours
+	std::vector<Image> images;
+	images.push_back(makeImage("4 colours", 37, 23, 4, 4, 3));
+	images.push_back(makeImage("16 colours", 64, 16, 16, 4, 3));
+	images.push_back(makeImage("17 colours", 63, 16, 17, 8, 3));
+	images.push_back(makeImage("256 colours", 97, 31, 256, 8, 3));
+	images.push_back(makeImage("257 colours", 97, 31, 257, 8, 2));
+	images.push_back(makeImage("gradient", 31, 29, 0, 8, 2));
+
+	static const int levels[] = { 0, 1, 3, 9 };
+	static const int nbLevels = sizeof(levels) / sizeof(*levels);
+
+	printf("%-12s", "bytes");
+	for (int l = 0; l < nbLevels; ++l)
+		printf(" %9s %d", "level", levels[l]);
+	printf("\n");
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		const Image & image = images[i];
+		const Image & other = images[(i + 1) % images.size()];
+		printf("%-12s", image.name);
+		for (int l = 0; l < nbLevels; ++l)
+		{
+			// Encode the image, another one with the same encoder, the image again, and the image with a new encoder
+			PngEncoder encoder(levels[l]);
+			std::string first, between, second, fresh;
+			encoder.encode(&image.pixels[0], image.width, image.height, image.stride, first);
+			encoder.encode(&other.pixels[0], other.width, other.height, other.stride, between);
+			encoder.encode(&image.pixels[0], image.width, image.height, image.stride, second);
+			PngEncoder newEncoder(levels[l]);
+			newEncoder.encode(&image.pixels[0], image.width, image.height, image.stride, fresh);
+
+			// The same image must always give the same bytes
+			if (second != first || fresh != first)
+				fail(image, levels[l], "encoding it again gives other bytes");
+
+			checkPng(image, levels[l], first);
+			printf(" %11u", (unsigned int)first.size());
+		}
+		printf("\n");
+	}
+
+	if (failures)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("OK: %u images at %d levels\n", (unsigned int)images.size(), nbLevels);
+	return 0;
+}
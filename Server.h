@@ -8,11 +8,23 @@
 #define __SERVER_H
 
 #include "SoHTTP/SoHTTP.h"
+#include "CommandQueue.h"
+#include "EncoderPool.h"
+#include "FrameTrace.h"
+#include "MFDRegistry.h"
 #include "ServerMFD.h"
+#include "TimingStats.h"
+#include "WebInterfaces.h"
 
-#include <map>
-#include <queue>
 #include <string>
+#include <vector>
+
+/// Macro that defines an int that is the MFD refresh time divided by 10 in milliseconds if it is > 10, else 10
+#define WEBMFD_REFRESH_ASK_MS (((Server::Instance().Interval() * 1000 / 10) > 10) ? (Server::Instance().Interval() * 1000 / 10) : 10)
+
+/// Macro that defines an int that is the time in milliseconds after which a MFD stream that did not receive any new image forces the MFD refresh:
+/// the MFD refresh time in milliseconds if it is > 100, else 100
+#define WEBMFD_FRAME_TIMEOUT_MS (((Server::Instance().Interval() * 1000) > 100) ? (Server::Instance().Interval() * 1000) : 100)
 
 /// Handles the web server using SoHTTP.
 /// This class is a static singleton : There can be only one running server for a simulation.
@@ -28,9 +40,14 @@ public:
 
 
 	/// Start the server on the given port
-	/// \param[in]	port	The port on which to start the server
+	/// \param[in]	port			The port on which to start the server
+	/// \param[in]	encoderThreads	The number of threads that encode the MFD images
+	/// \param[in]	encoderQueue	The maximum number of MFD images waiting to be encoded
+	/// \param[in]	pngLevel		The compression level of the PNG images, from 0 (fastest) to 9 (smallest)
+	/// \param[in]	webMaxAge		The time, in seconds, during which the browsers can use the web interfaces files without revalidating them
+	/// \param[in]	stepBudgetUs	The time, in microseconds, that the main thread can spend in a step for the MFDs. 0 for no limit.
 	/// \return wether the starting has succeded or not
-	bool			start(unsigned int port);
+	bool			start(unsigned int port, unsigned int encoderThreads, unsigned int encoderQueue, int pngLevel, int webMaxAge, int stepBudgetUs);
 	
 	/// Stop the running server
 	/// \return wether the stoping has succeded or not
@@ -49,53 +66,173 @@ public:
 	/// \return the interval of MFD refresh
 	double			Interval() const { return _interval; }
 
+	/// Gets the pool of threads that encode the MFD images
+	/// \return the encoder pool
+	EncoderPool		&Encoders() { return _encoders; }
+
+	/// Gets the trace of the MFD frames
+	/// \return the frame trace
+	FrameTrace		&Trace() { return _trace; }
+
+	/// Gets the compression level of the PNG images
+	/// \return the PNG compression level
+	int				PngLevel() const { return _pngLevel; }
+
 	/// Opens a MFD.
 	///  - Creates a MFD if a MFD does not already exists for the given key.
 	///  - Return the corresponding MFD if it already has been created for the given key.
 	/// The closeMFD MUST be called when the usage of the returned MFD is finished.
 	/// \param[in]	key		A key on which to register the MFD
-	/// \param[in]	format	"mpng" or "mjpeg" or "". If no null, used to inform the MFD refresh thread that there will be at least one thread that will need image from this format.
+	/// \param[in]	format	"png", "jpeg", "tiles" or "". If no null, used to inform the MFD refresh thread that there will be at least one thread that will need image from this format.
 	/// \param[in]	create	Wether to create a MFD if it does not exists for the required key
 	/// \return An existing or newly created ServerMFD pointer
 	ServerMFD		*openMFD(const std::string &key, const std::string &format = "", bool create = true);
 	
-	/// Closes a MFDMap
+	/// Closes a MFD
 	/// Must be called with the exact same parameter as given to OpenMFD.
 	/// \param[in]	key		The key on which the opened MFD was registered.
-	/// \param[in]	format	"mpng" or "mjpeg" or "". The image format on which the MFD was informed.
+	/// \param[in]	format	"png", "jpeg", "tiles" or "". The image format on which the MFD was informed.
 	void			closeMFD(const std::string &key, const std::string &format = "" );
 
+	/// Asks the main thread to press a button of a MFD, without waiting for the press to be processed.
+	/// The presses are processed in the order they were asked, all at the next Orbiter step, and the MFD is refreshed once after them.
+	/// Can be called from any thread.
+	/// \param[in]	mfd			The MFD.
+	/// \param[in]	btnId		The id of the button.
+	/// \param[in]	completion	If not null, the connection to wake once the press has been processed and the MFD refreshed: the acknowledgement of the press.
+	void			pressButton(ServerMFD * mfd, int btnId, SoConnection * completion = 0);
+
+	/// Asks the main thread to force the refresh of a MFD.
+	/// Can be called from any thread.
+	/// \param[in]	mfd		The MFD to refresh.
+	void			forceRefresh(ServerMFD * mfd);
+
+	/// The operations of the main thread that are timed, and the latency of the button presses
+	enum StepTiming
+	{
+		/// The registration of a MFD in Orbiter
+		TIMING_REGISTER = 0,
+
+		/// The unregistration of a MFD from Orbiter
+		TIMING_UNREGISTER,
+
+		/// A button press
+		TIMING_BUTTON,
+
+		/// The refresh of a MFD display
+		TIMING_REFRESH,
+
+		/// A whole pre-step
+		TIMING_STEP,
+
+		/// The time from the queuing of a button press to its acknowledgement, once its MFD has been refreshed
+		TIMING_BUTTON_LATENCY,
+
+		/// The number of timed operations
+		TIMING_COUNT
+	};
+
+	/// Gets the timings of an operation of the main thread.
+	/// Can be called from any thread.
+	/// \param[in]	timing	The operation.
+	/// \return the timings
+	const TimingStats &	StepTimings(StepTiming timing) const { return _timings[timing]; }
+
+	/// Gets the number of steps that have used their whole time budget, leaving work to the next steps.
+	/// \return the number of overrun steps
+	unsigned int	BudgetOverruns() const { return (unsigned int)_budgetOverruns; }
+
+	/// Gets the number of MFDs left to refresh by the last step, because its budget was spent.
+	/// \return the number of MFDs waiting for their refresh
+	unsigned int	RefreshBacklog() const { return (unsigned int)_refreshBacklog; }
+
+	/// Gets the queue of the commands given to the main thread, to read its depth.
+	/// \return the command queue
+	const CommandQueue &	Commands() const { return _commands; }
+
+	/// Gets the opened MFDs, to read their counters.
+	/// \return the MFD registry
+	MFDRegistry		&MFDs() { return _mfds; }
+
+	/// Gets the number of connections opened on the server.
+	/// \return the number of connections
+	size_t			OpenConnections() { return Reactor().Connections(); }
+
+	/// Gets the number of bytes sent on all the connections.
+	/// \return the number of bytes sent
+	LONGLONG		BytesSent() { return Reactor().BytesSent(); }
+
+	/// Gets the number of bytes received on all the connections.
+	/// \return the number of bytes received
+	LONGLONG		BytesReceived() { return Reactor().BytesReceived(); }
+
 	/// Callback used by the WebMFD Module Class to handle all the preStep MFDs actions.
+	/// Executes the commands queued by the other threads, without ever waiting for them.
+	/// The MFDs are refreshed once, after the commands, however many presses and refreshes they were given.
+	/// The step stops executing commands and refreshing MFDs once its time budget is spent: the remaining work is done at the next steps.
+	/// At least one command and one refresh are done in each step, so that the work always progresses.
 	void			clbkOrbiterPreStep();
 
 protected:
+	/// Callback used by SoHTTP to handle, in an I/O thread, the requests that do not need a thread.
+	virtual bool handleAsyncRequest(SoConnection & connection, Request & request);
+
 	/// Callback used by SoHTTP to handle a HTTP request / connection.
 	virtual void handleRequest(SOCKET connection, Request & request);
 
 private:
 	/// Treatment function called when a MFD is requested.
-	/// Handles the motion image stream.
+	/// Starts the motion image stream (mfd.mpng or mfd.mjpeg) or the tiles stream (mfd.tiles),
+	/// which is then handled by a MFDStream without any thread.
+	/// The MFDStream is woken by the MFD each time a new image is available.
 	/// \param[in]	connection	The connection of the request
 	/// \param[in]	request		The requestion information structure
-	void			handleMFDRequest(SOCKET connection, Request & request);
+	void			handleMFDRequest(SoConnection & connection, Request & request);
 
-	/// Treatment function called when a classic file is requested.
+	/// Treatment function called when a classic file that is not in memory is requested.
 	/// Handles the diferent files of the diferent installed web-interfaces.
-	/// If there is only one web-interface, it will automatically redirect to it.
+	/// The interface choice page is always in memory when the WebMFD directory exists (see WebInterfaces).
 	/// \param[in]	connection	The connection of the request
 	/// \param[in]	request		The requestion information structure
 	void			handleWebRequest(SOCKET connection, Request & request);
 
-	/// Treatment function called when a button WebSocket connection is requested
-	/// Handles Websocket input and output
+	/// Treatment function called when a button WebSocket connection is requested.
+	/// Accepts the WebSocket, which is then handled by a BtnSocket without any thread.
+	/// \param[in]	connection	The connection of the request
+	/// \param[in]	request		The requestion information structure
+	void			handleBtnRequest(SoConnection & connection, Request & request);
+
+	/// Treatment function called when a Button regular enquiry is requested.
+	/// The button press is queued and the response is left pending (see BtnResponse): no thread waits for the press.
 	/// \param[in]	connection	The connection of the request
 	/// \param[in]	request		The requestion information structure
-	void			handleBtnRequest(SOCKET connection, Request & request);
+	void			handleBtnHRequest(SoConnection & connection, Request & request);
 
-	/// Treatment function called when a Button regular enquiry is requested
+	/// Treatment function called when the performance counters are requested.
+	/// Sends them in JSON, or in the Prometheus text format if the get variable 'format' is "prometheus" (see Stats).
 	/// \param[in]	connection	The connection of the request
 	/// \param[in]	request		The requestion information structure
-	void			handleBtnHRequest(SOCKET connection, Request & request);
+	void			handleStatsRequest(SoConnection & connection, Request & request);
+
+	/// Treatment function called when the frame trace is requested.
+	/// Sends the traced events in the Chrome trace event format, to be loaded in chrome://tracing or Perfetto (see FrameTrace).
+	/// \param[in]	connection	The connection of the request
+	/// \param[in]	request		The requestion information structure
+	void			handleTraceRequest(SoConnection & connection, Request & request);
+
+	/// Wether the time budget of the step has been spent.
+	/// \param[in]	start	The performance counter at the beginning of the step.
+	/// \return Wether the step must stop.
+	bool			_overBudget(LONGLONG start) const { return _stepBudget > 0 && TimingStats::Now() - start >= _stepBudget; }
+
+	/// Records the duration of an operation of the main thread.
+	/// \param[in]	timing	The operation.
+	/// \param[in]	start	The performance counter at the beginning of the operation.
+	void			_time(StepTiming timing, LONGLONG start) { _timings[timing].record(TimingStats::ToMicroseconds(TimingStats::Now() - start)); }
+
+	/// Adds a MFD to the MFDs to refresh at the end of the current step, unless it is already in it.
+	/// \param[in]	mfd		The MFD.
+	void			_addRefresh(ServerMFD * mfd);
 
 	/// Private constructor (as needed for a singleton)
 	Server();
@@ -107,39 +244,53 @@ private:
 	double				_interval;
 
 	
+	/// The pool of threads that encode the MFD images
+	EncoderPool			_encoders;
+
+	/// The trace of the MFD frames
+	FrameTrace			_trace;
+
+	/// The web interfaces files and the interface choice page, loaded in memory
+	WebInterfaces		_assets;
+
 	/// Wether the server is currently running or not
 	bool				_isRunning;
 	
 	/// The port on which the server runs
 	unsigned int		_port;
 
-	
-	typedef std::map<std::string, ServerMFD*> MFDMap;
+	/// The compression level of the PNG images
+	int					_pngLevel;
 
-	/// The map of MFD pointers, each corresponding to a key
-	MFDMap				_mfds;
+	/// The Cache-Control header sent with the web interfaces files
+	std::string			_webCacheControl;
 
-	typedef std::queue<ServerMFD*> MFDQueue;
-	
-	/// The newly created MFDs to be registered in Orbiter in the main thread
-	MFDQueue			_toRegister;
-	
-	/// The MFDs to be unregistered in Orbiter in the main thread
-	MFDQueue			_toUnregister;
-	
-	/// The MFDs to force refreshment in Orbiter in the main thread
-	MFDQueue			_forceRefresh;
+	/// The time budget of a step, in performance counter ticks. 0 for no limit.
+	LONGLONG			_stepBudget;
+
+	/// The timings of the operations of the main thread
+	TimingStats			_timings[TIMING_COUNT];
+
+	/// The number of steps that have used their whole time budget
+	volatile LONG		_budgetOverruns;
+
+	/// The number of MFDs left to refresh by the last step
+	volatile LONG		_refreshBacklog;
 
-	typedef std::queue<std::pair<ServerMFD*, int> > BtnQueue;
 	
-	/// The button to inform pression in Orbiter in the main thread
-	BtnQueue			_btnPress;
+	/// The commands given to the main thread, which is the only one that can use the Orbiter API
+	CommandQueue		_commands;
+
+	/// The opened MFDs, by key
+	MFDRegistry			_mfds;
 
-	/// The MFDs to end a button press process
-	MFDQueue			_btnEnd;
+	/// The MFDs to refresh at the end of the current step, each only once. Those that could not be refreshed in the step budget stay for the next step.
+	/// Only accessed by the main thread.
+	std::vector<ServerMFD*>		_toRefresh;
 
-	/// The mutex to access MFD Map and different event queues
-	HANDLE				_mfdsMutex;
+	/// The button presses that have been processed, acknowledged once their MFD has been refreshed: their completion token, if any, is then woken.
+	/// Only accessed by the main thread.
+	std::vector<Command>	_completed;
 };
 
 #endif // __SERVER_H
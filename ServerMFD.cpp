@@ -4,19 +4,32 @@
 /// Copyright (C) 2010 File authors
 /// License LGPL
 
+#include "HashPixels.h"
 #include "Server.h"
 #include "ServerMFD.h"
 
+#include <algorithm>
 #include <gdiplus.h>
 #include <limits.h>
 
 int GetEncoderClsid(const WCHAR* format, CLSID* pClsid);
+INT32 getBigEndian(INT32 i);
+
+/// Appends a 32 bits big endian integer to a binary string.
+/// \param[in,out]	str		The string.
+/// \param[in]		i		The integer.
+static void appendBigEndian(std::string & str, INT32 i)
+{
+	INT32 be = getBigEndian(i);
+	str.append((const char *)&be, 4);
+}
 
 ServerMFD::ServerMFD(const std::string & key) :
 	// Initializes the specs and the ExternMFD with those specs
-	_spec(0, 0, 255, 255, 6, 6, 255 / 7, (255 * 2) / 13), ExternMFD(_spec),
+	_spec(0, 0, 255, 255, 6, 6, 255 / 7, (255 * 2) / 13), ExternMFD(_spec), _key(key),
 	// Default values for all properties
-	_pngFollowers(0), _jpegFollowers(0), _noxFollowers(0), _surface(0), _surfaceId(0), _surfaceHasChanged(false), _btnLabelsId(1), _btnClose(false)
+	_pngFollowers(0), _jpegFollowers(0), _noxFollowers(0), _surface(0), _surfaceId(0), _surfaceTime(0), _blitStart(0), _blitEnd(0), _surfaceHasChanged(false), _surfaceHash(0), _skippedEncodes(0), _deliveredFrames(0), _droppedFrames(0), _encodedFrames(0),
+	_tilesFollowers(0), _tilesBase(0), _tilesKey(0), _tilesKeyId(0), _tilesKeyAsked(0), _tilesSinceKey(0), _btnLabelsId(1), _btnClose(false)
 {
 	// First thing a MFD needs to do
 	Resize(_spec);
@@ -30,34 +43,75 @@ ServerMFD::ServerMFD(const std::string & key) :
 	_btnMutex = CreateMutex(NULL, FALSE, NULL);
 	_streamMutex = CreateMutex(NULL, FALSE, NULL);
 	_imageMutex = CreateMutex(NULL, FALSE, NULL);
+	_listenersMutex = CreateMutex(NULL, FALSE, NULL);
+
+	// Get the GDI+ encoder of JPEG, PNG and the tiles are encoded by the PngEncoder of their format
+	GetEncoderClsid(L"image/jpeg", &_formats[FORMAT_JPEG].clsid);
 
-	// Create the semaphore
-	_btnProcessSmp = CreateSemaphore(NULL, 1, 1, NULL);
+	// Create the formats mutexes
+	for (int i = 0; i < FORMAT_COUNT; ++i)
+		_formats[i].encodeMutex = CreateMutex(NULL, FALSE, NULL);
 
 	// Create the surface
 	_surface = oapiCreateSurface(255, 255);
 
-	// Load a compatible bitmap in order to get a compatible HBITMAP (...no comment...)
-	_bmpFromSurface = (HBITMAP)LoadImage(NULL, _T("WebMFD\\_testimage.bmp"), IMAGE_BITMAP, 0,0, LR_LOADFROMFILE);
+	// Create a 32 bits top-down DIB section in which the surface is copied, so that its pixels can be read directly
+	BITMAPINFO bmi;
+	memset(&bmi, 0, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = Width();
+	bmi.bmiHeader.biHeight = -Height();
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+	void * bits = 0;
+	_bmpFromSurface = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+
+	// The copied image is read directly in the pixels of the DIB section
+	_image.wrap(bits, Width(), Height(), Width() * 4);
+
+	// Allocate the image against which the tiles are compared
+	_tilesPrev.create(Width(), Height());
 }
 
 
 ServerMFD::~ServerMFD(void)
 {
+	// Make sure that no encoder worker uses the MFD anymore
+	Server::Instance().Encoders().cancel(this);
+
+	// Destroy the copied bitmap, the pixel buffers free themselves
+	DeleteObject(_bmpFromSurface);
+
+	// Release the current tiles keyframe
+	if (_tilesKey)
+		_tilesKey->Release();
+
 	// Destroy the mutexes
 	CloseHandle(_btnMutex);
-	CloseHandle(_btnProcessSmp);
 	CloseHandle(_streamMutex);
 	CloseHandle(_imageMutex);
+	CloseHandle(_listenersMutex);
 
-	// Delete the PNG stream and it's allocated memory
-	if (_streamPNG.stream)
-		_streamPNG.stream->Release();
-
-	// Delete the JPEG stream and it's allocated memory
-	if (_streamJPEG.stream)
-		_streamJPEG.stream->Release();
+	// Release the listeners that were not unregistered
+	for (std::set<SoConnection*>::iterator i = _listeners.begin(); i != _listeners.end(); ++i)
+		(*i)->Release();
 
+	for (int i = 0; i < FORMAT_COUNT; ++i)
+	{
+		// Destroy the format encoding mutex
+		CloseHandle(_formats[i].encodeMutex);
+
+		// Release the current frame and its header, followers that are still sending them hold their own reference
+		if (_formats[i].frame)
+			_formats[i].frame->Release();
+		if (_formats[i].header)
+			_formats[i].header->Release();
+
+		// Delete the stream and it's allocated memory
+		if (_formats[i].stream.stream)
+			_formats[i].stream.stream->Release();
+	}
 }
 
 
@@ -71,140 +125,220 @@ void ServerMFD::clbkRefreshDisplay(SURFHANDLE hSurf)
 	WaitForSingleObject(_imageMutex, INFINITE);
 
 	// Save the given surface to a local surface that is manipulable by other threads
+	// The blit is timed, to be traced with the image it produces
+	_blitStart = TimingStats::Now();
 	oapiBlt(_surface, hSurf, 0, 0, 0, 0, Width(), Height());
+	_blitEnd = TimingStats::Now();
 
-	// State that the surface has changed (trigering, in a follower thread, the image generation)
+	// State that the surface has changed
 	_surfaceHasChanged = true;
 
 	// Release the image surface access mutex
 	ReleaseMutex(_imageMutex);
+
+	// Trigger, in the encoder pool, the image generation
+	_queueEncodes();
 }
 
 void ServerMFD::clbkRefreshButtons ()
 {
 	// Regenerate the JSON string
 	_generateJSON();
+
+	// Wake the followers so that the button WebSockets send the new labels
+	_notifyListeners();
 }
 
-imageStream * ServerMFD::getStreamIf(const std::string &format, unsigned int &prevId)
+ServerMFD::Format ServerMFD::_format(const std::string &format)
 {
-	// Wait to be able to access the image buffers by waiting to gain acces to their mutex
-	WaitForSingleObject(_streamMutex, INFINITE);
+	// Get the format corresponding to the name
+	if (format == "png")
+		return FORMAT_PNG;
+	if (format == "jpeg")
+		return FORMAT_JPEG;
+	if (format == "tiles")
+		return FORMAT_TILES;
+
+	// The format is unknown
+	return FORMAT_COUNT;
+}
 
-	// If the image need to be regenerated, do it
-	if (_surfaceHasChanged)
-	{
-		// Wait to be able to access the image surface by waiting to gain acces to its mutex
-		WaitForSingleObject(_imageMutex, INFINITE);
 
-		// Copy the MFD surface to bitmap
-		_copySurfaceToBitmap();
+void ServerMFD::_queueEncodes()
+{
+	// Queue the encoding of the formats that have followers
+	// If the queue is full, the image will be encoded at one of the next refreshes, as the surface stays changed
+	if (_pngFollowers > 0)
+		Server::Instance().Encoders().push(this, FORMAT_PNG);
+	if (_jpegFollowers > 0)
+		Server::Instance().Encoders().push(this, FORMAT_JPEG);
+	if (_tilesFollowers > 0)
+		Server::Instance().Encoders().push(this, FORMAT_TILES);
+}
 
-		// Release the image surface access mutex
-		ReleaseMutex(_imageMutex);
 
-		// Generate the image from HBITMAP
-		_generateImage();
-	}
+void ServerMFD::addListener(SoConnection * connection)
+{
+	// The MFD holds a reference on the connection so that it can be woken even if it is closing
+	connection->AddRef();
 
-	// If the request gave the same id as the current id,
-	// it means that the image has not changed since last request.
-	if (prevId == _surfaceId)
-	{
-		// Release the image buffers access mutex
-		ReleaseMutex(_streamMutex);
+	// Register the listener
+	WaitForSingleObject(_listenersMutex, INFINITE);
+	_listeners.insert(connection);
+	ReleaseMutex(_listenersMutex);
+}
+
+
+void ServerMFD::addFollower(FollowerCounters * counters)
+{
+	// Register the counters
+	WaitForSingleObject(_listenersMutex, INFINITE);
+	_followers.insert(counters);
+	ReleaseMutex(_listenersMutex);
+}
+
+
+void ServerMFD::remFollower(FollowerCounters * counters)
+{
+	// Unregister the counters, the follower may then destroy them
+	WaitForSingleObject(_listenersMutex, INFINITE);
+	_followers.erase(counters);
+	ReleaseMutex(_listenersMutex);
+}
+
+
+void ServerMFD::collectFollowers(std::vector<FollowerCounters> & followers)
+{
+	// Copy the counters while they cannot be unregistered, and therefore destroyed
+	WaitForSingleObject(_listenersMutex, INFINITE);
+	for (std::set<FollowerCounters*>::iterator i = _followers.begin(); i != _followers.end(); ++i)
+		followers.push_back(**i);
+	ReleaseMutex(_listenersMutex);
+}
 
-		// Return an invalid handle because the image has not changed
+
+void ServerMFD::remListener(SoConnection * connection)
+{
+	// Unregister the listener
+	WaitForSingleObject(_listenersMutex, INFINITE);
+	bool found = _listeners.erase(connection) > 0;
+	ReleaseMutex(_listenersMutex);
+
+	// Release the reference that was held by the MFD
+	if (found)
+		connection->Release();
+}
+
+
+SoBuffer * ServerMFD::getFrameIf(const std::string &format, unsigned int &prevId, SoBuffer ** header /* = 0 */, DWORD * time /* = 0 */)
+{
+	// Get the requested format, the tiles frames are got with getTilesIf
+	Format f = _format(format);
+	if (f == FORMAT_COUNT || f == FORMAT_TILES)
 		return 0;
-	}
+
+	// Wait to be able to access the current frames by waiting to gain acces to their mutex
+	WaitForSingleObject(_streamMutex, INFINITE);
 
 	// What will be returned
-	imageStream * ret = 0;
+	SoBuffer * ret = 0;
 
-	// If the image is requested using the PNG format
-	if (format == "png")
+	// If the request gave the same id as the current id, it means that the image has not changed since last request.
+	// Else, get the frame of the requested format, if it has been generated (which means that there are followers of that format)
+	if (prevId != _formats[f].id)
+		ret = _formats[f].frame;
+
+	// If there is a frame to return
+	if (ret)
 	{
-		// If there are no PNG follower or if the PNG stream has not been allocated
-		if (_pngFollowers <= 0 || !_streamPNG.stream)
-		{
-			// Release the image buffers access mutex
-			ReleaseMutex(_streamMutex);
+		// The caller holds its own reference, so the frame stays valid after the mutex is released, even if a new frame replaces it
+		ret->AddRef();
 
-			// Return an invalid handle because the image has not been generated in PNG as there are no PNG followers
-			return 0;
-		}
+		// Update the given id reference
+		prevId = _formats[f].id;
 
-		// The PNG buffer will be returned
-		ret = &_streamPNG;
-	}
-	// If the image is requested using the JPEG format
-	else if (format == "jpeg" || !_streamJPEG.stream)
-	{
-		// If there are no JPEG follower or if the PNG stream has not been allocated
-		if (_jpegFollowers <= 0)
+		// Give the header that was built with the frame
+		if (header)
 		{
-			// Release the image buffers access mutex
-			ReleaseMutex(_streamMutex);
-
-			// Return an invalid handle because the image has not been generated in JPEG as there are no JPEG followers
-			return 0;
+			*header = _formats[f].header;
+			(*header)->AddRef();
 		}
 
-		// The JPEG buffer will be returned
-		ret = &_streamJPEG;
+		// Give the capture time of the image
+		if (time)
+			*time = _formats[f].time;
 	}
-	// The image is requested using an unknown format
-	else
-	{
-		// Release the image buffers access mutex
-		ReleaseMutex(_streamMutex);
 
-		// Return an invalid handle because the image has been requested in an unknown format
-		return 0;
-	}
-
-	// Update the given id reference
-	prevId = _surfaceId;
-
-	// Set the stream cursor at the beginning
-	LARGE_INTEGER moveBy;
-	moveBy.QuadPart = 0;
-	ret->stream->Seek(moveBy, STREAM_SEEK_SET, NULL);
+	// Release the current frames access mutex
+	ReleaseMutex(_streamMutex);
 
-	// Return the file handle
+	// Return the frame
 	return ret;
 }
 
 
-void ServerMFD::closeStream()
+SoBuffer * ServerMFD::getTilesIf(unsigned int &prevId, DWORD * time /* = 0 */)
 {
-	// Release the image buffers access mutex, enabling other thread to get the image and to update id
-	ReleaseMutex(_streamMutex);
-}
+	imageFormat & f = _formats[FORMAT_TILES];
 
+	// Wait to be able to access the current frames by waiting to gain acces to their mutex
+	WaitForSingleObject(_streamMutex, INFINITE);
 
-void	ServerMFD::waitForBtnProcess()
-{
-	// Wait for the button process mutex to be released, which means that no button process is running
-	WaitForSingleObject(_btnProcessSmp, INFINITE);
+	// What will be returned, and its id
+	SoBuffer * ret = 0;
+	unsigned int id = 0;
 
-	// Release the button process mutex as the lock was just to wait for its release
-	ReleaseSemaphore(_btnProcessSmp, 1, NULL);
-}
+	// Wether the follower needs a keyframe that does not exist yet
+	bool askKey = false;
 
+	// If there is a frame that the follower has not received yet
+	if (f.frame && prevId != f.id)
+	{
+		// The follower has received the base of the current frame: it only needs the changed tiles
+		if (prevId == _tilesBase)
+		{
+			ret = f.frame;
+			id = f.id;
+		}
+		// The follower is late or has just joined: it needs the keyframe of the current image
+		else if (_tilesKey && _tilesKeyId == f.id)
+		{
+			ret = _tilesKey;
+			id = _tilesKeyId;
+		}
+		else
+			askKey = true;
+	}
 
-void	ServerMFD::startBtnProcess()
-{
-	// Acquire a lock on the button process mutex, which means that a button process starts
-	WaitForSingleObject(_btnProcessSmp, INFINITE);
-}
+	// If there is a frame to return
+	if (ret)
+	{
+		// The caller holds its own reference, so the frame stays valid after the mutex is released, even if a new frame replaces it
+		ret->AddRef();
 
-void	ServerMFD::endBtnProcess()
-{
-	// Release the button process mutex, meaning the end of the button process
-	ReleaseSemaphore(_btnProcessSmp, 1, NULL);
+		// Update the given id reference
+		prevId = id;
+
+		// Give the capture time of the image, which is the same for the delta frame and the keyframe as they are both of the current image
+		if (time)
+			*time = f.time;
+	}
+
+	// Release the current frames access mutex
+	ReleaseMutex(_streamMutex);
+
+	// Ask the encoder pool for a keyframe, the follower will be woken when it is ready
+	if (askKey)
+	{
+		InterlockedExchange(&_tilesKeyAsked, 1);
+		Server::Instance().Encoders().push(this, FORMAT_TILES);
+	}
+
+	// Return the frame
+	return ret;
 }
 
+
 void	ServerMFD::execBtnProcess(int btnId)
 {
 	// If the button id is 13, it is the SEL key, send the corresponding event
@@ -226,13 +360,9 @@ void	ServerMFD::execBtnProcess(int btnId)
 		_btnClose = true;
 		ReleaseMutex(_btnMutex);
 
-		// Update the surface id
-		// The image has not been updated but the surface id is still incremented to force the refresh on all folowers,
-		// which will un-freeze them and enable to check getClose.
-		// Because the MFD has been shutdown, the image will no longer be refreshed and the id will no longer change.
-		WaitForSingleObject(_streamMutex, INFINITE);
-		++_surfaceId;
-		ReleaseMutex(_streamMutex);
+		// Wake the followers so that they check getClose
+		// Because the MFD has been shutdown, the image will no longer be refreshed and they would not be woken otherwise.
+		_notifyListeners();
 	}
 
 	// The button pressed is a regular button
@@ -280,6 +410,9 @@ std::string	ServerMFD::getJSONIf(unsigned int &prevId)
 	// Copy the JSON informations in a temporary variable as we need to release the mutex before returning
 	std::string ret = _JSON;
 
+	// Update the given id reference, so that the same labels are not returned again
+	prevId = _btnLabelsId;
+
 	// Release the button informations access mutex
 	ReleaseMutex(_btnMutex);
 
@@ -305,6 +438,9 @@ bool	ServerMFD::getClose()
 
 void ServerMFD::_copySurfaceToBitmap()
 {
+	// The copy is timed, to be traced with the image it produces
+	LONGLONG start = TimingStats::Now();
+
 	// Get the Device Context from the Surface
 	HDC hDCsrc = oapiGetDC(_surface);
 
@@ -320,78 +456,375 @@ void ServerMFD::_copySurfaceToBitmap()
 
 	// No need to regenrate until the surface changes
 	_surfaceHasChanged = false;
+
+	// Make sure that GDI has finished writing the pixels before reading them
+	GdiFlush();
+
+	// Hash the copied pixels: Orbiter refreshes the MFD even when it displays the exact same image (e.g. a static menu page)
+	UINT32 hash = hashPixels(_image.Data(), _image.Size());
+
+	// If the pixels are the same as the previous image, keep the image id so that the image is neither encoded nor sent again
+	// A collision of the 32 bits hash would only delay a new image until the next change of the surface
+	if (_surfaceId != 0 && hash == _surfaceHash)
+	{
+		InterlockedIncrement(&_skippedEncodes);
+		return ;
+	}
+	_surfaceHash = hash;
+
+	// Incrementing the image id, modulo the maximum possible value for a int
+	_surfaceId = ((_surfaceId + 1) % (UINT_MAX - 1)) + 1;
+
+	// Remember when the new image has been captured, so that the clients can know the age of the frames
+	_surfaceTime = GetTickCount();
+
+	// Trace the blit and the copy that have produced the new image
+	FrameTrace & trace = Server::Instance().Trace();
+	trace.record(FrameTrace::BLIT, _key, _surfaceId, _blitStart, _blitEnd);
+	trace.record(FrameTrace::COPY, _key, _surfaceId, start, TimingStats::Now());
 }
 
 
-void ServerMFD::_generateImage()
+bool ServerMFD::_encode(Format format)
 {
-	// Create a gdiplus image from the bitmap
-	Gdiplus::Bitmap * img = Gdiplus::Bitmap::FromHBITMAP(_bmpFromSurface, NULL);
+	imageFormat & f = _formats[format];
 
-	// Argument for later Seek call
-	LARGE_INTEGER moveBy;
-	moveBy.QuadPart = 0;
+	// Only one worker can encode a format at a time, as the format has only one image stream
+	WaitForSingleObject(f.encodeMutex, INFINITE);
 
-	// If the MFD have any PNG followers, then saves the image into the png image stream
-	if (_pngFollowers > 0)
+	// The tiles are encoded differently
+	if (format == FORMAT_TILES)
 	{
-		// If the PNG stream does not yet exists, allocates it
-		if (!_streamPNG.stream)
-		{
-			_streamPNG.Memory = GlobalAlloc(GMEM_MOVEABLE, 1024 * 64);
-			CreateStreamOnHGlobal(_streamPNG.Memory, TRUE, &_streamPNG.stream);
-		}
+		bool encoded = _encodeTiles();
+		ReleaseMutex(f.encodeMutex);
+		return encoded;
+	}
+
+	// Wait to be able to access the image surface by waiting to gain acces to its mutex
+	WaitForSingleObject(_imageMutex, INFINITE);
+
+	// Copy the MFD surface to bitmap if it has changed since the last copy
+	// The copy is shared by all formats: the first format worker does it
+	if (_surfaceHasChanged)
+		_copySurfaceToBitmap();
 
-		// Get the PNG encoder CLSID
-		CLSID pngClsid;
-		GetEncoderClsid(L"image/png", &pngClsid);
+	// The id of the image that will be encoded, and when it has been captured
+	unsigned int id = _surfaceId;
+	DWORD time = _surfaceTime;
 
-		// Move the stream cursor to the beginning of the stream
-		_streamPNG.stream->Seek(moveBy, STREAM_SEEK_SET, NULL);
+	// Wether the format has not already been encoded from the image
+	bool newImage = (id != f.id);
 
-		// Save the image into the stream
-		img->Save(_streamPNG.stream, &pngClsid);
+	// Take a copy of the image, so that it is encoded without holding the image mutex
+	// Each worker uses its own copy, so that the formats can be encoded in parallel
+	if (newImage)
+		f.pixels.copyFrom(_image);
 
-		// Get the size of the image according to the new cursor position
-		LARGE_INTEGER moveBy;
-		moveBy.QuadPart = 0;
-		ULARGE_INTEGER nPos;
-		_streamPNG.stream->Seek(moveBy, STREAM_SEEK_CUR, &nPos);
-		_streamPNG.size = nPos.QuadPart;
+	// Release the image surface access mutex
+	ReleaseMutex(_imageMutex);
+
+	// The current frame is already the latest image, most probably because the surface has not changed
+	if (!newImage)
+	{
+		ReleaseMutex(f.encodeMutex);
+		return false;
 	}
 
-	// If the MFD have any JPEG followers, then saves the image into the jpeg image stream
-	if (_jpegFollowers > 0)
+	// Encodes the image into a new frame, timing the encoding to trace it
+	LONGLONG start = TimingStats::Now();
+	SoBuffer * frame = 0;
+	if (format == FORMAT_PNG)
+	{
+		f.encoded.clear();
+		f.png.setLevel(Server::Instance().PngLevel());
+		f.png.encode(f.pixels.Data(), f.pixels.Width(), f.pixels.Height(), f.pixels.Stride(), f.encoded);
+		frame = SoBuffer::Create(f.encoded.data(), f.encoded.size());
+	}
+	else
+		frame = _encodeFrame(f);
+
+	// Wether the encoding has succeeded, as frame is swapped with the previous one
+	bool published = (frame != 0);
+
+	// Publish the new frame with its header, holding the current frames mutex only to swap the pointers
+	// The header is built here, once per frame, instead of by each follower
+	if (frame)
+	{
+		SoBuffer * header = _buildPartHeader(format, frame->Size());
+
+		WaitForSingleObject(_streamMutex, INFINITE);
+		std::swap(frame, f.frame);
+		std::swap(header, f.header);
+		f.id = id;
+		f.time = time;
+		ReleaseMutex(_streamMutex);
+
+		// Release the previous frame and header
+		// Followers that are still sending them hold their own reference, so they are only destroyed when they have been sent
+		if (frame)
+			frame->Release();
+		if (header)
+			header->Release();
+
+		// Count and trace the new frame
+		InterlockedIncrement(&_encodedFrames);
+		Server::Instance().Trace().record((FrameTrace::Stage)(FrameTrace::ENCODE_PNG + format), _key, id, start, TimingStats::Now());
+	}
+
+	ReleaseMutex(f.encodeMutex);
+
+	// Wake the followers so that they send the new image
+	_notifyListeners();
+
+	return published;
+}
+
+
+bool ServerMFD::_encodeTiles()
+{
+	imageFormat & f = _formats[FORMAT_TILES];
+
+	// Wait to be able to access the image surface by waiting to gain acces to its mutex
+	WaitForSingleObject(_imageMutex, INFINITE);
+
+	// Copy the MFD surface to bitmap if it has changed since the last copy
+	if (_surfaceHasChanged)
+		_copySurfaceToBitmap();
+
+	// The id of the latest image, and when it has been captured
+	unsigned int id = _surfaceId;
+	DWORD time = _surfaceTime;
+
+	// If the tiles frames have not yet been generated for the latest image, take a copy of its pixels
+	// so that the tiles are compared and encoded without holding the image mutex
+	bool newImage = (id != 0 && id != f.id);
+	if (newImage)
+		f.pixels.copyFrom(_image);
+
+	// Release the image surface access mutex
+	ReleaseMutex(_imageMutex);
+
+	// Wether a keyframe must be generated
+	bool key = (InterlockedExchange(&_tilesKeyAsked, 0) != 0);
+
+	// Nothing to do: the latest image has already been sent and no one needs a keyframe
+	if (!newImage && !key)
+		return false;
+
+	// The encoding is timed, to trace it
+	LONGLONG start = TimingStats::Now();
+
+	// The new frames
+	SoBuffer * delta = 0;
+	SoBuffer * keyFrame = 0;
+
+	// The base of the new delta frame: the current frame
+	unsigned int base = f.id;
+
+	// If there is a new image
+	if (newImage)
+	{
+		// Generate the frame of the tiles that have changed since the current frame
+		// If there is no current frame, all tiles are sent
+		delta = _buildTilesFrame(id, base, f.pixels, base ? &_tilesPrev : 0);
+
+		// The new image is now the one against which the next image will be compared
+		f.pixels.swap(_tilesPrev);
+
+		// Generate a keyframe regularly, so that late followers do not always have to ask for one
+		if (++_tilesSinceKey >= WEBMFD_TILES_KEYFRAME_INTERVAL)
+			key = true;
+	}
+	// The keyframe is generated for the current frame
+	else
+		id = f.id;
+
+	// Generate the keyframe: the whole image, in one tile
+	if (key && id != 0)
+	{
+		keyFrame = _buildTilesFrame(id, 0, _tilesPrev, 0);
+		_tilesSinceKey = 0;
+	}
+
+	// Trace the encoding of the new frames
+	bool published = (delta || keyFrame);
+	if (published)
+		Server::Instance().Trace().record(FrameTrace::ENCODE_TILES, _key, id, start, TimingStats::Now());
+
+	// Count the new frames, before they are swapped with the previous ones
+	if (delta)
+		InterlockedIncrement(&_encodedFrames);
+	if (keyFrame)
+		InterlockedIncrement(&_encodedFrames);
+
+	// Publish the new frames, holding the current frames mutex only to swap the pointers
+	WaitForSingleObject(_streamMutex, INFINITE);
+	if (delta)
+	{
+		std::swap(delta, f.frame);
+		f.id = id;
+		f.time = time;
+		_tilesBase = base;
+	}
+	if (keyFrame)
 	{
-		// If the JPEG stream does not yet exists, allocates it
-		if (!_streamJPEG.stream)
+		std::swap(keyFrame, _tilesKey);
+		_tilesKeyId = id;
+	}
+	ReleaseMutex(_streamMutex);
+
+	// Release the previous frames
+	// Followers that are still sending them hold their own reference, so they are only destroyed when they have been sent
+	if (delta)
+		delta->Release();
+	if (keyFrame)
+		keyFrame->Release();
+
+	// Wake the followers so that they send the new frames
+	_notifyListeners();
+
+	return published;
+}
+
+
+SoBuffer * ServerMFD::_buildTilesFrame(unsigned int id, unsigned int base, const PixelBuffer & pixels, const PixelBuffer * prev)
+{
+	// The number of bytes between two lines of pixels
+	int stride = pixels.Stride();
+
+	// The size of the tiles: the whole image for a keyframe
+	int tileWidth = prev ? WEBMFD_TILE_SIZE : Width();
+	int tileHeight = prev ? WEBMFD_TILE_SIZE : Height();
+
+	// The tiles of the frame
+	std::string tiles;
+	int nbTiles = 0;
+
+	// The encoded image of a tile
+	std::string png;
+	_formats[FORMAT_TILES].png.setLevel(Server::Instance().PngLevel());
+
+	// For each tile
+	for (int y = 0; y < Height(); y += tileHeight)
+		for (int x = 0; x < Width(); x += tileWidth)
 		{
-			_streamJPEG.Memory = GlobalAlloc(GMEM_MOVEABLE, 1024 * 64);
-			CreateStreamOnHGlobal(_streamJPEG.Memory, TRUE, &_streamJPEG.stream);
+			// The size of the tile: the tiles at the right and bottom edges are smaller
+			int w = (Width() - x < tileWidth) ? Width() - x : tileWidth;
+			int h = (Height() - y < tileHeight) ? Height() - y : tileHeight;
+
+			// The first pixel of the tile
+			const unsigned char * tile = pixels.Line(y) + x * 4;
+
+			// If there is a base image, check if a line of the tile has changed
+			if (prev)
+			{
+				bool changed = false;
+				for (int line = 0; line < h && !changed; ++line)
+					changed = (memcmp(tile + line * stride, prev->Line(y + line) + x * 4, w * 4) != 0);
+
+				// The tile has not changed, it is not sent
+				if (!changed)
+					continue ;
+			}
+
+			// Encode the tile, using directly the pixels of the image
+			png.clear();
+			_formats[FORMAT_TILES].png.encode(tile, w, h, stride, png);
+
+			// Add the tile coordinates and its encoded image
+			appendBigEndian(tiles, x);
+			appendBigEndian(tiles, y);
+			appendBigEndian(tiles, w);
+			appendBigEndian(tiles, h);
+			appendBigEndian(tiles, (INT32)png.size());
+			tiles += png;
+
+			++nbTiles;
 		}
 
-		// Get the JPEG encoder CLSID
-		CLSID jpegClsid;
-		GetEncoderClsid(L"image/jpeg", &jpegClsid);
+	// The frame header: the frame and base ids and the number of tiles
+	std::string header;
+	appendBigEndian(header, 12 + (INT32)tiles.size());
+	appendBigEndian(header, id);
+	appendBigEndian(header, base);
+	appendBigEndian(header, nbTiles);
 
-		// Move the stream cursor to the beginning of the stream
-		_streamJPEG.stream->Seek(moveBy, STREAM_SEEK_SET, NULL);
+	// Build the frame buffer
+	SoBuffer * frame = SoBuffer::Create(header.size() + tiles.size());
+	memcpy(frame->Data(), header.data(), header.size());
+	memcpy(frame->Data() + header.size(), tiles.data(), tiles.size());
 
-		// Save the image into the stream
-		img->Save(_streamJPEG.stream, &jpegClsid);
+	// Return the new frame
+	return frame;
+}
+
+
+SoBuffer * ServerMFD::_encodeFrame(imageFormat & format)
+{
+	imageStream & stream = format.stream;
 
-		// Get the size of the image according to the new cursor position
-		LARGE_INTEGER moveBy;
-		moveBy.QuadPart = 0;
-		ULARGE_INTEGER nPos;
-		_streamJPEG.stream->Seek(moveBy, STREAM_SEEK_CUR, &nPos);
-		_streamJPEG.size = nPos.QuadPart;
+	// Build the GDI+ image directly over the copied pixels
+	Gdiplus::Bitmap img(format.pixels.Width(), format.pixels.Height(), format.pixels.Stride(), PixelFormat32bppRGB, format.pixels.Data());
+
+	// If the stream does not yet exists, allocates it
+	if (!stream.stream)
+	{
+		stream.Memory = GlobalAlloc(GMEM_MOVEABLE, 1024 * 64);
+		CreateStreamOnHGlobal(stream.Memory, TRUE, &stream.stream);
 	}
 
-	delete img;
+	// Move the stream cursor to the beginning of the stream
+	LARGE_INTEGER moveBy;
+	moveBy.QuadPart = 0;
+	stream.stream->Seek(moveBy, STREAM_SEEK_SET, NULL);
 
-	// Incrementing the image id, modulo the maximum possible value for a int
-	_surfaceId = ((_surfaceId + 1) % (UINT_MAX - 1)) + 1;
+	// Save the image into the stream
+	if (img.Save(stream.stream, &format.clsid) != Gdiplus::Ok)
+		return 0;
+
+	// Get the size of the image according to the new cursor position
+	ULARGE_INTEGER nPos;
+	stream.stream->Seek(moveBy, STREAM_SEEK_CUR, &nPos);
+	stream.size = (int)nPos.QuadPart;
+
+	// Copy the encoded image from the stream memory into an immutable frame buffer
+	HGLOBAL memory;
+	if (GetHGlobalFromStream(stream.stream, &memory) != S_OK)
+		return 0;
+	SoBuffer * frame = SoBuffer::Create(GlobalLock(memory), stream.size);
+	GlobalUnlock(memory);
+
+	// Return the new frame
+	return frame;
+}
+
+
+SoBuffer * ServerMFD::_buildPartHeader(Format format, size_t size)
+{
+	// The next image boundary and the image type in the motion image stream
+	std::string header = "\r\n--MFDNextImage--\r\nContent-Type: image/";
+	header += (format == FORMAT_JPEG) ? "jpeg" : "png";
+
+	// The content-length header and the empty line indicating the end of the headers
+	char length[15];
+	_itoa_s((int)size, length, 15, 10);
+	header += "\r\nContent-Length: ";
+	header += length;
+	header += "\r\n\r\n";
+
+	// Return the header in a buffer that can be shared by all followers
+	return SoBuffer::Create(header.data(), header.size());
+}
+
+
+void ServerMFD::_notifyListeners()
+{
+	// Wake each listener. A wake only posts an event to the reactor, so this never waits for a follower
+	// The wakes of a listener that has not yet handled the previous one are coalesced
+	WaitForSingleObject(_listenersMutex, INFINITE);
+	for (std::set<SoConnection*>::iterator i = _listeners.begin(); i != _listeners.end(); ++i)
+		(*i)->wake();
+	ReleaseMutex(_listenersMutex);
 }
 
 
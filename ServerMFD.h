@@ -7,8 +7,22 @@
 #ifndef __SERVERMFD_H
 #define __SERVERMFD_H
 
+#include "PixelBuffer.h"
+#include "PngEncoder.h"
+#include "SoHTTP/SoBuffer.h"
+#include "SoHTTP/SoConnection.h"
+#include "SoHTTP/SoCounter.h"
+
 #include <Orbitersdk.h>
 #include <atlimage.h>
+#include <set>
+#include <vector>
+
+/// The size, in pixels, of the square tiles in which the MFD image is divided for the tiles stream
+#define WEBMFD_TILE_SIZE				32
+
+/// The number of tiles frames after which a keyframe is generated even if no follower has asked for one
+#define WEBMFD_TILES_KEYFRAME_INTERVAL	100
 
 /// C++ version of Orbiter's MFDSPEC
 /// Adds a constructor that initializes the data
@@ -30,7 +44,7 @@ struct CppMFDSPEC : public MFDSPEC
 	}
 };
 
-/// Image stream structure to be passed to image followers
+/// Image stream structure in which GDI+ encodes the images
 struct imageStream
 {
 	/// Constructor
@@ -46,15 +60,97 @@ struct imageStream
 	int			size;
 };
 
+/// An image format in which a MFD is encoded, with its current frame
+struct imageFormat
+{
+	/// Constructor
+	imageFormat() : frame(0), header(0), id(0), time(0), encodeMutex(0) {}
+
+	/// The CLSID of the GDI+ encoder, for the formats that are encoded by GDI+
+	CLSID			clsid;
+
+	/// The stream structure in which GDI+ encodes the images
+	imageStream		stream;
+
+	/// The encoder of the formats that are encoded in PNG
+	PngEncoder		png;
+
+	/// The copy of the image being encoded, read directly by the encoder
+	PixelBuffer		pixels;
+
+	/// The buffer in which the PNG images are encoded
+	std::string		encoded;
+
+	/// The current frame, shared by all followers of the format
+	SoBuffer *		frame;
+
+	/// The multipart header of the current frame in the motion image stream, built once per frame and shared by all followers
+	SoBuffer *		header;
+
+	/// The id of the surface from which the current frame has been encoded. 0 if there is no frame yet.
+	unsigned int	id;
+
+	/// The tick count (GetTickCount) at which the surface of the current frame has been captured
+	DWORD			time;
+
+	/// The mutex to encode the images: only one encoder worker can encode a format of a MFD at a time.
+	HANDLE			encodeMutex;
+};
+
+
+/// The counters of one follower of a MFD: a MFD stream, or a subscription of a cockpit WebSocket.
+/// They show how each follower keeps up: a slow follower drops the frames it could not send in time, a fast one delivers them all.
+/// The follower owns them and registers them to its MFD (see ServerMFD::addFollower) so that they are reported by the /stats route.
+/// They are only written by the I/O callbacks of the follower connection, and read without lock.
+struct FollowerCounters
+{
+	/// Constructor
+	/// \param[in]	v	The kind of follower: "stream" or "cockpit".
+	/// \param[in]	f	The format of the images: "png", "jpeg", "tiles" or "none".
+	FollowerCounters(const char * v = "", const std::string & f = "") : via(v), format(f), since(GetTickCount()), delivered(0), dropped(0) {}
+
+	/// The kind of follower: "stream" or "cockpit"
+	const char *	via;
+
+	/// The format of the images: "png", "jpeg", "tiles" or "none"
+	std::string		format;
+
+	/// The tick count (GetTickCount) at which the follower has started following the MFD
+	DWORD			since;
+
+	/// The number of frames sent to the follower. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	delivered;
+
+	/// The number of frames replaced in the mailbox of the follower before being sent. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	dropped;
+};
+
 
 /// Handles a MFD life cycle displayed by the web server
 /// To be used by the WebMFD Server
 class ServerMFD : public ExternMFD
 {
 public:
+	/// The formats in which the images can be encoded
+	enum Format
+	{
+		FORMAT_PNG = 0,
+		FORMAT_JPEG,
+
+		/// The changed tiles, each encoded in PNG (see getTilesIf)
+		FORMAT_TILES,
+
+		/// The number of formats
+		FORMAT_COUNT
+	};
+
 	/// Constructor
 	ServerMFD(const std::string & key);
 
+	/// Gets the key on which the MFD is registered
+	/// \return The key of the MFD
+	const std::string &	Key() const { return _key; }
+
 	/// Gets the MFD Width
 	/// FIXME: Currently, always 255
 	/// \return The width of the MFD
@@ -72,64 +168,155 @@ public:
 	void			unRegister() { oapiUnregisterExternMFD(this); }
 
 	/// Callback called by Orbiter when the MFD should refresh
+	/// Queues the encoding of the new image in the formats that have followers.
 	/// \param[in]	hSurf	The surface containing the new MFD image
 	virtual void	clbkRefreshDisplay(SURFHANDLE hSurf);
 
 	/// Callback called by Orbiter when the buttons change
 	virtual void clbkRefreshButtons();
 
+	/// The followers are counted atomically, as they are read without lock by the main thread and the encoders.
+	/// The add and rem methods of a MFD are called by the MFDRegistry while holding the lock of the MFD key, so they are never called concurrently.
+
 	/// Informs the ServerMFD that there is one more follower that will be looking at its PNG image
-	void			addPng() { ++_pngFollowers; }
+	void			addPng() { InterlockedIncrement(&_pngFollowers); }
 
 	/// Informs the ServerMFD that there is one less follower that will be looking at its PNG image
-	void			remPng() { if (_pngFollowers > 0) --_pngFollowers; }
+	void			remPng() { if (_pngFollowers > 0) InterlockedDecrement(&_pngFollowers); }
 
 	/// Informs the ServerMFD that there is one more follower that will be looking at its JPEG image
-	void			addJpeg() { ++_jpegFollowers; }
+	void			addJpeg() { InterlockedIncrement(&_jpegFollowers); }
 
 	/// Informs the ServerMFD that there is one less follower that will be looking at its JPEG image
-	void			remJpeg() { if (_jpegFollowers > 0) --_jpegFollowers; }
+	void			remJpeg() { if (_jpegFollowers > 0) InterlockedDecrement(&_jpegFollowers); }
+
+	/// Informs the ServerMFD that there is one more follower that will be looking at its tiles frames
+	void			addTiles() { InterlockedIncrement(&_tilesFollowers); }
+
+	/// Informs the ServerMFD that there is one less follower that will be looking at its tiles frames
+	void			remTiles() { if (_tilesFollowers > 0) InterlockedDecrement(&_tilesFollowers); }
 
 	/// Informs the ServerMFD that there is one more follower that won't be looking at any of it's image (will only use buttons)
-	void			addNox() { ++_noxFollowers; }
+	void			addNox() { InterlockedIncrement(&_noxFollowers); }
 
 	/// Informs the ServerMFD that there is one less follower that won't be looking at any of it's image
-	void			remNox() { if (_noxFollowers > 0) --_noxFollowers; }
+	void			remNox() { if (_noxFollowers > 0) InterlockedDecrement(&_noxFollowers); }
+
+	/// Registers a connection to be woken each time the MFD image or its button labels change.
+	/// The MFD holds a reference on the connection until remListener is called.
+	/// Can be called from any thread.
+	/// \param[in]	connection	The connection to wake.
+	void			addListener(SoConnection * connection);
+
+	/// Unregisters a connection registered with addListener.
+	/// Can be called from any thread.
+	/// \param[in]	connection	The connection to stop waking.
+	void			remListener(SoConnection * connection);
+
+	/// Gets the number of refreshes of the MFD surface that have not produced a new image, as its pixels had not changed.
+	/// Each of them saves an encoding for each followed format.
+	/// \return the number of saved encodings
+	unsigned int	SkippedEncodes() const { return (unsigned int)_skippedEncodes; }
+
+	/// Registers the counters of a follower, to be reported with the counters of the MFD (see collectFollowers).
+	/// The counters must stay valid until remFollower is called, which must be before the follower closes the MFD.
+	/// Can be called from any thread.
+	/// \param[in]	counters	The counters of the follower.
+	void			addFollower(FollowerCounters * counters);
+
+	/// Unregisters the counters of a follower registered with addFollower.
+	/// Can be called from any thread.
+	/// \param[in]	counters	The counters of the follower.
+	void			remFollower(FollowerCounters * counters);
+
+	/// Copies the counters of the registered followers.
+	/// Can be called from any thread.
+	/// \param[out]	followers	Receives a copy of the counters of each follower.
+	void			collectFollowers(std::vector<FollowerCounters> & followers);
+
+	/// Counts a frame that a follower has sent, in its counters and in the totals of the MFD.
+	/// Can be called from any thread.
+	/// \param[in,out]	follower	The counters of the follower.
+	/// \param[in]		bytes		The number of bytes sent for the frame, including its header.
+	void			countDelivered(FollowerCounters & follower, size_t bytes) { InterlockedIncrement(&follower.delivered); InterlockedIncrement(&_deliveredFrames); _bytesOut.add(bytes); }
+
+	/// Counts a frame that a follower has dropped because a newer one was published before it could be sent, in its counters and in the totals of the MFD.
+	/// Can be called from any thread.
+	/// \param[in,out]	follower	The counters of the follower.
+	void			countDropped(FollowerCounters & follower) { InterlockedIncrement(&follower.dropped); InterlockedIncrement(&_droppedFrames); }
+
+	/// Gets the number of frames sent by all the follower streams of the MFD.
+	/// \return the number of delivered frames
+	unsigned int	DeliveredFrames() const { return (unsigned int)_deliveredFrames; }
+
+	/// Gets the number of frames dropped by all the follower streams of the MFD.
+	/// \return the number of dropped frames
+	unsigned int	DroppedFrames() const { return (unsigned int)_droppedFrames; }
+
+	/// Gets the number of bytes of the frames sent by all the follower streams of the MFD.
+	/// \return the number of bytes sent
+	LONGLONG		BytesOut() const { return _bytesOut.Value(); }
+
+	/// Gets the number of frames encoded, in all formats.
+	/// \return the number of encoded frames
+	unsigned int	EncodedFrames() const { return (unsigned int)_encodedFrames; }
+
+	/// Gets the number of PNG folowers
+	/// \return the number of PNG folowers
+	unsigned int	PngFollowers() const { return (unsigned int)_pngFollowers; }
+
+	/// Gets the number of JPEG folowers
+	/// \return the number of JPEG folowers
+	unsigned int	JpegFollowers() const { return (unsigned int)_jpegFollowers; }
+
+	/// Gets the number of tiles folowers
+	/// \return the number of tiles folowers
+	unsigned int	TilesFollowers() const { return (unsigned int)_tilesFollowers; }
+
+	/// Gets the number of folowers with no image interest
+	/// \return the number of button only folowers
+	unsigned int	NoxFollowers() const { return (unsigned int)_noxFollowers; }
 
 	/// Gets the total number of all folowers
 	/// \return the number of folowers
-	unsigned int	Followers() { return _pngFollowers + _jpegFollowers + _noxFollowers; }
+	unsigned int	Followers() const { return (unsigned int)(_pngFollowers + _jpegFollowers + _tilesFollowers + _noxFollowers); }
 
-	/// Returns a IStream* containing the desired image if and only if the prevId is not the current image id.
-	/// The current id can never be 0, so a 0 prevId means that it should always return the stream, except when the MFD has been created but not yet refreshed.
+	/// Returns the buffer containing the desired encoded image if and only if the prevId is not the current image id.
+	/// The current id can never be 0, so a 0 prevId means that it should always return the image, except when the MFD has been created but not yet refreshed.
+	/// The images are encoded by the encoder pool: this never encodes and never waits for an encoding.
 	/// This will return 0 if:
 	///   - The image is requested in a format that does not have any followers.
 	///   - prevId is the same as the current image id.
 	/// When the image is correctly returned:
 	///   - prevId is updated to the current image id.
-	///   - The ownership of the stream is granted, which means that the stream cannot be read or updated by any other thread until closeStream is called.
+	///   - The caller holds a reference on the returned buffer and must Release it.
+	///     The buffer is immutable, so the caller can send it without holding any lock while the next image is generated.
+	///   - If header is given, it is set to the multipart header of the image, on which the caller also holds a reference.
+	///   - If time is given, it is set to the tick count at which the image has been captured.
 	/// \param[in]		format	The format of the image requested: "png" or "jpeg".
 	/// \param[in,out]	prevId	The id of the previous image. Updated if there is a new image.
-	/// \return the Istream or 0
-	imageStream *	getStreamIf(const std::string &format, unsigned int &prevId);
-
-	/// Closes a stream opened with getStreamIf
-	/// Releases it ownership
-	void			closeStream();
-
-	/// Starts a Button press process.
-	/// Waits for any other button process to finish and then start a button process.
-	/// There cannot be two button process on the same MFD at the same time.
-	/// Can be called from any thread.
-	void			startBtnProcess();
-
-	/// Ends a Button press process, relasing any lock on waitForBtnProcess and allowing next button press processes.
-	/// Should only be called by the same thread that called execBtnProcess, after a orbiter core processing.
-	void			endBtnProcess();
-
-	/// Waits until the current button process ends.
-	/// Can be called from any thread.
-	void			waitForBtnProcess();
+	/// \param[out]		header	If not null, receives the multipart header of the image in the motion image stream.
+	/// \param[out]		time	If not null, receives the tick count (GetTickCount) at which the image has been captured.
+	/// \return the image buffer or 0
+	SoBuffer *		getFrameIf(const std::string &format, unsigned int &prevId, SoBuffer ** header = 0, DWORD * time = 0);
+
+	/// Returns the buffer containing the next tiles frame to send to a follower whose last frame is prevId.
+	/// A tiles frame only contains the tiles that changed since its base frame, so that a follower can only apply it on top of its base frame:
+	///   - If prevId is the base of the current frame, the current (delta) frame is returned.
+	///   - Else, the follower is late or has just joined: the keyframe of the current image is returned.
+	///     If there is none, one is asked to the encoder pool and 0 is returned: the follower will be woken when it is ready.
+	/// A tiles frame is a binary message whose integers are 32 bits big endian:
+	///   - The length of the message, not including this integer.
+	///   - The id of the frame.
+	///   - The id of the base frame, 0 for a keyframe (which contains the whole image).
+	///   - The number of tiles, then for each tile: x, y, width, height, the size of the PNG image and the PNG image.
+	/// When a frame is correctly returned:
+	///   - prevId is updated to the id of the frame.
+	///   - The caller holds a reference on the returned buffer and must Release it.
+	/// \param[in,out]	prevId	The id of the last frame the follower received. Updated if a frame is returned.
+	/// \param[out]		time	If not null and a frame is returned, receives the tick count (GetTickCount) at which its image has been captured.
+	/// \return the tiles frame buffer or 0
+	SoBuffer *		getTilesIf(unsigned int &prevId, DWORD * time = 0);
 
 	/// Execute the a button process.
 	/// Must be called from the main Orbiter thread as it uses Orbiter API.
@@ -141,6 +328,8 @@ public:
 
 	/// Returns the JSON string with all the button labels if and only if the prevId is not the current button labels id
 	/// The current id can never be 0, so a 0 prevId means that it should always return the JSON string.
+	/// When the JSON string is returned, prevId is updated to the current button labels id.
+	/// \param[in,out]	prevId	The id of the previous button labels. Updated if there are new labels.
 	/// \return All buttons label in a JSON string or an empty string
 	std::string		getJSONIf(unsigned int &prevId);
 
@@ -156,13 +345,57 @@ protected:
 	virtual ~ServerMFD(void);
 
 private:
-	/// Called to copy the content of MFD surface to bitmap
-	/// This must be called before releasing stream mutex and before calling _generateImage()
-	void ServerMFD::_copySurfaceToBitmap();
-
-	/// Called to regenerate the JPEG and PNG images
-	/// This must be called while having the ownership of _streamMutex
-	void			_generateImage();
+	/// Gets the format corresponding to a format name.
+	/// \param[in]	format	The format name: "png" or "jpeg".
+	/// \return The format, or FORMAT_COUNT if the name is unknown.
+	static Format	_format(const std::string &format);
+
+	/// Queues the encoding of the current image in each format that has followers.
+	void			_queueEncodes();
+
+	/// Called to copy the content of MFD surface to _image
+	/// The image id is only incremented if the copied pixels are different from the previous image.
+	/// This must be called while having the ownership of _imageMutex
+	void			_copySurfaceToBitmap();
+
+	/// Encodes the latest MFD image in the given format and publishes it as the current frame of the format.
+	/// Does nothing if the current frame already is the latest image.
+	/// Called by the encoder pool workers: the formats of a MFD can be encoded in parallel.
+	/// \param[in]	format	The format in which to encode.
+	/// \return Wether a new frame has been published.
+	bool			_encode(Format format);
+
+	/// Encodes the latest MFD image in tiles frames and publishes them.
+	/// Generates the delta frame of the new image, if any, and a keyframe if one has been asked or if the keyframe interval has elapsed.
+	/// Must be called while having the ownership of the tiles format encodeMutex.
+	/// \return Wether a new frame has been published.
+	bool			_encodeTiles();
+
+	/// Builds a tiles frame.
+	/// Must be called while having the ownership of the tiles format encodeMutex.
+	/// \param[in]	id		The id of the frame.
+	/// \param[in]	base	The id of the base frame, 0 for a keyframe.
+	/// \param[in]	pixels	The image.
+	/// \param[in]	prev	The base image, or 0 to send the whole image as one tile.
+	/// \return The new frame buffer, or 0 if the encoding has failed.
+	SoBuffer *		_buildTilesFrame(unsigned int id, unsigned int base, const PixelBuffer & pixels, const PixelBuffer * prev);
+
+	/// Encodes the pixels of a format with GDI+ into its image stream and copies the result into a new frame buffer.
+	/// The GDI+ image is built directly over the pixels, without copying them.
+	/// This must be called while having the ownership of the format encodeMutex
+	/// \param[in]	format	The format in which to encode.
+	/// \return The new frame buffer, or 0 if the encoding has failed.
+	SoBuffer *		_encodeFrame(imageFormat & format);
+
+	/// Builds the header that precedes an image in the motion image stream: its boundary, Content-Type and Content-Length.
+	/// \param[in]	format	The format of the image.
+	/// \param[in]	size	The size of the encoded image.
+	/// \return The new header buffer.
+	static SoBuffer *	_buildPartHeader(Format format, size_t size);
+
+	/// Wakes all the listeners: the MFD surface has changed or a new image is available.
+	/// Never blocks on a listener, can be called from the main Orbiter thread.
+	void			_notifyListeners();
 
 	/// Generates the JSON string and stores it in _JSON.
 	/// Must be called from the main Orbiter thread.
@@ -171,32 +404,88 @@ private:
 	/// The MFD specifications.
 	CppMFDSPEC		_spec;
 
-	/// The mutex to access the streams.
-	HANDLE			_streamMutex;
+	/// The key on which the MFD is registered, used to trace its frames
+	std::string		_key;
 
-	/// The stream structure for the PNG followers
-	imageStream		_streamPNG;
+	/// The mutex to access the current frames and their ids.
+	/// Is only held while getting or replacing a frame pointer, never while encoding or sending.
+	HANDLE			_streamMutex;
 
-	/// The stream structure for the JPEG followers
-	imageStream		_streamJPEG;
+	/// The formats in which the images are encoded, with their current frame
+	imageFormat		_formats[FORMAT_COUNT];
 
-	/// The id of the current image. Is incremented at each MFD refresh. Cannot be 0.
+	/// The id of the image copied in _image. Is incremented at each copy of the MFD surface that changes its pixels. Cannot be 0.
 	unsigned int	_surfaceId;
 
+	/// The tick count (GetTickCount) at which the image copied in _image has been captured
+	DWORD			_surfaceTime;
+
+	/// The performance counters at the beginning and the end of the last blit of the Orbiter surface, traced with the image it produces
+	LONGLONG		_blitStart, _blitEnd;
+
 	/// The SURFHANDLE used in threads (not managed by the Orbiter core)
 	SURFHANDLE		_surface;
 
 	/// Wether the image needs to be regenerated.
 	bool			_surfaceHasChanged;
 
-	/// The number of PNG folowers.
-	unsigned int	_pngFollowers;
+	/// The hash of the pixels of the image copied in _image
+	UINT32			_surfaceHash;
+
+	/// The number of refreshes of the MFD surface whose pixels had not changed.
+	volatile LONG	_skippedEncodes;
+
+	/// The number of frames sent by the follower streams.
+	volatile LONG	_deliveredFrames;
+
+	/// The number of frames dropped by the follower streams.
+	volatile LONG	_droppedFrames;
+
+	/// The number of bytes of the frames sent by the follower streams.
+	SoCounter		_bytesOut;
+
+	/// The number of frames encoded, in all formats.
+	volatile LONG	_encodedFrames;
+
+	/// The connections to wake when the image changes. The MFD holds a reference on each of them.
+	std::set<SoConnection*>	_listeners;
+
+	/// The counters of the followers, owned by the followers.
+	std::set<FollowerCounters*>	_followers;
+
+	/// The mutex to access the listeners and the counters of the followers.
+	HANDLE			_listenersMutex;
 
-	/// The number of JPEG folowers.
-	unsigned int	_jpegFollowers;
+	/// The number of PNG folowers. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	_pngFollowers;
 
-	/// The number of folowers with no image interest.
-	unsigned int	_noxFollowers;
+	/// The number of JPEG folowers. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	_jpegFollowers;
+
+	/// The number of tiles folowers. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	_tilesFollowers;
+
+	/// The id of the base frame of the current tiles frame (which is in _formats[FORMAT_TILES]).
+	unsigned int	_tilesBase;
+
+	/// The current tiles keyframe. Is accessed with _streamMutex.
+	SoBuffer *		_tilesKey;
+
+	/// The id of the current tiles keyframe.
+	unsigned int	_tilesKeyId;
+
+	/// Wether a follower has asked for a tiles keyframe. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	_tilesKeyAsked;
+
+	/// The number of tiles frames generated since the last keyframe.
+	unsigned int	_tilesSinceKey;
+
+	/// The image of the current tiles frame, against which the next image is compared.
+	/// The image being encoded in tiles is in _formats[FORMAT_TILES].pixels.
+	PixelBuffer		_tilesPrev;
+
+	/// The number of folowers with no image interest. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG	_noxFollowers;
 
 	/// The mutex to handle the button processes.
 	HANDLE			_btnMutex;
@@ -207,18 +496,19 @@ private:
 	/// Wether the close button have been pressed or not.
 	bool			_btnClose;
 
-	/// The button process binary semaphore: locked when a button process is running.
-	/// Is a binary semaphore instead of a mutex because the mutex has thread ownership which breaks the required behaviour.
-	HANDLE			_btnProcessSmp;
-
 	/// The labels of all buttons encoded in JSON
 	std::string		_JSON;
 
-	/// The copied bitmap from surface
+	/// The bitmap in which GDI copies the surface, a 32 bits top-down DIB section
 	HBITMAP			_bmpFromSurface;
 
-	/// The mutex to access the image surface
+	/// The copied image: a view on the pixels of _bmpFromSurface, from which each format takes its copy
+	PixelBuffer		_image;
+
+	/// The mutex to access the image surface and the copied image
 	HANDLE			_imageMutex;
+
+	friend class EncoderPool;
 };
 
 #endif // __SERVERMFD_H
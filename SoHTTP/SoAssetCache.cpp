@@ -0,0 +1,364 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#include "SoAssetCache.h"
+#include "SoDeflate.h"
+
+#include <ctype.h>
+#include <stdio.h>
+
+/// Watching thread start function.
+/// Just launch the _watch method on the given SoAssetCache object pointer.
+DWORD WINAPI assetCacheWatch(LPVOID lpParameter)
+{
+	// Launch _watch
+	((SoAssetCache*)lpParameter)->_watch();
+
+	// Thread return value
+	return 0;
+}
+
+
+SoAsset::SoAsset(const std::string & type, const std::string & etag, const FILETIME & modified, SoBuffer * body, SoBuffer * gzip, const std::string & location) :
+	_refs(1), _type(type), _etag(etag), _modified(modified), _body(body), _gzip(gzip), _location(location)
+{
+}
+
+
+SoAsset::~SoAsset()
+{
+	// Release the buffers
+	_body->Release();
+	if (_gzip)
+		_gzip->Release();
+}
+
+
+void	SoAsset::Release()
+{
+	if (InterlockedDecrement(&_refs) == 0)
+		delete this;
+}
+
+
+/// The Content-Type of each known file extension
+static const struct { const char * ext; const char * type; bool compress; } assetTypes[] =
+{
+	{ "html",	"text/html",				true },
+	{ "htm",	"text/html",				true },
+	{ "css",	"text/css",					true },
+	{ "js",		"application/javascript",	true },
+	{ "json",	"application/json",			true },
+	{ "txt",	"text/plain",				true },
+	{ "xml",	"text/xml",					true },
+	{ "svg",	"image/svg+xml",			true },
+	{ "ico",	"image/x-icon",				true },
+	{ "png",	"image/png",				false },
+	{ "jpg",	"image/jpeg",				false },
+	{ "jpeg",	"image/jpeg",				false },
+	{ "gif",	"image/gif",				false },
+	{ 0,		0,							false }
+};
+
+
+/// Finds the entry of the extension of a file in assetTypes.
+/// \param[in]	path	The path of the file.
+/// \return The index of the entry, or the index of the last (null) entry if the extension is unknown.
+static int	assetTypeIndex(const std::string & path)
+{
+	// Get the extension, in lower case
+	size_t dot = path.find_last_of("./\\");
+	std::string ext;
+	if (dot != std::string::npos && path[dot] == '.')
+		for (size_t i = dot + 1; i < path.length(); ++i)
+			ext += (char)tolower(path[i]);
+
+	// Find it in the table
+	int i = 0;
+	while (assetTypes[i].ext && ext != assetTypes[i].ext)
+		++i;
+	return i;
+}
+
+
+SoAssetCache::SoAssetCache() : _change(INVALID_HANDLE_VALUE), _stopEvent(0), _thread(0)
+{
+	// Create the mutex
+	_mutex = CreateMutex(NULL, FALSE, NULL);
+}
+
+
+SoAssetCache::~SoAssetCache()
+{
+	// Stop watching and free the assets
+	stop();
+
+	// Destroy the mutex
+	CloseHandle(_mutex);
+}
+
+
+bool	SoAssetCache::start(const std::string & dir)
+{
+	// The directory must exist
+	DWORD attrs = GetFileAttributes(dir.c_str());
+	if (attrs == INVALID_FILE_ATTRIBUTES || (attrs & FILE_ATTRIBUTE_DIRECTORY) != FILE_ATTRIBUTE_DIRECTORY)
+		return false;
+
+	_dir = dir;
+
+	// Watch the directory before loading it, so that a change made during the loading is not missed
+	_change = FindFirstChangeNotification(_dir.c_str(), TRUE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+
+	// Load the files
+	_reload();
+
+	// If the directory can be watched, start the watching thread
+	if (_change != INVALID_HANDLE_VALUE)
+	{
+		_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		_thread = CreateThread(NULL, 0, assetCacheWatch, (LPVOID*)this, 0, NULL);
+	}
+
+	// The starting of the cache has succeeded
+	return true;
+}
+
+
+void	SoAssetCache::stop()
+{
+	// Stop the watching thread
+	if (_thread)
+	{
+		SetEvent(_stopEvent);
+		WaitForSingleObject(_thread, INFINITE);
+		CloseHandle(_thread);
+		_thread = 0;
+	}
+	if (_stopEvent)
+	{
+		CloseHandle(_stopEvent);
+		_stopEvent = 0;
+	}
+
+	// Stop watching the directory
+	if (_change != INVALID_HANDLE_VALUE)
+	{
+		FindCloseChangeNotification(_change);
+		_change = INVALID_HANDLE_VALUE;
+	}
+
+	// Free the assets
+	WaitForSingleObject(_mutex, INFINITE);
+	_clear(_assets);
+	ReleaseMutex(_mutex);
+}
+
+
+SoAsset *	SoAssetCache::find(const std::string & resource)
+{
+	// The asset to return
+	SoAsset * asset = 0;
+
+	// The key of the resource
+	std::string key = _key(resource);
+
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// If the resource is in the cache, hold a reference on it for the caller
+	AssetMap::iterator i = _assets.find(key);
+	if (i != _assets.end())
+	{
+		asset = i->second;
+		asset->AddRef();
+	}
+
+	ReleaseMutex(_mutex);
+
+	return asset;
+}
+
+
+const char *	SoAssetCache::TypeOf(const std::string & path)
+{
+	// The type of the extension, or the generic binary type if it is unknown
+	const char * type = assetTypes[assetTypeIndex(path)].type;
+	return type ? type : "application/octet-stream";
+}
+
+
+void	SoAssetCache::_load(const std::string & dir, const std::string & prefix, AssetMap & assets)
+{
+	// Open an item list of the directory
+	WIN32_FIND_DATA FindFileData;
+	HANDLE hFind = FindFirstFile((dir + "\\*").c_str(), &FindFileData);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return ;
+
+	// Browse the directory
+	do
+	{
+		// Skip the current and parent directories
+		if (FindFileData.cFileName[0] == '.' && (FindFileData.cFileName[1] == 0 || (FindFileData.cFileName[1] == '.' && FindFileData.cFileName[2] == 0)))
+			continue ;
+
+		std::string path = dir + "\\" + FindFileData.cFileName;
+		std::string key = prefix + _key(FindFileData.cFileName);
+
+		// A directory: load its files
+		if ((FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY)
+			_load(path, key + "/", assets);
+
+		// A file that is not too big: load it
+		else if (FindFileData.nFileSizeHigh == 0 && FindFileData.nFileSizeLow <= SOASSETCACHE_MAX_FILE_SIZE)
+		{
+			SoAsset * asset = _loadFile(path);
+			if (asset)
+				assets[key] = asset;
+		}
+	}
+	// While there are items to be found
+	while (FindNextFile(hFind, &FindFileData) != 0);
+
+	// Close the item list
+	FindClose(hFind);
+
+	// A directory is served as its index.html file, with and without the trailing '/'
+	AssetMap::iterator index = assets.find(prefix + "index.html");
+	if (index != assets.end())
+	{
+		index->second->AddRef();
+		assets[prefix] = index->second;
+		if (!prefix.empty())
+		{
+			index->second->AddRef();
+			assets[prefix.substr(0, prefix.length() - 1)] = index->second;
+		}
+	}
+}
+
+
+SoAsset *	SoAssetCache::_loadFile(const std::string & path)
+{
+	// Open the file and get its size and modification time
+	HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+	LARGE_INTEGER size;
+	FILETIME modified;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart > SOASSETCACHE_MAX_FILE_SIZE || !GetFileTime(file, NULL, NULL, &modified))
+	{
+		CloseHandle(file);
+		return 0;
+	}
+
+	// Read the whole file in a buffer
+	SoBuffer * body = SoBuffer::Create((size_t)size.QuadPart);
+	DWORD total = 0;
+	DWORD read;
+	while (total < (DWORD)size.QuadPart && ReadFile(file, body->Data() + total, (DWORD)size.QuadPart - total, &read, NULL) && read)
+		total += read;
+	CloseHandle(file);
+
+	// The file has changed while being read: it will be reloaded with the next notification
+	if (total != (DWORD)size.QuadPart)
+	{
+		body->Release();
+		return 0;
+	}
+
+	// Create the asset
+	return CreateAsset(path, body, modified);
+}
+
+
+SoAsset *	SoAssetCache::CreateAsset(const std::string & name, SoBuffer * body, const FILETIME & modified)
+{
+	// The strong entity tag: the CRC32 and the size of the content
+	char etag[32];
+	sprintf_s(etag, sizeof(etag), "\"%08x-%lx\"", SoDeflate::crc32(0, body->Data(), body->Size()), (unsigned long)body->Size());
+
+	// Compress the text files, keeping the compressed copy only if it is smaller
+	SoBuffer * gzip = 0;
+	if (assetTypes[assetTypeIndex(name)].compress && body->Size() > 0)
+	{
+		SoDeflate deflate(9);
+		std::string compressed;
+		deflate.gzip(body->Data(), body->Size(), compressed);
+		if (compressed.length() < body->Size())
+			gzip = SoBuffer::Create(compressed.data(), compressed.length());
+	}
+
+	// Create the asset
+	return new SoAsset(TypeOf(name), etag, modified, body, gzip);
+}
+
+
+std::string	SoAssetCache::_key(const std::string & path)
+{
+	// Lower case, with '/' separators, without a leading separator
+	std::string key;
+	key.reserve(path.length());
+	for (std::string::const_iterator c = path.begin(); c != path.end(); ++c)
+		if (*c == '\\' || *c == '/')
+		{
+			if (!key.empty())
+				key += '/';
+		}
+		else
+			key += (char)tolower(*c);
+	return key;
+}
+
+
+void	SoAssetCache::_clear(AssetMap & assets)
+{
+	// Release the reference held by the map on each asset
+	for (AssetMap::iterator i = assets.begin(); i != assets.end(); ++i)
+		i->second->Release();
+	assets.clear();
+}
+
+
+void	SoAssetCache::_reload()
+{
+	// Load the directory without holding the mutex, so that the assets keep being served during the loading
+	AssetMap assets;
+	_load(_dir, "", assets);
+
+	// Let the subclass add its generated assets
+	onLoad(_dir, assets);
+
+	// Replace the assets, the old ones being destroyed once they are not being sent anymore
+	WaitForSingleObject(_mutex, INFINITE);
+	_assets.swap(assets);
+	ReleaseMutex(_mutex);
+	_clear(assets);
+}
+
+
+void	SoAssetCache::_watch()
+{
+	// The handles to wait for: the stop order and the change notification
+	HANDLE handles[2] = { _stopEvent, _change };
+
+	// Wait for a change until the stop order
+	while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+	{
+		// Let a burst of changes (e.g. a whole interface being copied) end before reloading, unless stopping
+		do
+			FindNextChangeNotification(_change);
+		while (WaitForMultipleObjects(2, handles, FALSE, SOASSETCACHE_RELOAD_DELAY_MS) == WAIT_OBJECT_0 + 1);
+		if (WaitForSingleObject(_stopEvent, 0) == WAIT_OBJECT_0)
+			break ;
+
+		// Reload all the files
+		_reload();
+	}
+}
+
+/// \}
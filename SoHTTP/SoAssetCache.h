@@ -0,0 +1,196 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// License LGPL
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#pragma once
+
+#include "SoBuffer.h"
+
+#include <map>
+#include <string>
+
+/// The largest file that is kept in the asset cache, in bytes. The larger files are not cached.
+#define SOASSETCACHE_MAX_FILE_SIZE	(8 * 1024 * 1024)
+
+/// The time, in milliseconds, to wait after a change in the directory before reloading it, so that a burst of changes causes only one reload
+#define SOASSETCACHE_RELOAD_DELAY_MS	200
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// A static file loaded in memory, with everything needed to send it.
+/// It can also be a redirection to another location, which has no content.
+/// It is immutable and reference counted, so it can be sent while the cache is reloaded.
+class SoAsset
+{
+public:
+	/// Constructor
+	/// The creator holds the only reference on the asset.
+	/// \param[in]	type	The Content-Type of the file.
+	/// \param[in]	etag	The strong entity tag of the file, with its quotes.
+	/// \param[in]	modified	The time of the last modification of the file.
+	/// \param[in]	body	The content of the file. The asset takes the reference of the caller.
+	/// \param[in]	gzip	The gzip compressed content of the file, 0 if it is not worth compressing. The asset takes the reference of the caller.
+	/// \param[in]	location	The location to which the asset redirects, empty if it is a regular file.
+	SoAsset(const std::string & type, const std::string & etag, const FILETIME & modified, SoBuffer * body, SoBuffer * gzip, const std::string & location = "");
+
+	/// Adds a reference on the asset.
+	void					AddRef() { InterlockedIncrement(&_refs); }
+
+	/// Releases a reference on the asset, destroying it if it was the last one.
+	void					Release();
+
+	/// Gets the Content-Type of the file
+	/// \return the mime type
+	const std::string &		Type() const { return _type; }
+
+	/// Gets the strong entity tag of the file, with its quotes
+	/// \return the ETag
+	const std::string &		ETag() const { return _etag; }
+
+	/// Gets the time of the last modification of the file
+	/// \return the modification time
+	const FILETIME &		Modified() const { return _modified; }
+
+	/// Gets the content of the file
+	/// \return the buffer
+	SoBuffer *				Body() const { return _body; }
+
+	/// Gets the gzip compressed content of the file
+	/// \return the buffer, or 0 if the file is not compressed
+	SoBuffer *				Gzip() const { return _gzip; }
+
+	/// Gets the location to which the asset redirects
+	/// \return the location, or an empty string if the asset is a regular file
+	const std::string &		Location() const { return _location; }
+
+private:
+	/// Destructor
+	/// Only called by Release.
+	~SoAsset();
+
+	/// The reference counter.
+	volatile LONG			_refs;
+
+	/// The Content-Type of the file
+	std::string				_type;
+
+	/// The strong entity tag of the file
+	std::string				_etag;
+
+	/// The time of the last modification of the file
+	FILETIME				_modified;
+
+	/// The content of the file
+	SoBuffer *				_body;
+
+	/// The gzip compressed content of the file
+	SoBuffer *				_gzip;
+
+	/// The location to which the asset redirects
+	std::string				_location;
+};
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// In memory cache of the static files of a directory.
+/// All files are loaded when the cache is started, with a precompressed gzip copy of the text files,
+/// so that they are sent from memory without touching the disk.
+/// The directory is watched: the cache is reloaded when a file changes.
+/// A subclass can add generated assets to the cache each time it is loaded, by implementing onLoad.
+class SoAssetCache
+{
+public:
+	/// Constructor
+	SoAssetCache();
+
+	/// Virtual destructor
+	virtual ~SoAssetCache();
+
+	/// Loads all the files of a directory and its sub-directories, and starts watching the directory.
+	/// \param[in]	dir		The path of the directory.
+	/// \return Wether the directory could be loaded.
+	bool					start(const std::string & dir);
+
+	/// Stops watching the directory and empties the cache.
+	void					stop();
+
+	/// Finds a file.
+	/// A directory is found as its index.html file.
+	/// \param[in]	resource	The path of the file, relative to the directory, with '/' or '\\' separators. Is case insensitive.
+	/// \return The asset, on which the caller holds a reference and must Release, or 0 if it is not in the cache.
+	SoAsset *				find(const std::string & resource);
+
+	/// Gets the Content-Type corresponding to the extension of a file.
+	/// \param[in]	path	The path of the file.
+	/// \return The mime type.
+	static const char *		TypeOf(const std::string & path);
+
+	/// Creates an asset from a content.
+	/// The type is given by the extension of the name, and the content is compressed if the type is worth it.
+	/// \param[in]	name		The name of the file, used to find its type.
+	/// \param[in]	body		The content of the file. The asset takes the reference of the caller.
+	/// \param[in]	modified	The time of the last modification of the content.
+	/// \return The asset, on which the caller holds the only reference.
+	static SoAsset *		CreateAsset(const std::string & name, SoBuffer * body, const FILETIME & modified);
+
+protected:
+	typedef std::map<std::string, SoAsset*> AssetMap;
+
+	/// Method that can be implemented by a subclass to add generated assets to the cache.
+	/// It is called each time the directory has been loaded, before the new assets replace the previous ones,
+	/// in the thread that called start or in the watching thread.
+	/// \param[in]		dir		The path of the directory.
+	/// \param[in,out]	assets	The loaded files, by key (see find). The map holds a reference on each asset: an asset that is replaced must be released.
+	virtual void			onLoad(const std::string & dir, AssetMap & assets) {}
+
+	/// Normalizes a path so that it can be used as a key: lower case, with '/' separators.
+	/// \param[in]	path	The path.
+	/// \return The key.
+	static std::string		_key(const std::string & path);
+
+private:
+	/// Loads all the files of a directory in a map.
+	/// \param[in]	dir		The path of the directory on disk.
+	/// \param[in]	prefix	The key of the directory in the map: empty, or ending with '/'.
+	/// \param[out]	assets	The map in which the files are added.
+	static void				_load(const std::string & dir, const std::string & prefix, AssetMap & assets);
+
+	/// Loads a file.
+	/// \param[in]	path	The path of the file on disk.
+	/// \return The asset, or 0 if the file could not be loaded.
+	static SoAsset *		_loadFile(const std::string & path);
+
+	/// Releases all the assets of a map.
+	/// \param[in,out]	assets	The map to empty.
+	static void				_clear(AssetMap & assets);
+
+	/// Reloads the cache, replacing all its assets.
+	void					_reload();
+
+	/// The loop of the thread that watches the directory.
+	void					_watch();
+
+	/// The path of the directory
+	std::string				_dir;
+
+	/// The cached files, by key. The cache holds a reference on each asset.
+	AssetMap				_assets;
+
+	/// The mutex to access _assets
+	HANDLE					_mutex;
+
+	/// The change notification handle of the directory
+	HANDLE					_change;
+
+	/// The event that stops the watching thread
+	HANDLE					_stopEvent;
+
+	/// The watching thread
+	HANDLE					_thread;
+
+	friend DWORD WINAPI assetCacheWatch(LPVOID lpParameter);
+};
+
+/// \}
@@ -0,0 +1,47 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#include "SoBuffer.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+SoBuffer *	SoBuffer::Create(size_t size)
+{
+	// Allocate the buffer object and its data in the same memory block
+	void * memory = malloc(sizeof(SoBuffer) + size);
+	if (!memory)
+		return 0;
+
+	// Construct the buffer object at the beginning of the memory block
+	return new (memory) SoBuffer(size);
+}
+
+
+SoBuffer *	SoBuffer::Create(const void * data, size_t size)
+{
+	// Allocate the buffer and copy the data into it
+	SoBuffer * buffer = Create(size);
+	if (buffer && size)
+		memcpy(buffer->Data(), data, size);
+
+	return buffer;
+}
+
+
+void		SoBuffer::Release()
+{
+	// If this was the last reference, destroy the buffer and free its memory block
+	if (InterlockedDecrement(&_refs) == 0)
+	{
+		this->~SoBuffer();
+		free(this);
+	}
+}
+
+/// \}
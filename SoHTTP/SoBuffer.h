@@ -0,0 +1,66 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// License LGPL
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#pragma once
+
+#include <Winsock2.h>
+#include <Windows.h>
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Reference counted byte buffer.
+/// A buffer is filled once by its creator and is then immutable: it can be shared by any number of threads and connections
+/// without any lock, each of them holding its own reference.
+/// The data is allocated in the same memory block as the buffer object.
+class SoBuffer
+{
+public:
+	/// Creates a buffer of the given size, to be filled by the creator before being shared.
+	/// The creator holds the only reference on the returned buffer.
+	/// \param[in]	size	The size of the buffer, in bytes.
+	/// \return The new buffer.
+	static SoBuffer *	Create(size_t size);
+
+	/// Creates a buffer containing a copy of the given data.
+	/// The creator holds the only reference on the returned buffer.
+	/// \param[in]	data	The data to copy.
+	/// \param[in]	size	The size of the data, in bytes.
+	/// \return The new buffer.
+	static SoBuffer *	Create(const void * data, size_t size);
+
+	/// Adds a reference on the buffer.
+	void				AddRef() { InterlockedIncrement(&_refs); }
+
+	/// Releases a reference on the buffer, destroying it if it was the last one.
+	void				Release();
+
+	/// Gets the data of the buffer, to fill it.
+	/// Must only be used by the creator, before the buffer is shared.
+	/// \return The data of the buffer.
+	char *				Data() { return (char*)(this + 1); }
+
+	/// Gets the data of the buffer.
+	/// \return The data of the buffer.
+	const char *		Data() const { return (const char*)(this + 1); }
+
+	/// Gets the size of the buffer.
+	/// \return The size of the buffer, in bytes.
+	size_t				Size() const { return _size; }
+
+private:
+	/// Private constructor: buffers are allocated with Create.
+	/// \param[in]	size	The size of the buffer, in bytes.
+	SoBuffer(size_t size) : _refs(1), _size(size) {}
+
+	/// The reference counter.
+	volatile LONG		_refs;
+
+	/// The size of the data, in bytes.
+	size_t				_size;
+};
+
+/// \}
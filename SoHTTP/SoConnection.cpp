@@ -0,0 +1,410 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#include "SoConnection.h"
+#include "SoReactor.h"
+
+SoConnection::SoConnection(SoReactor & reactor, SOCKET socket, SoConnectionHandler * handler) :
+	_reactor(reactor), _socket(socket), _handler(handler), _oldHandler(0),
+	// The first reference is held by the connection itself until it is closed
+	_refs(1),
+	_sendOffset(0), _recvPending(false), _sendPending(false), _wakePending(0), _closing(false), _closed(false), _detached(false)
+{
+	// Create the mutex
+	_mutex = CreateMutex(NULL, FALSE, NULL);
+
+	// Set the operation of each overlapped structure
+	_recvOv.op = SoOverlapped::RECV;
+	_sendOv.op = SoOverlapped::SEND;
+	_wakeOv.op = SoOverlapped::WAKE;
+}
+
+
+SoConnection::~SoConnection()
+{
+	// Release the buffers that were never sent
+	_clearSendQueue();
+
+	// Destroy the handlers
+	delete _oldHandler;
+	delete _handler;
+
+	// Destroy the mutex
+	CloseHandle(_mutex);
+}
+
+
+void	SoConnection::AddRef()
+{
+	InterlockedIncrement(&_refs);
+}
+
+
+void	SoConnection::Release()
+{
+	if (InterlockedDecrement(&_refs) == 0)
+		delete this;
+}
+
+
+void	SoConnection::setHandler(SoConnectionHandler * handler)
+{
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// The current handler may be the one calling setHandler, so it is only destroyed after its callback has returned
+	delete _oldHandler;
+	_oldHandler = _handler;
+	_handler = handler;
+
+	ReleaseMutex(_mutex);
+}
+
+
+void	SoConnection::send(const char * data, int len)
+{
+	// Nothing to send
+	if (len <= 0)
+		return ;
+
+	// Copy the data into a buffer and queue it
+	SoBuffer * buffer = SoBuffer::Create(data, len);
+	send(buffer);
+	buffer->Release();
+}
+
+
+void	SoConnection::send(SoBuffer * buffer)
+{
+	send(&buffer, 1);
+}
+
+
+void	SoConnection::send(SoBuffer * const * buffers, int count)
+{
+	// Hold a reference so that the connection is not destroyed while its mutex is held
+	AddRef();
+
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// If the connection is not closed, queue the buffers and start sending them if nothing is being sent
+	if (!_closed)
+	{
+		for (int i = 0; i < count; ++i)
+			if (buffers[i]->Size() > 0)
+			{
+				buffers[i]->AddRef();
+				_sendQueue.push_back(buffers[i]);
+			}
+		if (!_sendPending)
+			_postSend();
+	}
+
+	ReleaseMutex(_mutex);
+
+	Release();
+}
+
+
+bool	SoConnection::isSending()
+{
+	WaitForSingleObject(_mutex, INFINITE);
+	bool ret = _sendPending || !_sendQueue.empty();
+	ReleaseMutex(_mutex);
+
+	return ret;
+}
+
+
+void	SoConnection::close()
+{
+	// Hold a reference so that the connection is not destroyed while its mutex is held
+	AddRef();
+
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// If there is nothing left to send, close the connection immediately
+	if (!_sendPending && _sendQueue.empty())
+		_close();
+	// Else, close it once all data has been sent
+	else
+		_closing = true;
+
+	ReleaseMutex(_mutex);
+
+	Release();
+}
+
+
+void	SoConnection::setTimer(DWORD ms)
+{
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// A closed connection cannot be armed
+	if (!_closed || ms == 0)
+		_reactor._setTimer(this, ms);
+
+	ReleaseMutex(_mutex);
+}
+
+
+void	SoConnection::wake()
+{
+	// Only post a wake if there is not already one pending, so that wakes are coalesced
+	if (InterlockedExchange(&_wakePending, 1) == 0)
+	{
+		// The pending wake holds a reference on the connection
+		AddRef();
+		_reactor._postWake(this);
+	}
+}
+
+
+void	SoConnection::detach()
+{
+	WaitForSingleObject(_mutex, INFINITE);
+	_detached = true;
+	ReleaseMutex(_mutex);
+}
+
+
+void	SoConnection::attach()
+{
+	// Hold a reference so that the connection is not destroyed while its mutex is held
+	AddRef();
+
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// Receive again on the socket
+	_detached = false;
+	_postRecv();
+
+	ReleaseMutex(_mutex);
+
+	// Let the handler continue with what it had received before the detach
+	wake();
+
+	Release();
+}
+
+
+void	SoConnection::_clearSendQueue()
+{
+	// Release every queued buffer
+	for (std::deque<SoBuffer*>::iterator i = _sendQueue.begin(); i != _sendQueue.end(); ++i)
+		(*i)->Release();
+	_sendQueue.clear();
+	_sendOffset = 0;
+}
+
+
+void	SoConnection::_postRecv()
+{
+	// Do not receive on a closed, closing or detached connection, and never post two receptions at the same time
+	// A closing connection only sends what is left: what the peer sends meanwhile must not reach the handler anymore
+	if (_closed || _closing || _detached || _recvPending)
+		return ;
+
+	// The buffer to receive in
+	WSABUF buf;
+	buf.buf = _recvBuf;
+	buf.len = SOCONNECTION_RECV_SIZE;
+
+	// Reset the overlapped structure
+	memset((OVERLAPPED*)&_recvOv, 0, sizeof(OVERLAPPED));
+
+	// The pending reception holds a reference on the connection
+	AddRef();
+	_recvPending = true;
+
+	// Start the reception
+	DWORD flags = 0;
+	if (WSARecv(_socket, &buf, 1, NULL, &flags, &_recvOv, NULL) == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING)
+	{
+		// The reception has failed and will never complete
+		_recvPending = false;
+		_close();
+		Release();
+	}
+}
+
+
+void	SoConnection::_postSend()
+{
+	// Nothing to send
+	if (_closed || _sendQueue.empty())
+		return ;
+
+	// The buffers to send: what remains of the first buffer in the queue, then the next ones
+	// WSASend reads the WSABUF array when it is called, so it can be on the stack
+	WSABUF bufs[SOCONNECTION_SEND_GATHER];
+	DWORD count = 0;
+	for (std::deque<SoBuffer*>::iterator i = _sendQueue.begin(); i != _sendQueue.end() && count < SOCONNECTION_SEND_GATHER; ++i, ++count)
+	{
+		size_t offset = (count == 0) ? _sendOffset : 0;
+		bufs[count].buf = (char*)(*i)->Data() + offset;
+		bufs[count].len = (u_long)((*i)->Size() - offset);
+	}
+
+	// Reset the overlapped structure
+	memset((OVERLAPPED*)&_sendOv, 0, sizeof(OVERLAPPED));
+
+	// The pending sending holds a reference on the connection
+	AddRef();
+	_sendPending = true;
+
+	// Start the sending
+	if (WSASend(_socket, bufs, count, NULL, 0, &_sendOv, NULL) == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING)
+	{
+		// The sending has failed and will never complete
+		_sendPending = false;
+		_close();
+		Release();
+	}
+}
+
+
+void	SoConnection::_close()
+{
+	// A connection is only closed once
+	if (_closed)
+		return ;
+	_closed = true;
+
+	// Free the queued data
+	_clearSendQueue();
+
+	// Closing the socket makes every pending operation complete with an error
+	closesocket(_socket);
+
+	// Cancel the timer
+	_reactor._setTimer(this, 0);
+
+	// Inform the handler
+	if (_handler)
+	{
+		_handler->onClose(*this);
+		_endCallback();
+	}
+
+	// Unregister the connection from the reactor
+	_reactor._remove(this);
+
+	// Release the reference held by the connection itself since its creation
+	// The caller always holds another reference, so this never destroys the connection while its mutex is held
+	Release();
+}
+
+
+void	SoConnection::_onCompletion(SoOverlapped * ov, DWORD bytes, bool ok)
+{
+	WaitForSingleObject(_mutex, INFINITE);
+
+	switch (ov->op)
+	{
+	case SoOverlapped::RECV:
+		_recvPending = false;
+
+		// A failed or empty reception means that the peer has closed the connection
+		if (!ok || bytes == 0)
+			_close();
+
+		// Give the received data to the handler, and continue receiving if it wants to keep the connection
+		else if (!_closed)
+		{
+			// Count the received bytes
+			_reactor._bytesReceived.add(bytes);
+
+			// Give the data to the handler
+			bool keep = _handler->onReceive(*this, _recvBuf, (int)bytes);
+			_endCallback();
+			if (!keep)
+				_close();
+			else
+				_postRecv();
+		}
+		break ;
+
+	case SoOverlapped::SEND:
+		_sendPending = false;
+
+		// A failed sending means that the connection is broken
+		if (!ok)
+			_close();
+
+		else if (!_closed)
+		{
+			// Count the sent bytes
+			_reactor._bytesSent.add(bytes);
+
+			// Remove what has been sent from the queue, which may span several buffers
+			_sendOffset += bytes;
+			while (!_sendQueue.empty() && _sendOffset >= _sendQueue.front()->Size())
+			{
+				_sendOffset -= _sendQueue.front()->Size();
+				_sendQueue.front()->Release();
+				_sendQueue.pop_front();
+			}
+
+			// If there is more to send, continue sending
+			if (!_sendQueue.empty())
+				_postSend();
+
+			// All data has been sent and the connection was waiting for it to be closed
+			else if (_closing)
+				_close();
+
+			// All data has been sent, inform the handler
+			else
+			{
+				_handler->onSent(*this);
+				_endCallback();
+			}
+		}
+		break ;
+
+	case SoOverlapped::WAKE:
+		// Allow the next wake to be posted, before calling the handler so that no wake is lost
+		InterlockedExchange(&_wakePending, 0);
+
+		if (!_closed)
+		{
+			_handler->onWake(*this);
+			_endCallback();
+		}
+		break ;
+	}
+
+	ReleaseMutex(_mutex);
+
+	// Release the reference that was held by the completed operation
+	Release();
+}
+
+
+void	SoConnection::_onTimer()
+{
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// Call the handler if the connection is still opened
+	if (!_closed)
+	{
+		_handler->onTimer(*this);
+		_endCallback();
+	}
+
+	ReleaseMutex(_mutex);
+}
+
+
+void	SoConnection::_endCallback()
+{
+	// Destroy the handler that was replaced during the callback
+	delete _oldHandler;
+	_oldHandler = 0;
+}
+
+/// \}
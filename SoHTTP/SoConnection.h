@@ -0,0 +1,240 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// License LGPL
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#pragma once
+
+#include "SoBuffer.h"
+
+#include <Winsock2.h>
+#include <Windows.h>
+#include <deque>
+#include <string.h>
+
+/// The size of the buffer in which each connection receives its data
+#define SOCONNECTION_RECV_SIZE	4096
+
+/// The maximum number of queued buffers given to one vectored send
+#define SOCONNECTION_SEND_GATHER	16
+
+class SoReactor;
+class SoConnection;
+
+/// Overlapped structure used by the reactor to know which operation has completed.
+struct SoOverlapped : public OVERLAPPED
+{
+	/// The different operations a connection can be waiting for
+	enum Operation { RECV, SEND, WAKE };
+
+	/// The operation this overlapped structure is used for
+	Operation	op;
+};
+
+/// Interface of the objects that give a behaviour to a SoConnection.
+/// All callbacks are called by the reactor I/O threads while the connection lock is held,
+/// so a handler is never called concurrently for the same connection.
+/// A handler must never block: every other connection of the same I/O thread would be blocked too.
+class SoConnectionHandler
+{
+public:
+	/// Virtual destructor
+	virtual ~SoConnectionHandler() {}
+
+	/// Called once, when the connection has been added to the reactor, before any data is received.
+	/// \param[in]	connection	The connection.
+	virtual void	onOpen(SoConnection & connection) {}
+
+	/// Called when data has been received on the connection.
+	/// \param[in]	connection	The connection on which the data has been received.
+	/// \param[in]	data		The received data (not null terminated).
+	/// \param[in]	len			The number of bytes received.
+	/// \return Wether the connection should be kept open.
+	virtual bool	onReceive(SoConnection & connection, const char * data, int len) = 0;
+
+	/// Called when every data queued with SoConnection::send has been sent.
+	/// \param[in]	connection	The connection.
+	virtual void	onSent(SoConnection & connection) {}
+
+	/// Called when the timer set with SoConnection::setTimer expires.
+	/// \param[in]	connection	The connection.
+	virtual void	onTimer(SoConnection & connection) {}
+
+	/// Called after SoConnection::wake has been called (from any thread).
+	/// Several wake calls made before the handler is called are coalesced into one call.
+	/// \param[in]	connection	The connection.
+	virtual void	onWake(SoConnection & connection) {}
+
+	/// Called once, when the connection is closed (either by the peer or by SoConnection::close).
+	/// \param[in]	connection	The connection.
+	virtual void	onClose(SoConnection & connection) {}
+};
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// A socket connection handled by a SoReactor.
+/// The connection receives data and sends its queued data asynchronously, giving all events to its handler.
+/// It is reference counted: it is destroyed when it has been closed and when nobody holds a reference on it anymore.
+/// All public methods are thread safe.
+class SoConnection
+{
+public:
+	/// Constructor
+	/// \param[in]	reactor		The reactor that will handle the connection I/O.
+	/// \param[in]	socket		The connected socket.
+	/// \param[in]	handler		The handler of the connection events. The connection takes its ownership.
+	SoConnection(SoReactor & reactor, SOCKET socket, SoConnectionHandler * handler);
+
+	/// Adds a reference on the connection.
+	void		AddRef();
+
+	/// Releases a reference on the connection, destroying it if it was the last one.
+	void		Release();
+
+	/// Gets the socket of the connection.
+	/// \return the socket.
+	SOCKET		Socket() const { return _socket; }
+
+	/// Replaces the handler of the connection.
+	/// The previous handler is destroyed once its current callback, if any, has returned.
+	/// \param[in]	handler		The new handler. The connection takes its ownership.
+	void		setHandler(SoConnectionHandler * handler);
+
+	/// Queues data to be sent on the connection.
+	/// \param[in]	data	The data to send. Is copied.
+	/// \param[in]	len		The number of bytes to send.
+	void		send(const char * data, int len);
+
+	/// Queues a null-terminated character string to be sent on the connection.
+	/// \param[in]	str		The string to send. Is copied.
+	void		send(const char * str) { send(str, strlen(str)); }
+
+	/// Queues a buffer to be sent on the connection, without copying it.
+	/// The connection holds its own reference on the buffer until it has been sent.
+	/// \param[in]	buffer	The buffer to send.
+	void		send(SoBuffer * buffer);
+
+	/// Queues several buffers to be sent on the connection, without copying them.
+	/// The buffers are queued at once, so that they are sent together in one vectored write when the connection is not already sending.
+	/// The connection holds its own reference on each buffer until it has been sent.
+	/// \param[in]	buffers	The buffers to send, in order.
+	/// \param[in]	count	The number of buffers.
+	void		send(SoBuffer * const * buffers, int count);
+
+	/// Informs wether there is still data waiting to be sent.
+	/// \return Wether the connection is still sending data.
+	bool		isSending();
+
+	/// Closes the connection once all queued data has been sent.
+	void		close();
+
+	/// Sets the timer of the connection: the handler onTimer will be called after the given time.
+	/// There is only one timer per connection: setting it again replaces the previous one.
+	/// \param[in]	ms	The time to wait, in milliseconds. 0 cancels the timer.
+	void		setTimer(DWORD ms);
+
+	/// Makes the reactor call the handler onWake callback in one of its I/O threads.
+	/// This is the way for other threads to notify a connection. It never blocks.
+	void		wake();
+
+	/// Detaches the socket from the reactor I/O: the reactor will no more receive on the socket.
+	/// This enables a thread to use the socket with regular blocking calls.
+	/// The thread must call close when the socket is no more needed, or attach to give the socket back to the reactor.
+	void		detach();
+
+	/// Gives a detached socket back to the reactor: the reactor receives on it again.
+	/// The handler is then woken (onWake), so that it can handle the data it received before the socket was detached.
+	void		attach();
+
+private:
+	/// Destructor
+	/// Only called by Release.
+	~SoConnection();
+
+	/// Releases all the buffers waiting to be sent.
+	void		_clearSendQueue();
+
+	/// Posts the asynchronous reception of data.
+	/// Must be called while holding _mutex and a reference on the connection.
+	void		_postRecv();
+
+	/// Posts the asynchronous sending of the data in the queue, gathering up to SOCONNECTION_SEND_GATHER buffers in one write.
+	/// Must be called while holding _mutex and a reference on the connection.
+	void		_postSend();
+
+	/// Closes the socket immediately and informs the handler.
+	/// Must be called while holding _mutex and a reference on the connection.
+	void		_close();
+
+	/// Called by the reactor when an operation has completed.
+	/// \param[in]	ov		The overlapped structure of the operation.
+	/// \param[in]	bytes	The number of bytes transfered.
+	/// \param[in]	ok		Wether the operation has succeeded.
+	void		_onCompletion(SoOverlapped * ov, DWORD bytes, bool ok);
+
+	/// Called by the reactor when the timer has expired.
+	void		_onTimer();
+
+	/// Called after each handler callback to destroy the replaced handler, if any.
+	void		_endCallback();
+
+	/// The reactor handling the connection I/O.
+	SoReactor &				_reactor;
+
+	/// The connected socket.
+	SOCKET					_socket;
+
+	/// The handler of the connection events.
+	SoConnectionHandler *	_handler;
+
+	/// The handler that has been replaced during a callback, waiting for the callback to end to be destroyed.
+	SoConnectionHandler *	_oldHandler;
+
+	/// The reference counter.
+	volatile LONG			_refs;
+
+	/// The mutex to access the connection state and to call the handler.
+	HANDLE					_mutex;
+
+	/// The overlapped structure used for receptions.
+	SoOverlapped			_recvOv;
+
+	/// The overlapped structure used for sendings.
+	SoOverlapped			_sendOv;
+
+	/// The overlapped structure used for wakes.
+	SoOverlapped			_wakeOv;
+
+	/// The buffer in which data is received.
+	char					_recvBuf[SOCONNECTION_RECV_SIZE];
+
+	/// The queue of buffers waiting to be sent. The connection holds a reference on each of them.
+	std::deque<SoBuffer*>	_sendQueue;
+
+	/// The number of bytes of the first data in the queue that have already been sent.
+	size_t					_sendOffset;
+
+	/// Wether a reception is pending.
+	bool					_recvPending;
+
+	/// Wether a sending is pending.
+	bool					_sendPending;
+
+	/// Wether a wake is pending. Is a LONG to be accessed with Interlocked functions.
+	volatile LONG			_wakePending;
+
+	/// Wether the connection must be closed once all data has been sent.
+	bool					_closing;
+
+	/// Wether the connection is closed.
+	bool					_closed;
+
+	/// Wether the socket has been detached from the reactor.
+	bool					_detached;
+
+	friend class SoReactor;
+};
+
+/// \}
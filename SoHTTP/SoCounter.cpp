@@ -0,0 +1,41 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#include "SoCounter.h"
+
+SoCounter::SoCounter()
+{
+	// Empty all the stripes
+	for (int i = 0; i < SOCOUNTER_STRIPES; ++i)
+		_stripes[i].value = 0;
+}
+
+
+void	SoCounter::add(LONGLONG value)
+{
+	// Thread ids are multiples of 4, so the low bits are dropped before choosing the stripe
+	volatile LONGLONG * stripe = &_stripes[(GetCurrentThreadId() >> 2) % SOCOUNTER_STRIPES].value;
+
+	// Threads rarely share a stripe, so the exchange nearly always succeeds at the first try
+	// It is used so that the 64 bits are written atomically, even on 32 bits systems
+	LONGLONG prev;
+	do
+		prev = *stripe;
+	while (InterlockedCompareExchange64(stripe, prev + value, prev) != prev);
+}
+
+
+LONGLONG	SoCounter::Value() const
+{
+	// Sum the stripes, reading each of them atomically
+	LONGLONG sum = 0;
+	for (int i = 0; i < SOCOUNTER_STRIPES; ++i)
+		sum += InterlockedCompareExchange64((volatile LONGLONG *)&_stripes[i].value, 0, 0);
+	return sum;
+}
+
+/// \}
@@ -0,0 +1,56 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// License LGPL
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#pragma once
+
+#include <Windows.h>
+
+/// The number of stripes of a counter: the threads are spread across them by their id
+#define SOCOUNTER_STRIPES		16
+
+/// The size of a cache line, on which each stripe is aligned so that two threads never write to the same line
+#define SOCOUNTER_CACHE_LINE	64
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// 64 bits counter that many threads can increment without lock and without contending on the same cache line.
+/// Each thread adds to the stripe of its thread id, and the reader sums all stripes.
+/// The value read is not a snapshot: the additions made while reading may or may not be counted.
+class SoCounter
+{
+public:
+	/// Constructor
+	SoCounter();
+
+	/// Adds a value to the counter.
+	/// Can be called from any thread, never blocks.
+	/// \param[in]	value	The value to add.
+	void			add(LONGLONG value);
+
+	/// Adds 1 to the counter.
+	void			increment() { add(1); }
+
+	/// Gets the value of the counter: the sum of all the stripes.
+	/// \return the value
+	LONGLONG		Value() const;
+
+private:
+	/// A stripe, alone on its cache line
+	struct Stripe
+	{
+		/// The part of the counter added by the threads of this stripe. Is accessed with InterlockedCompareExchange64 as it is 64 bits.
+		volatile LONGLONG	value;
+
+		/// Padding up to the cache line size
+		char				padding[SOCOUNTER_CACHE_LINE - sizeof(LONGLONG)];
+	};
+
+	/// The stripes
+	Stripe			_stripes[SOCOUNTER_STRIPES];
+};
+
+/// \}
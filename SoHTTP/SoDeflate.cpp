@@ -0,0 +1,402 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#include "SoDeflate.h"
+
+#include <string.h>
+
+/// The size of the LZ77 window
+#define SODEFLATE_WINDOW_SIZE		32768
+
+/// The mask to get the position in the window
+#define SODEFLATE_WINDOW_MASK		(SODEFLATE_WINDOW_SIZE - 1)
+
+/// The number of entries of the hash table
+#define SODEFLATE_HASH_SIZE		32768
+
+/// The shortest and longest matches
+#define SODEFLATE_MIN_MATCH		3
+#define SODEFLATE_MAX_MATCH		258
+
+/// The largest stored block
+#define SODEFLATE_MAX_STORED		65535
+
+/// The maximum number of positions tried when looking for a match, for each level
+static const int maxChains[10] = { 0, 4, 8, 16, 32, 64, 128, 256, 512, 1024 };
+
+/// The base length of each length code (257 to 285)
+static const int lengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+/// The number of extra bits of each length code (257 to 285)
+static const int lengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/// The base distance of each distance code
+static const int distBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+/// The number of extra bits of each distance code
+static const int distExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/// The CRC-32 table, computed when the module is loaded (before any thread uses it)
+static struct CrcTable
+{
+	/// Computes the table
+	CrcTable()
+	{
+		for (unsigned int n = 0; n < 256; ++n)
+		{
+			unsigned int c = n;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+			table[n] = c;
+		}
+	}
+
+	/// The CRC of each byte
+	unsigned int table[256];
+} crcTable;
+
+/// Reverses the bits of a Huffman code, as Deflate writes them most significant bit first.
+/// \param[in]	code	The code.
+/// \param[in]	len		The number of bits of the code.
+/// \return The reversed code.
+static unsigned int reverseBits(unsigned int code, int len)
+{
+	unsigned int ret = 0;
+	for (int i = 0; i < len; ++i)
+	{
+		ret = (ret << 1) | (code & 1);
+		code >>= 1;
+	}
+	return ret;
+}
+
+/// Hashes the 3 bytes at the given position.
+/// \param[in]	p	The position.
+/// \return The hash.
+static inline unsigned int hash3(const unsigned char * p)
+{
+	return (((unsigned int)p[0] << 10) ^ ((unsigned int)p[1] << 5) ^ p[2]) & (SODEFLATE_HASH_SIZE - 1);
+}
+
+
+SoDeflate::SoDeflate(int level) : _bitBuf(0), _bitCount(0), _base(0)
+{
+	setLevel(level);
+}
+
+
+void	SoDeflate::setLevel(int level)
+{
+	// Clamp the level to the allowed range
+	if (level < 0)
+		level = 0;
+	if (level > 9)
+		level = 9;
+
+	_level = level;
+	_maxChain = maxChains[level];
+}
+
+
+void	SoDeflate::deflate(const void * data, size_t len, std::string & out)
+{
+	const unsigned char * p = (const unsigned char *)data;
+
+	_bitBuf = 0;
+	_bitCount = 0;
+
+	// Level 0: the data is written in stored blocks
+	if (_maxChain == 0)
+	{
+		_store(p, len, out);
+		return ;
+	}
+
+	// Where the compressed data starts in the output
+	size_t start = out.size();
+
+	// The positions are stored in the tables with an offset that grows at each call, so that the tables never need to be cleared:
+	// a position that is not greater than _base has been stored by a previous call.
+	// When the offset would overflow, the tables are cleared and the offset restarts.
+	if (_head.empty() || (unsigned int)-1 - _base < len + SODEFLATE_WINDOW_SIZE + 1)
+	{
+		_head.assign(SODEFLATE_HASH_SIZE, 0);
+		_prev.assign(SODEFLATE_WINDOW_SIZE, 0);
+		_base = 0;
+	}
+
+	// One final block with the fixed Huffman codes: BFINAL = 1, BTYPE = 01
+	_putBits(out, 3, 3);
+
+	size_t i = 0;
+	while (i < len)
+	{
+		// The longest match found
+		int bestLen = 0;
+		int bestDist = 0;
+
+		if (i + SODEFLATE_MIN_MATCH <= len)
+		{
+			// Insert the position in its hash chain, getting the previous position with the same hash
+			unsigned int h = hash3(p + i);
+			unsigned int cand = _head[h];
+			_prev[i & SODEFLATE_WINDOW_MASK] = cand;
+			_head[h] = _base + (unsigned int)i + 1;
+
+			// The longest possible match
+			int maxLen = (len - i < SODEFLATE_MAX_MATCH) ? (int)(len - i) : SODEFLATE_MAX_MATCH;
+
+			// Walk the hash chain, newest positions first
+			for (int chain = _maxChain; cand > _base && chain > 0; --chain)
+			{
+				size_t j = cand - _base - 1;
+
+				// The position is out of the window
+				if (i - j > SODEFLATE_WINDOW_SIZE)
+					break ;
+
+				// Only compare the whole match if it can be longer than the best one
+				if (p[j + bestLen] == p[i + bestLen])
+				{
+					int l = 0;
+					while (l < maxLen && p[j + l] == p[i + l])
+						++l;
+					if (l > bestLen)
+					{
+						bestLen = l;
+						bestDist = (int)(i - j);
+						if (l == maxLen)
+							break ;
+					}
+				}
+
+				// The previous position with the same hash. The chain always goes backward.
+				unsigned int next = _prev[j & SODEFLATE_WINDOW_MASK];
+				if (next >= cand)
+					break ;
+				cand = next;
+			}
+		}
+
+		// A match is found: write it and insert the positions it covers in the hash chains
+		if (bestLen >= SODEFLATE_MIN_MATCH)
+		{
+			_putMatch(out, bestLen, bestDist);
+			for (size_t k = i + 1; k < i + bestLen && k + SODEFLATE_MIN_MATCH <= len; ++k)
+			{
+				unsigned int h = hash3(p + k);
+				_prev[k & SODEFLATE_WINDOW_MASK] = _head[h];
+				_head[h] = _base + (unsigned int)k + 1;
+			}
+			i += bestLen;
+		}
+		// Else write the literal byte
+		else
+		{
+			_putSymbol(out, p[i]);
+			++i;
+		}
+	}
+
+	// End of block
+	_putSymbol(out, 256);
+	_flushBits(out);
+
+	// The positions of the next call will not be confused with the positions of this call
+	_base += (unsigned int)len + SODEFLATE_WINDOW_SIZE + 1;
+
+	// If the data could not be compressed (e.g. noise), write it in stored blocks instead
+	if (out.size() - start > len + 5 * (len / SODEFLATE_MAX_STORED + 1))
+	{
+		out.resize(start);
+		_store(p, len, out);
+	}
+}
+
+
+void	SoDeflate::zlib(const void * data, size_t len, std::string & out)
+{
+	// zlib header: deflate with a 32K window, and the compression level informations
+	// The header must be a multiple of 31
+	unsigned char cmf = 0x78;
+	unsigned char flg = (unsigned char)((_level == 0 ? 0 : (_level < 6 ? 1 : (_level == 6 ? 2 : 3))) << 6);
+	flg += (unsigned char)((31 - ((cmf * 256 + flg) % 31)) % 31);
+	out += (char)cmf;
+	out += (char)flg;
+
+	// The compressed data
+	deflate(data, len, out);
+
+	// The Adler-32 of the uncompressed data, big endian
+	unsigned int adler = adler32(1, data, len);
+	out += (char)(adler >> 24);
+	out += (char)((adler >> 16) & 0xFF);
+	out += (char)((adler >> 8) & 0xFF);
+	out += (char)(adler & 0xFF);
+}
+
+
+void	SoDeflate::gzip(const void * data, size_t len, std::string & out)
+{
+	// gzip header: magic, deflate method, no flag, no modification time (so that the output only depends on the data),
+	// the compression level informations and an unknown operating system
+	static const char header[10] = { (char)0x1F, (char)0x8B, 8, 0, 0, 0, 0, 0, 0, (char)0xFF };
+	out.append(header, 10);
+	out[out.length() - 2] = (char)(_level >= 9 ? 2 : (_level <= 1 ? 4 : 0));
+
+	// The compressed data
+	deflate(data, len, out);
+
+	// The CRC-32 and the size of the uncompressed data, little endian
+	unsigned int crc = crc32(0, data, len);
+	unsigned int size = (unsigned int)len;
+	for (int i = 0; i < 4; ++i)
+		out += (char)((crc >> (i * 8)) & 0xFF);
+	for (int i = 0; i < 4; ++i)
+		out += (char)((size >> (i * 8)) & 0xFF);
+}
+
+
+unsigned int	SoDeflate::crc32(unsigned int crc, const void * data, size_t len)
+{
+	const unsigned char * p = (const unsigned char *)data;
+
+	crc = ~crc;
+	for (size_t i = 0; i < len; ++i)
+		crc = crcTable.table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+
+unsigned int	SoDeflate::adler32(unsigned int adler, const void * data, size_t len)
+{
+	const unsigned char * p = (const unsigned char *)data;
+
+	unsigned int a = adler & 0xFFFF;
+	unsigned int b = adler >> 16;
+
+	while (len > 0)
+	{
+		// 5552 is the largest number of bytes that can be summed before the sums overflow
+		size_t n = (len < 5552) ? len : 5552;
+		len -= n;
+		while (n-- > 0)
+		{
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+
+void	SoDeflate::_store(const unsigned char * p, size_t len, std::string & out)
+{
+	size_t i = 0;
+	do
+	{
+		// The size of the block, the last block is final
+		size_t size = len - i;
+		if (size > SODEFLATE_MAX_STORED)
+			size = SODEFLATE_MAX_STORED;
+		bool final = (i + size == len);
+
+		// Block header: BFINAL and BTYPE = 00, then the block is aligned on a byte
+		_putBits(out, final ? 1 : 0, 3);
+		_flushBits(out);
+
+		// LEN and NLEN, then the data
+		out += (char)(size & 0xFF);
+		out += (char)(size >> 8);
+		out += (char)(~size & 0xFF);
+		out += (char)((~size >> 8) & 0xFF);
+		out.append((const char *)p + i, size);
+
+		i += size;
+	}
+	while (i < len);
+}
+
+
+void	SoDeflate::_putBits(std::string & out, unsigned int bits, int count)
+{
+	_bitBuf |= bits << _bitCount;
+	_bitCount += count;
+
+	// Write the full bytes
+	while (_bitCount >= 8)
+	{
+		out += (char)(_bitBuf & 0xFF);
+		_bitBuf >>= 8;
+		_bitCount -= 8;
+	}
+}
+
+
+void	SoDeflate::_putSymbol(std::string & out, int symbol)
+{
+	// The fixed Huffman codes (RFC 1951, 3.2.6)
+	if (symbol < 144)
+		_putBits(out, reverseBits(0x30 + symbol, 8), 8);
+	else if (symbol < 256)
+		_putBits(out, reverseBits(0x190 + symbol - 144, 9), 9);
+	else if (symbol < 280)
+		_putBits(out, reverseBits(symbol - 256, 7), 7);
+	else
+		_putBits(out, reverseBits(0xC0 + symbol - 280, 8), 8);
+}
+
+
+void	SoDeflate::_putMatch(std::string & out, int length, int distance)
+{
+	// Find the length code
+	int code = 28;
+	while (lengthBase[code] > length)
+		--code;
+
+	// Write the length code and its extra bits
+	_putSymbol(out, 257 + code);
+	if (lengthExtra[code])
+		_putBits(out, length - lengthBase[code], lengthExtra[code]);
+
+	// Find the distance code
+	int dcode = 29;
+	while (distBase[dcode] > distance)
+		--dcode;
+
+	// Write the distance code (fixed 5 bits codes) and its extra bits
+	_putBits(out, reverseBits(dcode, 5), 5);
+	if (distExtra[dcode])
+		_putBits(out, distance - distBase[dcode], distExtra[dcode]);
+}
+
+
+void	SoDeflate::_flushBits(std::string & out)
+{
+	// Write the last incomplete byte
+	if (_bitCount > 0)
+		out += (char)(_bitBuf & 0xFF);
+	_bitBuf = 0;
+	_bitCount = 0;
+}
+
+/// \}
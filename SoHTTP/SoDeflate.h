@@ -0,0 +1,120 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// License LGPL
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// The default compression level of Deflate
+#define SODEFLATE_DEFAULT_LEVEL	3
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Portable and deterministic Deflate (RFC 1951) compressor.
+/// Uses greedy LZ77 matching on hash chains and the fixed Huffman codes, which is fast and compresses the MFD images well.
+/// The same input and level always give the same output, on any platform.
+/// A compressor keeps its working tables between calls, so it should be reused, but it must not be used by two threads at the same time.
+class SoDeflate
+{
+public:
+	/// Constructor
+	/// \param[in]	level	The compression level, from 0 (no compression) to 9 (best and slowest compression).
+	SoDeflate(int level = SODEFLATE_DEFAULT_LEVEL);
+
+	/// Gets the compression level
+	/// \return the compression level
+	int				Level() const { return _level; }
+
+	/// Sets the compression level
+	/// \param[in]	level	The compression level, from 0 (no compression) to 9 (best and slowest compression).
+	void			setLevel(int level);
+
+	/// Compresses data in a raw Deflate stream.
+	/// \param[in]	data	The data to compress.
+	/// \param[in]	len		The number of bytes to compress.
+	/// \param[out]	out		The string to which the compressed stream is appended.
+	void			deflate(const void * data, size_t len, std::string & out);
+
+	/// Compresses data in a zlib (RFC 1950) stream: a Deflate stream with a header and an Adler-32 checksum.
+	/// \param[in]	data	The data to compress.
+	/// \param[in]	len		The number of bytes to compress.
+	/// \param[out]	out		The string to which the compressed stream is appended.
+	void			zlib(const void * data, size_t len, std::string & out);
+
+	/// Compresses data in a gzip (RFC 1952) stream: a Deflate stream with a header and a CRC-32 checksum.
+	/// The header has no file name nor modification time, so that the output only depends on the data.
+	/// \param[in]	data	The data to compress.
+	/// \param[in]	len		The number of bytes to compress.
+	/// \param[out]	out		The string to which the compressed stream is appended.
+	void			gzip(const void * data, size_t len, std::string & out);
+
+	/// Computes the CRC-32 (as used by PNG and gzip) of data.
+	/// \param[in]	crc		The CRC of the previous data, 0 to start.
+	/// \param[in]	data	The data.
+	/// \param[in]	len		The number of bytes.
+	/// \return The CRC of the previous data followed by the given data.
+	static unsigned int	crc32(unsigned int crc, const void * data, size_t len);
+
+	/// Computes the Adler-32 (as used by zlib) of data.
+	/// \param[in]	adler	The Adler-32 of the previous data, 1 to start.
+	/// \param[in]	data	The data.
+	/// \param[in]	len		The number of bytes.
+	/// \return The Adler-32 of the previous data followed by the given data.
+	static unsigned int	adler32(unsigned int adler, const void * data, size_t len);
+
+private:
+	/// Writes data in stored (uncompressed) blocks.
+	/// \param[in]	p		The data.
+	/// \param[in]	len		The number of bytes.
+	/// \param[out]	out		The output string.
+	void			_store(const unsigned char * p, size_t len, std::string & out);
+
+	/// Writes bits to the output, least significant bit first.
+	/// \param[out]	out		The output string.
+	/// \param[in]	bits	The bits to write.
+	/// \param[in]	count	The number of bits to write.
+	void			_putBits(std::string & out, unsigned int bits, int count);
+
+	/// Writes a literal or length symbol with its fixed Huffman code.
+	/// \param[out]	out		The output string.
+	/// \param[in]	symbol	The symbol, from 0 to 287.
+	void			_putSymbol(std::string & out, int symbol);
+
+	/// Writes a match.
+	/// \param[out]	out			The output string.
+	/// \param[in]	length		The length of the match, from 3 to 258.
+	/// \param[in]	distance	The distance of the match, from 1 to 32768.
+	void			_putMatch(std::string & out, int length, int distance);
+
+	/// Writes the remaining bits, padding the last byte with zeros.
+	/// \param[out]	out		The output string.
+	void			_flushBits(std::string & out);
+
+	/// The compression level
+	int					_level;
+
+	/// The maximum number of positions tried when looking for a match
+	int					_maxChain;
+
+	/// The bits waiting to be written
+	unsigned int		_bitBuf;
+
+	/// The number of bits waiting to be written
+	int					_bitCount;
+
+	/// The offset added to the positions stored in the tables, so that the positions of previous calls are ignored
+	unsigned int		_base;
+
+	/// For each hash of 3 bytes, the last position at which it was found (offset by _base + 1)
+	std::vector<unsigned int>	_head;
+
+	/// For each position in the window, the previous position with the same hash (offset by _base + 1)
+	std::vector<unsigned int>	_prev;
+};
+
+/// \}
@@ -6,8 +6,10 @@
 /// \{
 
 #include "SoHTTP.h"
+#include "SoHTTPParser.h"
 
 #include <iostream>
+#include <stdlib.h>
 #include <string>
 
 /// Server main thread (listening loop) start function.
@@ -22,22 +24,23 @@ DWORD WINAPI startLoop(__in LPVOID lpParameter)
 }
 
 
-/// As handleConnection needs 2 parameters, this structur permit the windows thread function to call handleConnection with 2 parameters.
+/// As handleConnection needs 3 parameters, this structur permit the windows thread function to call handleConnection with 3 parameters.
 struct hConnectionParam
 {
 	SoHTTP* http;
-	SOCKET connection;
+	SoConnection* connection;
+	SoHTTP::Request request;
 };
 
 /// Connection thread start function.
-/// Just launck the _handleConnection method on the given SoHTTP object pointer with the given socket.
+/// Just launck the _handleConnection method on the given SoHTTP object pointer with the given connection and request.
 DWORD WINAPI handleConnection(__in LPVOID lpParameter)
 {
 	// Get the param structure from the function argument
 	hConnectionParam *param = (hConnectionParam*)lpParameter;
 
 	// Launch _handleConnection
-	param->http->_handleConnection(param->connection);
+	param->http->_handleConnection(param->connection, param->request);
 
 	// Delete the parameters structure
 	delete param;
@@ -47,6 +50,294 @@ DWORD WINAPI handleConnection(__in LPVOID lpParameter)
 }
 
 
+/// Handler of a connection on which HTTP requests are being received.
+/// Parses the requests in place as they arrive and, once one is complete, gives it to SoHTTP::_dispatch.
+/// The requests of a persistent connection, including pipelined ones, are dispatched one after the other, in order.
+class SoHTTPRequestHandler : public SoConnectionHandler
+{
+public:
+	/// Constructor
+	/// \param[in]	http	The server that will dispatch the requests.
+	SoHTTPRequestHandler(SoHTTP & http) : _http(http), _busy(false), _pending(0) {}
+
+	/// Destructor
+	/// Destroys the response that was still pending.
+	virtual ~SoHTTPRequestHandler() { delete _pending; }
+
+	/// Starts waiting for the first request.
+	virtual void	onOpen(SoConnection & connection);
+
+	/// Parses the received data and dispatches the requests that are complete.
+	virtual bool	onReceive(SoConnection & connection, const char * data, int len);
+
+	/// Called when the connection has been given back by the thread that answered the request, or when a pending response can be written:
+	/// handles the next request.
+	virtual void	onWake(SoConnection & connection);
+
+	/// Closes the connection that has waited too long for a request.
+	virtual void	onTimer(SoConnection & connection);
+
+private:
+	/// Dispatches the complete requests of the buffer, until a request is incomplete or is not answered right away.
+	/// \param[in]	connection	The connection.
+	/// \param[in]	status		The status of the parsing of the current request.
+	/// \return Wether the connection should be kept open. True when the request is refused, as the connection is then closed once the error is sent.
+	bool			_process(SoConnection & connection, SoHTTPParser::Status status);
+
+	/// Answers a request that could not be parsed with an error, and closes the connection once the error is sent.
+	/// The connection cannot be kept open, as the end of the refused request, and so the start of the next one, is unknown.
+	/// \param[in]	connection	The connection.
+	/// \param[in]	status		The status of the parsing: INVALID is answered with a 400, UNSUPPORTED with a 501.
+	static void		_refuse(SoConnection & connection, SoHTTPParser::Status status);
+
+	/// Fills the request structure given to the server from the parsed request.
+	/// This is the only place where the request is copied, once it is complete.
+	/// \param[out]	req		The request structure to fill.
+	void			_fillRequest(SoHTTP::Request & req);
+
+	/// Parses the get string of the resource.
+	/// \param[in,out]	req		The request whose get string is parsed.
+	static void		_parseGetString(SoHTTP::Request & req);
+
+	/// The server that will dispatch the requests.
+	SoHTTP &		_http;
+
+	/// Wether a request is being answered by a thread or by a pending response: the next requests wait for it to give the connection back.
+	bool			_busy;
+
+	/// The response of the current request, waiting for the connection to be woken. 0 if there is none.
+	SoPendingResponse *	_pending;
+
+	/// The request answered by the pending response.
+	SoHTTP::Request	_pendingRequest;
+
+	/// The parser of the requests
+	SoHTTPParser	_parser;
+};
+
+
+/// Checks wether a comma separated list of tokens (e.g. a Connection header) contains a token, ignoring the case.
+/// \param[in]	list	The list.
+/// \param[in]	token	The token, in lower case.
+/// \return Wether the token is in the list.
+static bool hasToken(const std::string & list, const char * token)
+{
+	size_t pos = 0;
+	while (pos <= list.length())
+	{
+		// Get the next token of the list, without the spaces
+		size_t end = list.find(',', pos);
+		if (end == std::string::npos)
+			end = list.length();
+		size_t first = list.find_first_not_of(" \t", pos);
+		size_t last = (end > pos) ? list.find_last_not_of(" \t", end - 1) : std::string::npos;
+		if (first != std::string::npos && first < end && last != std::string::npos && last >= first
+			&& _stricmp(list.substr(first, last - first + 1).c_str(), token) == 0)
+			return true;
+		pos = end + 1;
+	}
+	return false;
+}
+
+
+void	SoHTTPRequestHandler::onOpen(SoConnection & connection)
+{
+	// The client has a limited time to send its request
+	connection.setTimer(SOHTTP_IDLE_TIMEOUT_MS);
+}
+
+
+bool	SoHTTPRequestHandler::onReceive(SoConnection & connection, const char * data, int len)
+{
+	// Add what has just been read to the buffer and parse it
+	SoHTTPParser::Status status = _parser.feed(data, (size_t)len);
+
+	// While a request is being answered, the pipelined requests are only buffered, and the connection is closed if they do not fit
+	// The connection is used by the answer: no error can be written on it
+	if (_busy)
+		return status != SoHTTPParser::INVALID;
+
+	// Dispatch the complete requests
+	return _process(connection, status);
+}
+
+
+void	SoHTTPRequestHandler::onWake(SoConnection & connection)
+{
+	// Only the thread that answered a request, or the event a pending response was waiting for, wakes the handler
+	if (!_busy)
+		return ;
+
+	// Write the pending response, and close the connection if it cannot receive the next request
+	if (_pending)
+	{
+		_pending->respond(connection, _pendingRequest);
+		delete _pending;
+		_pending = 0;
+		if (!_pendingRequest.keepAlive)
+		{
+			connection.close();
+			return ;
+		}
+	}
+	_busy = false;
+
+	// Parse and dispatch the requests that have been received meanwhile
+	_parser.reset();
+	if (!_process(connection, _parser.parse()))
+		connection.close();
+}
+
+
+void	SoHTTPRequestHandler::onTimer(SoConnection & connection)
+{
+	// The connection has waited too long for a request
+	if (!_busy)
+		connection.close();
+}
+
+
+bool	SoHTTPRequestHandler::_process(SoConnection & connection, SoHTTPParser::Status status)
+{
+	// While there is a complete request
+	for (;;)
+	{
+		// Answer an incorrect or unsupported request with an error, the connection is closed once it is sent
+		if (status == SoHTTPParser::INVALID || status == SoHTTPParser::UNSUPPORTED)
+		{
+			_refuse(connection, status);
+			return true;
+		}
+
+		// If the request is not yet complete, wait for more data, for a limited time
+		if (status != SoHTTPParser::COMPLETE)
+		{
+			connection.setTimer(SOHTTP_IDLE_TIMEOUT_MS);
+			return true;
+		}
+
+		// The request is complete: the idle time is over
+		connection.setTimer(0);
+
+		// Dispatch the request
+		SoHTTP::Request req;
+		_fillRequest(req);
+		if (!_http._dispatch(connection, req))
+		{
+			// The connection has either been closed, given to another handler or to a thread, which will wake the handler once it has answered
+			// or the response is pending until the connection is woken
+			_busy = true;
+			if (req.pending)
+			{
+				_pending = req.pending;
+				_pendingRequest = req;
+				_pendingRequest.pending = 0;
+			}
+			return true;
+		}
+
+		// The request has been answered and the connection is kept open: parse the next request
+		_parser.reset();
+		status = _parser.parse();
+	}
+}
+
+
+void	SoHTTPRequestHandler::_refuse(SoConnection & connection, SoHTTPParser::Status status)
+{
+	// The request cannot be read: the response is only framed to be closed
+	SoHTTP::Request req;
+	req.canKeepAlive = false;
+
+	// Send the error
+	if (status == SoHTTPParser::UNSUPPORTED)
+		SoHTTP::sendResponse(connection, req, "501 Not Implemented", "", "<h1>Transfer-Encoding is not supported</h1>");
+	else
+		SoHTTP::sendResponse(connection, req, "400 Bad Request", "", "<h1>Malformed request</h1>");
+
+	// Close the connection once the error has been sent
+	connection.close();
+}
+
+
+void	SoHTTPRequestHandler::_fillRequest(SoHTTP::Request & req)
+{
+	// The first line
+	req.method = _parser.Method().str();
+	req.resource = _parser.Target().str();
+	req.version = _parser.Version().str();
+
+	// The headers, whose names are in lower case
+	for (int i = 0; i < _parser.HeaderCount(); ++i)
+	{
+		const SoHTTPParser::Header & h = _parser.getHeader(i);
+		std::string name = h.name.str();
+		for (std::string::iterator c = name.begin(); c != name.end(); ++c)
+			*c = tolower(*c);
+		req.headers[name] = h.value.str();
+	}
+
+	// The body, which may contain any byte
+	req.body = _parser.Body().str();
+
+	// Wether the client accepts that the connection is kept open: by default in HTTP/1.1, only if asked in HTTP/1.0
+	SoStringView connectionHeader;
+	bool hasConnection = _parser.findHeader("connection", connectionHeader);
+	std::string connectionValue = connectionHeader.str();
+	if (_parser.Version() == "1.1")
+		req.canKeepAlive = !hasConnection || !hasToken(connectionValue, "close");
+	else
+		req.canKeepAlive = hasConnection && hasToken(connectionValue, "keep-alive");
+
+	// A connection that is upgraded to another protocol does not carry any more HTTP request:
+	// the bytes that follow the request (e.g. the WebSocket key) are given in the body, as they have already been received
+	SoStringView upgrade;
+	if (_parser.findHeader("upgrade", upgrade))
+	{
+		req.body.append(_parser.Rest().data, _parser.Rest().len);
+		req.canKeepAlive = false;
+	}
+
+	// Parse the get variables
+	_parseGetString(req);
+}
+
+
+void	SoHTTPRequestHandler::_parseGetString(SoHTTP::Request & req)
+{
+	// The position of the first '?' character in the resource string
+	size_t pos = req.resource.find('?');
+
+	// If there is no '?' in the resource string, there is no get variable
+	if (pos == std::string::npos)
+		return ;
+
+	// Get the raw get string
+	req.getString = req.resource.substr(pos + 1);
+
+	// Changing the resource so it now does not include the get string
+	req.resource.erase(pos);
+
+	// Parsing each variable declaration, between '&' characters
+	const std::string & getString = req.getString;
+	for (size_t start = 0; start <= getString.length(); )
+	{
+		// The end of the declaration
+		size_t end = getString.find('&', start);
+		if (end == std::string::npos)
+			end = getString.length();
+
+		// If there is a '=', then it is indeed a variable declaration, then register it
+		size_t eq = getString.find('=', start);
+		if (eq < end)
+			req.get[getString.substr(start, eq - start)] = getString.substr(eq + 1, end - eq - 1);
+
+		// Go to the next declaration
+		start = end + 1;
+	}
+}
+
+
 SoHTTP::SoHTTP()
 {
 	// Create the mutex
@@ -59,7 +350,7 @@ SoHTTP::~SoHTTP(void)
 }
 
 
-bool	SoHTTP::start(int port, int backlog)
+bool	SoHTTP::start(int port, int backlog, unsigned int ioThreads /* = 2 */)
 {
 	// Creating the Socket
 	_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -89,6 +380,13 @@ bool	SoHTTP::start(int port, int backlog)
 		return false;
 	}
 
+	// Starting the reactor that will handle all connections
+	if (!_reactor.start(ioThreads))
+	{
+		closesocket(_socket);
+		return false;
+	}
+
 	// Creating the main thread (listening loop)
 	_thread = CreateThread(NULL, 0, startLoop, (LPVOID*)this, 0, NULL);
 	
@@ -99,14 +397,21 @@ bool	SoHTTP::start(int port, int backlog)
 
 void	SoHTTP::stop()
 {
+	// Terminating the main thread and socket (listening loop) so that no new connection arrives
+	TerminateThread(_thread, 1);
+	closesocket(_socket);
+
+	// Close all the connections handled by the reactor (including those used by handleRequest threads) and stop its I/O threads
+	_reactor.stop();
+
 	// Wait to be able to access _childrenThreads by waiting to gain acces to its mutex
 	WaitForSingleObject(_childrenThreadsMutex, INFINITE);
 
-	// Terminate all connection threads and sockets
+	// Terminate all handleRequest threads, their sockets have been closed with the reactor connections
 	for (HANDLEList::iterator i = _childrenThreads.begin(); i != _childrenThreads.end(); ++i)
 	{
 		TerminateThread(i->first, 1);
-		closesocket(i->second);
+		CloseHandle(i->first);
 	}
 	
 	// Emptying _childrenThreads as all connections have been terminated
@@ -114,14 +419,307 @@ void	SoHTTP::stop()
 	
 	// Release the _childrenThreads access mutex
 	ReleaseMutex(_childrenThreadsMutex);
+}
 
-	// Terminating the main thread and socket (listening loop)
-	TerminateThread(_thread, 1);
-	closesocket(_socket);
+
+/// Builds the status line and the headers of a response.
+/// \param[in]	request		The request being answered.
+/// \param[in]	status		The status code and reason.
+/// \param[in]	headers		Additional headers, each ending with "\r\n".
+/// \param[in]	framing		The header that delimits the body, ending with "\r\n".
+/// \return The head of the response, up to the empty line.
+static std::string responseHead(const SoHTTP::Request & request, const char * status, const char * headers, const std::string & framing)
+{
+	std::string head = "HTTP/1.1 ";
+	head += status;
+	head += "\r\n";
+	head += headers;
+	head += framing;
+	head += request.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+	return head;
+}
+
+
+/// Builds the Content-Length header of a response.
+/// \param[in]	len		The length of the body.
+/// \return The header, ending with "\r\n".
+static std::string contentLength(unsigned __int64 len)
+{
+	char length[24];
+	_ui64toa_s(len, length, 24, 10);
+	return std::string("Content-Length: ") + length + "\r\n";
 }
 
 
-void	SoHTTP::sendFromDir(SOCKET connection, const char * dir, const char * resource)
+/// Converts a file time to a number of seconds, as HTTP dates have a one second precision.
+/// \param[in]	time	The file time.
+/// \return The number of seconds since 1601.
+static ULONGLONG fileTimeSeconds(const FILETIME & time)
+{
+	return (((ULONGLONG)time.dwHighDateTime << 32) | time.dwLowDateTime) / 10000000;
+}
+
+
+/// The day names of the HTTP dates, by day of the week
+static const char * const httpDays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+
+/// The month names of the HTTP dates, by month
+static const char * const httpMonths[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+
+/// Formats a file time as a HTTP date (e.g. "Sun, 06 Nov 1994 08:49:37 GMT").
+/// \param[in]	time	The file time.
+/// \return The HTTP date.
+static std::string httpDate(const FILETIME & time)
+{
+	SYSTEMTIME st;
+	if (!FileTimeToSystemTime(&time, &st))
+		return "";
+
+	char date[32];
+	sprintf_s(date, sizeof(date), "%s, %02d %s %04d %02d:%02d:%02d GMT", httpDays[st.wDayOfWeek % 7], st.wDay, httpMonths[(st.wMonth + 11) % 12], st.wYear, st.wHour, st.wMinute, st.wSecond);
+	return date;
+}
+
+
+/// Parses a HTTP date in the format sent by httpDate, which is the only one generated by current clients.
+/// \param[in]	date	The HTTP date.
+/// \param[out]	seconds	The number of seconds since 1601.
+/// \return Wether the date could be parsed.
+static bool parseHttpDate(const std::string & date, ULONGLONG & seconds)
+{
+	// "Sun, 06 Nov 1994 08:49:37 GMT"
+	if (date.length() != 29 || date[3] != ',' || date[4] != ' ' || date[7] != ' ' || date[11] != ' ' || date[16] != ' ' || date[19] != ':' || date[22] != ':' || date.compare(25, 4, " GMT") != 0)
+		return false;
+
+	SYSTEMTIME st;
+	memset(&st, 0, sizeof(st));
+	st.wDay = (WORD)atoi(date.c_str() + 5);
+	st.wYear = (WORD)atoi(date.c_str() + 12);
+	st.wHour = (WORD)atoi(date.c_str() + 17);
+	st.wMinute = (WORD)atoi(date.c_str() + 20);
+	st.wSecond = (WORD)atoi(date.c_str() + 23);
+	for (int i = 0; i < 12 && !st.wMonth; ++i)
+		if (date.compare(8, 3, httpMonths[i]) == 0)
+			st.wMonth = (WORD)(i + 1);
+
+	// SystemTimeToFileTime validates the fields
+	FILETIME time;
+	if (!SystemTimeToFileTime(&st, &time))
+		return false;
+	seconds = fileTimeSeconds(time);
+	return true;
+}
+
+
+/// Checks the validators of a request against the current version of a resource.
+/// If-None-Match is used when it is given, If-Modified-Since is only used without it.
+/// \param[in]	request		The request.
+/// \param[in]	etag		The entity tag of the resource, with its quotes.
+/// \param[in]	modified	The time of the last modification of the resource.
+/// \return Wether the client already has the current version, and should be answered with 304 Not Modified.
+static bool isNotModified(const SoHTTP::Request & request, const std::string & etag, const FILETIME & modified)
+{
+	// If-None-Match: a list of entity tags, or "*", compared with the weak comparison
+	SoHTTP::Request::headerMap::const_iterator match = request.headers.find("if-none-match");
+	if (match != request.headers.end())
+	{
+		std::string opaque = (etag.compare(0, 2, "W/") == 0) ? etag.substr(2) : etag;
+		const std::string & list = match->second;
+		size_t pos = 0;
+		while (pos < list.length())
+		{
+			// Get the next entity tag of the list, without the spaces and the weak indicator
+			size_t end = list.find(',', pos);
+			if (end == std::string::npos)
+				end = list.length();
+			size_t first = list.find_first_not_of(" \t", pos);
+			size_t last = list.find_last_not_of(" \t", end - 1);
+			if (first != std::string::npos && first < end && last >= first)
+			{
+				std::string tag = list.substr(first, last - first + 1);
+				if (tag == "*")
+					return true;
+				if (tag.compare(0, 2, "W/") == 0)
+					tag = tag.substr(2);
+				if (tag == opaque)
+					return true;
+			}
+			pos = end + 1;
+		}
+		return false;
+	}
+
+	// If-Modified-Since: the resource has not been modified after the given date
+	SoHTTP::Request::headerMap::const_iterator since = request.headers.find("if-modified-since");
+	ULONGLONG sinceSeconds;
+	if (since != request.headers.end() && parseHttpDate(since->second, sinceSeconds))
+		return fileTimeSeconds(modified) <= sinceSeconds;
+
+	// There is no usable validator
+	return false;
+}
+
+
+void	SoHTTP::sendResponse(SOCKET connection, Request & request, const char * status, const char * headers, const char * body, size_t len)
+{
+	// The response is delimited: the connection can be kept open if the client accepts it
+	request.keepAlive = request.canKeepAlive;
+
+	// Send the head and the body
+	std::string head = responseHead(request, status, headers, contentLength(len));
+	send(connection, head.data(), (int)head.length(), 0);
+	if (len > 0)
+		send(connection, body, (int)len, 0);
+}
+
+
+void	SoHTTP::sendResponse(SoConnection & connection, Request & request, const char * status, const char * headers, const char * body, size_t len)
+{
+	// The response is delimited: the connection can be kept open if the client accepts it
+	request.keepAlive = request.canKeepAlive;
+
+	// Queue the head and the body
+	std::string head = responseHead(request, status, headers, contentLength(len));
+	connection.send(head.data(), (int)head.length());
+	connection.send(body, (int)len);
+}
+
+
+void	SoHTTP::sendAsset(SoConnection & connection, Request & request, SoAsset * asset, const char * headers)
+{
+	// The response is delimited: the connection can be kept open if the client accepts it
+	request.keepAlive = request.canKeepAlive;
+
+	// A redirection has no content and no validators, and is not cached by the clients
+	if (!asset->Location().empty())
+	{
+		std::string head = responseHead(request, "307 Temporary Redirect", ("Location: " + asset->Location() + "\r\n").c_str(), contentLength(0));
+		connection.send(head.data(), (int)head.length());
+		return ;
+	}
+
+	// The validators and the caching headers, sent with the 200 and the 304 responses
+	std::string validators = "ETag: " + asset->ETag() + "\r\nLast-Modified: " + httpDate(asset->Modified()) + "\r\nVary: Accept-Encoding\r\n" + headers;
+
+	// If the client already has the file, answer with a 304 that has no content
+	if (isNotModified(request, asset->ETag(), asset->Modified()))
+	{
+		std::string head = responseHead(request, "304 Not Modified", validators.c_str(), "");
+		connection.send(head.data(), (int)head.length());
+		return ;
+	}
+
+	// Send the compressed content if there is one and if the client accepts it
+	SoBuffer * body = asset->Body();
+	Request::headerMap::const_iterator encoding = request.headers.find("accept-encoding");
+	bool gzip = asset->Gzip() && encoding != request.headers.end() && encoding->second.find("gzip") != std::string::npos;
+	if (gzip)
+		body = asset->Gzip();
+
+	// The headers describing the content
+	validators += "Content-Type: " + asset->Type() + "\r\n";
+	if (gzip)
+		validators += "Content-Encoding: gzip\r\n";
+
+	// Send the head and the content together
+	std::string head = responseHead(request, "200 OK", validators.c_str(), contentLength(body->Size()));
+	SoBuffer * parts[2] = { SoBuffer::Create(head.data(), head.length()), body };
+	connection.send(parts, 2);
+	parts[0]->Release();
+}
+
+
+bool	SoHTTP::acceptWebSocket(SoConnection & connection, Request & request, SoWebSocketHandler * handler, const char * protocol)
+{
+	// The request must be a GET asking to upgrade the connection to a WebSocket
+	Request::headerMap::const_iterator upgrade = request.headers.find("upgrade");
+	Request::headerMap::const_iterator connectionHeader = request.headers.find("connection");
+	Request::headerMap::const_iterator version = request.headers.find("sec-websocket-version");
+	Request::headerMap::const_iterator key = request.headers.find("sec-websocket-key");
+	if (	request.method != "GET"
+		||	upgrade == request.headers.end() || !hasToken(upgrade->second, "websocket")
+		||	connectionHeader == request.headers.end() || !hasToken(connectionHeader->second, "upgrade")
+		||	key == request.headers.end() || key->second.length() != 24)
+	{
+		delete handler;
+		sendResponse(connection, request, "400 Bad Request", "Sec-WebSocket-Version: 13\r\n", "<h1>Connection to this URL must use WebSockets</h1>");
+		return false;
+	}
+
+	// Only the version of RFC 6455 is supported
+	if (version == request.headers.end() || version->second != "13")
+	{
+		delete handler;
+		sendResponse(connection, request, "426 Upgrade Required", "Sec-WebSocket-Version: 13\r\n", "<h1>Unsupported WebSocket version</h1>");
+		return false;
+	}
+
+	// The proof that the handshake has been understood
+	std::string accept = SoWebSocketHandler::AcceptKey(key->second);
+	if (accept.empty())
+	{
+		delete handler;
+		sendResponse(connection, request, "500 Internal Server Error", "", "<h1>Could not compute the WebSocket handshake</h1>");
+		return false;
+	}
+
+	// Answer the handshake, confirming the sub-protocol if the client asked for it
+	std::string head = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " + accept + "\r\n";
+	Request::headerMap::const_iterator protocols = request.headers.find("sec-websocket-protocol");
+	if (protocol && protocols != request.headers.end() && hasToken(protocols->second, protocol))
+		head += std::string("Sec-WebSocket-Protocol: ") + protocol + "\r\n";
+	head += "\r\n";
+	connection.send(head.data(), (int)head.length());
+
+	// From now on, the connection is handled by the WebSocket handler
+	connection.setHandler(handler);
+
+	// Give it the frames that have been received with the request
+	if (!request.body.empty() && !handler->onReceive(connection, request.body.data(), (int)request.body.length()))
+		connection.close();
+
+	// The WebSocket has been accepted
+	return true;
+}
+
+
+void	SoHTTP::sendChunkedHeader(SOCKET connection, Request & request, const char * status, const char * headers)
+{
+	// Only HTTP/1.1 clients understand the chunked transfer encoding
+	// The other clients get the body as is, and the end of the connection delimits it
+	request.chunked = (request.version == "1.1");
+	request.keepAlive = request.chunked && request.canKeepAlive;
+
+	// Send the head
+	std::string head = responseHead(request, status, headers, request.chunked ? "Transfer-Encoding: chunked\r\n" : "");
+	send(connection, head.data(), (int)head.length(), 0);
+}
+
+
+void	SoHTTP::sendChunk(SOCKET connection, Request & request, const char * data, size_t len)
+{
+	// Without the chunked transfer encoding, the data is sent as is
+	if (!request.chunked)
+	{
+		if (len > 0)
+			send(connection, data, (int)len, 0);
+		return ;
+	}
+
+	// The size of the chunk in hexadecimal, then the chunk
+	// An empty chunk ends the body
+	char size[20];
+	_ultoa_s((unsigned long)len, size, 18, 16);
+	strcat_s(size, 20, "\r\n");
+	send(connection, size, (int)strlen(size), 0);
+	if (len > 0)
+		send(connection, data, (int)len, 0);
+	send(connection, "\r\n", 2, 0);
+}
+
+
+void	SoHTTP::sendFromDir(SOCKET connection, Request & request, const char * dir, const char * resource, const char * headers)
 {
 	// Get the resource full path
 	std::string path = std::string(dir) + "\\" + resource;
@@ -137,35 +735,65 @@ void	SoHTTP::sendFromDir(SOCKET connection, const char * dir, const char * resou
 		attrs = GetFileAttributes(path.c_str());
 	}
 	
-	// If the file does not exists, sed a 404 error
-	if (attrs == INVALID_FILE_ATTRIBUTES || (attrs & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY)
-		send(connection, "HTTP/1.0 404 NOT FOUND\r\n\r\n", 26, 0);
-	else
+	// The file to send
+	HANDLE file = INVALID_HANDLE_VALUE;
+	LARGE_INTEGER size;
+	FILETIME modified;
+
+	// Open the file if it exists and get its size and modification time
+	if (attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY) != FILE_ATTRIBUTE_DIRECTORY)
 	{
-		// Open the file
-		HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-		
-		// If the file could not be open, send a 404 error
-		if (file == INVALID_HANDLE_VALUE)
-			send(connection, "HTTP/1.0 404 NOT FOUND\r\n\r\n", 26, 0);
-		else
+		file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file != INVALID_HANDLE_VALUE && (!GetFileSizeEx(file, &size) || !GetFileTime(file, NULL, NULL, &modified)))
 		{
-			// Send a 200 OK HTTP code
-			send(connection, "HTTP/1.0 200 OK\r\n\r\n", 19, 0);
-			
-			// Send the file (using a 256 bytes buffer)
-			char buffer[256];
-			DWORD read;
-			for (;;)
-			{
-				if (!ReadFile(file, buffer, 256, &read, NULL))
-					break ;
-				if (!read)
-					break ;
-				send(connection, buffer, read, 0);
-			}
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
 		}
 	}
+
+	// If the file does not exists or could not be open, send a 404 error
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		sendResponse(connection, request, "404 NOT FOUND");
+		return ;
+	}
+
+	// The file is delimited by its size: the connection can be kept open if the client accepts it
+	request.keepAlive = request.canKeepAlive;
+
+	// The validators of the file: a weak entity tag made of its modification time and size, and its modification time
+	char etag[48];
+	sprintf_s(etag, sizeof(etag), "W/\"%llx-%llx\"", fileTimeSeconds(modified), (ULONGLONG)size.QuadPart);
+	std::string validators = std::string("ETag: ") + etag + "\r\nLast-Modified: " + httpDate(modified) + "\r\n" + headers;
+
+	// If the client already has the file, answer with a 304 that has no content
+	if (isNotModified(request, etag, modified))
+	{
+		std::string head = responseHead(request, "304 Not Modified", validators.c_str(), "");
+		send(connection, head.data(), (int)head.length(), 0);
+		CloseHandle(file);
+		return ;
+	}
+
+	// Send a 200 OK HTTP code with the type and the size of the file
+	validators += std::string("Content-Type: ") + SoAssetCache::TypeOf(path) + "\r\n";
+	std::string head = responseHead(request, "200 OK", validators.c_str(), contentLength(size.QuadPart));
+	send(connection, head.data(), (int)head.length(), 0);
+
+	// Send the file (using a 16 KB buffer)
+	char buffer[16384];
+	DWORD read;
+	for (;;)
+	{
+		if (!ReadFile(file, buffer, sizeof(buffer), &read, NULL))
+			break ;
+		if (!read)
+			break ;
+		send(connection, buffer, read, 0);
+	}
+
+	// Close the file
+	CloseHandle(file);
 }
 
 
@@ -177,245 +805,76 @@ void	SoHTTP::_loop()
 		// Wait for a new connection to arrive.
 		SOCKET connection = accept(_socket, NULL, NULL);
 		
-		// If the connection is correct
+		// If the connection is correct, give it to the reactor, that will parse its request
 		if (connection != INVALID_SOCKET)
-		{
-			// Creating and filling a hConnectionParam to be used by the connection thread start function handleConnection
-			hConnectionParam *param = new hConnectionParam;
-			param->http = this;
-			param->connection = connection;
-			
-			// Wait to be able to access _childrenThreads by waiting to gain acces to its mutex
-			WaitForSingleObject(_childrenThreadsMutex, INFINITE);
-			
-			// Create the connection thread and register it
-			HANDLE thread = CreateThread(NULL, 0, handleConnection, (LPVOID*)param, 0, NULL);
-			_childrenThreads.push_back(HSPair(thread, connection));
-			
-			// Release the _childrenThreads access mutex
-			ReleaseMutex(_childrenThreadsMutex);
-		}
+			_reactor.add(connection, new SoHTTPRequestHandler(*this));
 	}
 }
 
 
-void	SoHTTP::_handleConnection(SOCKET connection)
+bool	SoHTTP::_dispatch(SoConnection & connection, Request & request)
 {
-	// The parsing state to know which state is the current in the parsing loop
-	enum { PARSING_FISRT_LINE , PARSING_HEADERS , READING_BODY } state = PARSING_FISRT_LINE;
+	// Let the server handle the request without a thread if it can
+	// If it has answered with a delimited response, the next request can be handled right away
+	// A pending response is written once the connection is woken: the next request waits for it
+	if (handleAsyncRequest(connection, request))
+		return request.keepAlive && !request.pending;
+
+	// The request will be handled by handleRequest in its own thread, which will use the socket with blocking calls
+	connection.detach();
+
+	// Creating and filling a hConnectionParam to be used by the connection thread start function handleConnection
+	// The thread holds a reference on the connection
+	hConnectionParam *param = new hConnectionParam;
+	param->http = this;
+	param->connection = &connection;
+	param->request = request;
+	connection.AddRef();
+
+	// Wait to be able to access _childrenThreads by waiting to gain acces to its mutex
+	WaitForSingleObject(_childrenThreadsMutex, INFINITE);
 	
-	// The buffer of character to parse
-	std::string buffer;
+	// Create the connection thread and register it
+	HANDLE thread = CreateThread(NULL, 0, handleConnection, (LPVOID*)param, 0, NULL);
+	_childrenThreads.push_back(HSPair(thread, connection.Socket()));
 	
-	// The content length possibly provided in the headers, used to read the body
-	unsigned int contentLength = 0;
-
-	// The request object to fill
-	Request req;
-
-	// PARSING OF HTTP HEADERS
-	for (;;)
-	{
-		// 512 bbytes 0-filled buffer to read from the socket
-		char recvBuf[513] = {0, };
-		
-		// Reading from the socket. Because recvBuf is 0-filled, will essentially creates a 0-terminated string
-		// FIXME: Will corrupt the datas on binary bodies
-		int len = recv(connection, recvBuf, 512, 0);
-		
-		// Add what has just been read to the buffer of character to parse 
-		buffer += recvBuf;
-
-		// If we are not reading the body, then we are parsing either the first line or the HTTP headers
-		if (state != READING_BODY)
-		{
-			// Position of the next \\n character
-			unsigned int pos;
-			
-			// While there is a line
-			while ((pos = buffer.find_first_of("\n")) != std::string::npos)
-			{
-				// Get this line into the line variable
-				std::string line = buffer.substr(0, pos);
-				
-				// Remove the line from the buffer
-				buffer = buffer.substr(pos + 1);
-				
-				// Remove the ending \\r as HTTP header lines can end by \\r\\n or \\n
-				if (line[line.length() - 1] == '\r')
-					line = line.substr(0, line.length() - 1);
-
-				// If this is the fisrt line
-				if (state == PARSING_FISRT_LINE)
-				{
-					// Charcter position indicator
-					unsigned int i = 0;
-					
-					// Reading the first word of the first line: the method
-					for (; i < line.length() && isalpha(line[i]); ++i)
-						req.method += line[i];
-					
-					// Checking that the line is not finished and that there is a space
-					if (i >= line.length() || line[i] != ' ')
-					{
-						closesocket(_socket);
-						return ;
-					}
-					
-					// Ignoring all spaces between the first and the second word
-					while (line[i] == ' ')
-						++i;
-
-					// Reading the second word of the first line: the resource
-					for (; i < line.length() && line[i] != ' '; ++i)
-						req.resource += line[i];
-
-					// Checking that the line is not finished and that there is a space
-					if (i >= line.length() || line[i] != ' ')
-					{
-						closesocket(_socket);
-						return ;
-					}
-
-					// Ignoring all spaces between the first and the second word
-					while (line[i] == ' ')
-						++i;
-
-					// Reading the third word of the first line: the HTTP Version
-					if (line.substr(i, 5) != "HTTP/")
-					{
-						closesocket(_socket);
-						return ;
-					}
-					i += 5;
-					for (; i < line.length() && line[i] != ' '; ++i)
-						req.version += line[i];
-
-					// The first line parsing is finished, all the remaining lines are the first the headers then the body
-					state = PARSING_HEADERS;
-					
-					// Ignoring the rest of the line
-				}
-				// If this is not the first line, this is a header line
-				else if (state == PARSING_HEADERS)
-				{
-					// If this is an empty line, then all the headers have been parsed and the remaining of the stream is the body
-					if (line.empty())
-						state = READING_BODY;
-					// The line is not empty
-					else
-					{
-						// Charcter position indicator
-						unsigned int i = 0;
-						
-						// The name of the header
-						std::string headerName;
-						
-						// Reading all characters before ':' which are the header name
-						for (; i < line.length() && line[i] != ':'; ++i)
-							headerName += tolower(line[i]);
-						
-						// Checking that the line is not finished and that there is a colon
-						if (i >= line.length() || line[i] != ':')
-						{
-							closesocket(_socket);
-							return ;
-						}
-						
-						// Ignoring the colon
-						++i;
-						
-						// Ignoring all spaces before the header value
-						while (line[i] == ' ')
-							++i;
-						
-						// The rest of the line contains the header value
-						req.headers[headerName] = line.substr(i);
-					}
-				}
-			}
-		}
-		
-		// If we are reading the body
-		// Does not uses an 'else if' because the state may have been changed while the buffer is not empty
-		if (state == READING_BODY)
-		{
-			// Get the content-length if the request has provided one
-			if (contentLength == 0 && req.headers.find("content-length") != req.headers.end())
-				contentLength = atoi(req.headers["content-length"].c_str());
-			
-			// Reading the body
-			req.body += buffer;
-			
-			// All the remaining chars in the buffer have been put to the body, so we empty the buffer
-			buffer = "";
-			
-			// If what is read equals or is bigger than the content-length
-			// FIXME: Will not read all the body if the content-length is not given, in that case, it should read until connection closes
-			if (req.body.length() >= contentLength)
-				break ;
-		}
-	}
+	// Release the _childrenThreads access mutex
+	ReleaseMutex(_childrenThreadsMutex);
 
+	// The next request will be handled once the thread has given the connection back
+	return false;
+}
 
-	// PARSING OF THE GET STRING
-
-	// The position of the first '?' character in the resource string
-	int pos = req.resource.find_first_of('?');
-	
-	// If there is a '?' in the resource string
-	if (pos != std::string::npos)
-	{
-		// Get the raw get string
-		req.getString = req.resource.substr(pos + 1);
-		
-		// Changing the resource so it now does not include the get string
-		req.resource = req.resource.substr(0, pos);
-		
-		// Copy of the getstring to be modifyable by the parsing algorythm
-		std::string getString = req.getString;
-		
-		// Parsing the get variables...
-		do
-		{
-			// The declaration of only one variable
-			std::string str;
-			
-			// If there is a '&' then isolate the declaration of only one variable
-			if ((pos = getString.find_first_of('&')) != std::string::npos)
-			{
-				str = getString.substr(0, pos);
-				getString = getString.substr(pos + 1);
-			}
-			// The declaration is all that remains
-			else
-			{
-				str = getString;
-				getString = "";
-			}
-			// If there is a '=', then it is indeed a variable declaration, then register it
-			if ((pos = str.find_first_of('=')) != std::string::npos)
-				req.get[str.substr(0, pos)] = str.substr(pos + 1);
-		}
-		// ...while there is something to read
-		while (!getString.empty());
-	}
 
+void	SoHTTP::_handleConnection(SoConnection * connection, Request & request)
+{
 	// Launching the server-dependant treatement
 	// It should write the HTTP response
-	handleRequest(connection, req);
+	handleRequest(connection->Socket(), request);
 
 	// Wait to be able to access _childrenThreads by waiting to gain acces to its mutex
 	WaitForSingleObject(_childrenThreadsMutex, INFINITE);
 	
-	// Close the socket
-	closesocket(connection);
-	
 	// Unregister the connection thread
-	_childrenThreads.remove(HSPair(GetCurrentThread(), connection));
+	for (HANDLEList::iterator i = _childrenThreads.begin(); i != _childrenThreads.end(); ++i)
+		if (i->second == connection->Socket())
+		{
+			CloseHandle(i->first);
+			_childrenThreads.erase(i);
+			break ;
+		}
 	
 	// Release the _childrenThreads access mutex
 	ReleaseMutex(_childrenThreadsMutex);
+
+	// If the response allows it, give the connection back to the reactor to receive the next request, else close the socket
+	if (request.keepAlive)
+		connection->attach();
+	else
+		connection->close();
+
+	// Release the reference held by the thread
+	connection->Release();
 }
 
 /// }
\ No newline at end of file
@@ -9,20 +9,36 @@
 
 #pragma once
 
+#include "SoReactor.h"
+#include "SoAssetCache.h"
+#include "SoWebSocket.h"
+
 #include <Winsock2.h>
 #include <Windows.h>
 #include <list>
 #include <map>
 
+/// The time, in milliseconds, after which a connection that is waiting for a request is closed
+#define SOHTTP_IDLE_TIMEOUT_MS	15000
+
 typedef std::pair<HANDLE, SOCKET> HSPair;
 typedef std::list<HSPair> HANDLEList;
 
+class SoPendingResponse;
+
 /// \author Salomon BRYS <salomon.brys@gmail.com>
 /// Salomon Brys HHTP Library Class.
 /// Any web server has to subclass this. It then has to implements the handleRequest method.
 /// SoHTTP only parses requests, it does not handle the response.
-/// Once a request is parsed, the request structure and the socket are passed to handleRequest.
-/// It is the subclass job, via handleRequest, to write any response, HTTP or not, into the socket.
+/// All connections are handled by a SoReactor, on a small fixed set of I/O threads.
+/// Once a request is parsed, the request structure and the connection are passed to handleAsyncRequest.
+/// If it does not handle the request, the request structure and the socket are passed to handleRequest in a dedicated thread.
+/// It is the subclass job, via handleAsyncRequest or handleRequest, to write any response, HTTP or not, into the connection.
+/// Connections are persistent (HTTP/1.1 keep-alive) when both the client and the handler agree:
+/// the client by not asking to close it, the handler by writing a complete, delimited response (see sendResponse) which sets Request::keepAlive.
+/// The next requests, including pipelined ones, are then handled in order on the same connection.
+/// handleAsyncRequest can also leave the response pending (see Request::pending) until an event of another thread, without blocking any thread meanwhile.
+/// A connection waiting for a request for more than SOHTTP_IDLE_TIMEOUT_MS is closed.
 class SoHTTP
 {
 public:
@@ -33,35 +49,25 @@ public:
 	virtual ~SoHTTP(void);
 
 	/// Starts a server in its own thread.
-	/// \param[in]	port	The port to listen connections in.
-	/// \param[out]	backlog	The maximum length of the queue of pending connections.
+	/// \param[in]	port		The port to listen connections in.
+	/// \param[out]	backlog		The maximum length of the queue of pending connections.
+	/// \param[in]	ioThreads	The number of I/O threads that handle all the connections.
 	/// \return Wether the starting of the server has succeded or not
-	bool	start(int port, int backlog);
+	bool	start(int port, int backlog, unsigned int ioThreads = 2);
 	
 	/// Stops the running server.
-	/// Terminates all the threads of connected clients
+	/// Closes all the connections, terminates all the threads of handleRequest
 	/// and terminates the server listening thread.
 	void	stop();
 
-	/// Utility function to send files in a socket.
-	/// This utility function is meant to be called from a handleRequest implementation if the implemented server needs to display file contents.
-	/// It handles a HTTP response with only 404 and 200 error codes.
-	///  - If the given resource is a file, then its content is directly sent to the socket (after the HTTP 200 header).
-	///  - Else, if the given resource is a directory :
-	///     - if a index.html file exists, it is sent.
-	///     - if not, error 404.
-	///  - Else, error 404.
-	/// The true real path of the file to display is dir\\resource
-	/// \param[in]	connection	The socket to write to.
-	/// \param[in]	dir			The path of the directory of the resource.
-	/// \param[in]	resource	The resource.
-	void	sendFromDir(SOCKET connection, const char * dir, const char * resource);
-
 	/// The Request structure with every HTTP header and request information.
 	struct Request
 	{
 		typedef std::map<std::string, std::string> headerMap, getMap;
 
+		/// Constructor
+		Request() : canKeepAlive(false), keepAlive(false), chunked(false), pending(0) {}
+
 		/// The method name. Should usualy be GET or POST but could be any given method by the client
 		std::string method;
 		
@@ -82,27 +88,163 @@ public:
 
 		/// The given body of the request, if any.
 		std::string body;
+
+		/// Wether the client accepts that the connection is kept open after the response:
+		/// it is a HTTP/1.1 request without "Connection: close", or it has "Connection: keep-alive".
+		bool canKeepAlive;
+
+		/// Wether the connection must be kept open, to receive the next request, once the response has been written.
+		/// Is false by default: the handler sets it (usually through sendResponse) when its response is complete and delimited.
+		bool keepAlive;
+
+		/// Wether the response is being sent with the chunked transfer encoding (see sendChunkedHeader).
+		bool chunked;
+
+		/// The response that handleAsyncRequest has left pending, 0 if it has answered the request.
+		/// The connection takes its ownership: it is called to write the response once the connection has been woken (see SoConnection::wake),
+		/// and is destroyed after, or when the connection is closed before.
+		SoPendingResponse * pending;
 	};
 
+	/// Utility function to send files in a socket.
+	/// This utility function is meant to be called from a handleRequest implementation if the implemented server needs to display file contents.
+	/// It handles a HTTP response with only 404, 304 and 200 error codes, delimited by a Content-Length so that the connection can be kept open.
+	/// The file is sent with an ETag and a Last-Modified header, and is answered with 304 Not Modified if the request validators (If-None-Match, If-Modified-Since) match it.
+	///  - If the given resource is a file, then its content is directly sent to the socket (after the HTTP 200 header).
+	///  - Else, if the given resource is a directory :
+	///     - if a index.html file exists, it is sent.
+	///     - if not, error 404.
+	///  - Else, error 404.
+	/// The true real path of the file to display is dir\\resource
+	/// \param[in]	connection	The socket to write to.
+	/// \param[in]	request		The request being answered.
+	/// \param[in]	dir			The path of the directory of the resource.
+	/// \param[in]	resource	The resource.
+	/// \param[in]	headers		Additional headers (e.g. Cache-Control), each ending with "\r\n", sent with the 200 and 304 responses.
+	void	sendFromDir(SOCKET connection, Request & request, const char * dir, const char * resource, const char * headers = "");
+
+	/// Utility function to send a file of a SoAssetCache, on a connection handled by the reactor.
+	/// The head and the content are sent from memory in one vectored write, delimited by the Content-Length.
+	/// The gzip compressed content is sent if the asset has one and if the client accepts it.
+	/// The file is answered with 304 Not Modified, without content, if the request validators (If-None-Match, If-Modified-Since) match it.
+	/// An asset that is a redirection is answered with 307 Temporary Redirect.
+	/// Sets request.keepAlive if the client accepts that the connection is kept open.
+	/// \param[in]	connection	The connection to write to.
+	/// \param[in]	request		The request being answered.
+	/// \param[in]	asset		The file to send.
+	/// \param[in]	headers		Additional headers (e.g. Cache-Control), each ending with "\r\n", sent with the 200 and 304 responses.
+	static void	sendAsset(SoConnection & connection, Request & request, SoAsset * asset, const char * headers = "");
+
+	/// Utility function to send a complete response, delimited by its Content-Length.
+	/// Sets request.keepAlive if the client accepts that the connection is kept open.
+	/// \param[in]	connection	The socket to write to.
+	/// \param[in]	request		The request being answered.
+	/// \param[in]	status		The status code and reason, e.g. "200 OK".
+	/// \param[in]	headers		Additional headers, each ending with "\r\n". Can be empty.
+	/// \param[in]	body		The body of the response.
+	/// \param[in]	len			The number of bytes of the body.
+	static void	sendResponse(SOCKET connection, Request & request, const char * status, const char * headers, const char * body, size_t len);
+
+	/// Utility function to send a complete response, delimited by its Content-Length, on a connection handled by the reactor.
+	/// Sets request.keepAlive if the client accepts that the connection is kept open.
+	/// \param[in]	connection	The connection to write to.
+	/// \param[in]	request		The request being answered.
+	/// \param[in]	status		The status code and reason, e.g. "200 OK".
+	/// \param[in]	headers		Additional headers, each ending with "\r\n". Can be empty.
+	/// \param[in]	body		The body of the response.
+	/// \param[in]	len			The number of bytes of the body.
+	static void	sendResponse(SoConnection & connection, Request & request, const char * status, const char * headers, const char * body, size_t len);
+
+	/// Utility function to send a complete response whose body is a null-terminated string.
+	/// \param[in]	connection	The socket to write to.
+	/// \param[in]	request		The request being answered.
+	/// \param[in]	status		The status code and reason, e.g. "200 OK".
+	/// \param[in]	headers		Additional headers, each ending with "\r\n". Can be empty.
+	/// \param[in]	body		The body of the response.
+	static void	sendResponse(SOCKET connection, Request & request, const char * status, const char * headers = "", const char * body = "") { sendResponse(connection, request, status, headers, body, strlen(body)); }
+
+	/// Utility function to send a complete response whose body is a null-terminated string, on a connection handled by the reactor.
+	/// \param[in]	connection	The connection to write to.
+	/// \param[in]	request		The request being answered.
+	/// \param[in]	status		The status code and reason, e.g. "200 OK".
+	/// \param[in]	headers		Additional headers, each ending with "\r\n". Can be empty.
+	/// \param[in]	body		The body of the response.
+	static void	sendResponse(SoConnection & connection, Request & request, const char * status, const char * headers = "", const char * body = "") { sendResponse(connection, request, status, headers, body, strlen(body)); }
+
+	/// Utility function to accept a WebSocket (RFC 6455) on a connection handled by the reactor.
+	/// Checks the handshake of the request and, if it is correct, answers it and gives the connection to the WebSocket handler,
+	/// which receives the frames the client may have sent right after the request.
+	/// If it is not correct, answers with a 400 Bad Request (or 426 Upgrade Required for another WebSocket version) and destroys the handler:
+	/// the caller must then close the connection, as for any response that does not set request.keepAlive.
+	/// \param[in]	connection	The connection to the client.
+	/// \param[in]	request		The upgrade request.
+	/// \param[in]	handler		The handler of the WebSocket. The connection takes its ownership.
+	/// \param[in]	protocol	The sub-protocol of the WebSocket, confirmed to the client if it asked for it. Can be 0.
+	/// \return Wether the WebSocket has been accepted.
+	static bool	acceptWebSocket(SoConnection & connection, Request & request, SoWebSocketHandler * handler, const char * protocol = 0);
+
+	/// Utility function to start a response whose length is not known in advance.
+	/// The body is then sent with sendChunk, and terminated by sendChunk with an empty chunk.
+	/// The body is sent in the chunked transfer encoding to HTTP/1.1 clients, so that the connection can be kept open.
+	/// It is sent as is to the other clients, and the connection is closed after it.
+	/// \param[in]	connection	The socket to write to.
+	/// \param[in]	request		The request being answered.
+	/// \param[in]	status		The status code and reason, e.g. "200 OK".
+	/// \param[in]	headers		Additional headers, each ending with "\r\n". Can be empty.
+	static void	sendChunkedHeader(SOCKET connection, Request & request, const char * status, const char * headers);
+
+	/// Utility function to send a part of a response started with sendChunkedHeader.
+	/// \param[in]	connection	The socket to write to.
+	/// \param[in]	request		The request being answered.
+	/// \param[in]	data		The part of the body.
+	/// \param[in]	len			The number of bytes of the part. 0 ends the response.
+	static void	sendChunk(SOCKET connection, Request & request, const char * data, size_t len);
 
 protected:
+	/// Method that can be implemented by a server subclass to handle requests without a thread.
+	/// It is called by an I/O thread and must therefore NEVER block.
+	/// To handle the request, it must write its response into the connection and either close the connection,
+	/// give it a new handler (with SoConnection::setHandler) that will handle all the next connection events,
+	/// or write a complete response that sets request.keepAlive (see sendResponse) so that the next request is received on the connection,
+	/// or set request.pending so that the response is written once another thread has woken the connection.
+	/// \param[in]	connection	The connection to the client.
+	/// \param[in]	request		The request informations. Can be modified without side effects.
+	/// \return Wether the request has been handled. If not, handleRequest will be called in its own thread.
+	virtual bool handleAsyncRequest(SoConnection & connection, Request & request) { return false; }
+
 	/// Method to be implemented by any server subclass that uses SoHTTP.
-	/// The socket will be closed when the function returns.
-	/// This function can block without impacting the server as it is run in a thread.
+	/// Called for each request that has not been handled by handleAsyncRequest.
+	/// The socket will be closed when the function returns, unless request.keepAlive has been set (see sendResponse).
+	/// This function can block without impacting the server as it is run in its own thread.
 	/// \param[in]	connection	The socket connected to the clients.
 	/// \param[in]	request		The request informations passed by reference for optimization. Is not used after the handleRequest call so it can be modified without side effects.
 	virtual void handleRequest(SOCKET connection, Request & request) = 0;
 
+	/// Gets the reactor that handles all the connections, to read its counters.
+	/// \return the reactor
+	SoReactor &	Reactor() { return _reactor; }
+
 private:
 	/// The listening loop of the main server thread.
-	/// Handles the new connections, creating their own thread and calls _handleConnection.
+	/// Accepts the new connections and gives them to the reactor.
 	void	_loop();
 	
-	/// Handles a connection life cycle.
-	///  - Parses a request, creating a Request structure.
+	/// Dispatches a parsed request.
+	/// Calls handleAsyncRequest and, if the request has not been handled, calls handleRequest in its own thread.
+	/// \param[in]	connection	The connection on which the request has been received.
+	/// \param[in]	request		The parsed request.
+	/// \return Wether the request has been answered and the next request of the connection can be parsed right away.
+	bool	_dispatch(SoConnection & connection, Request & request);
+
+	/// Handles the legacy life cycle of a request, in its own thread.
 	///  - Calls handleRequest.
-	///  - Terminates the connection.
-	void	_handleConnection(SOCKET connection);
+	///  - Gives the connection back to the reactor if the response allows it to be kept open, else terminates the connection.
+	/// \param[in]	connection	The detached connection on which the request has been received.
+	/// \param[in]	request		The parsed request.
+	void	_handleConnection(SoConnection * connection, Request & request);
+
+	/// The reactor that handles all the connections.
+	SoReactor	_reactor;
 
 	/// The handle of the main thread (listening loop).
 	HANDLE		_thread;
@@ -110,8 +252,8 @@ private:
 	/// The socket of the main thread (listening loop).
 	SOCKET		_socket;
 	
-	/// The list of all current connections threads.
-	/// Used by each connection thread to register and unregister themselves.
+	/// The list of all current handleRequest threads.
+	/// Used by each handleRequest thread to register and unregister themselves.
 	HANDLEList	_childrenThreads;
 	
 	/// The mutex to access _childrenThreads.
@@ -119,6 +261,25 @@ private:
 
 	friend DWORD WINAPI startLoop(__in LPVOID lpParameter);
 	friend DWORD WINAPI handleConnection(__in LPVOID lpParameter);
+	friend class SoHTTPRequestHandler;
+};
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// A response that can only be written after an event that happens in another thread (see SoHTTP::Request::pending).
+/// The thread in which the event happens wakes the connection (SoConnection::wake), which must hold a reference on the connection until then.
+/// The next requests of the connection wait for the response to be written.
+class SoPendingResponse
+{
+public:
+	/// Virtual destructor
+	/// Is called once the response has been written, or when the connection has been closed before.
+	virtual ~SoPendingResponse() {}
+
+	/// Called by an I/O thread once the connection has been woken: writes the response.
+	/// The connection is closed after, unless request.keepAlive has been set (see SoHTTP::sendResponse).
+	/// \param[in]	connection	The connection to the client.
+	/// \param[in]	request		The request being answered.
+	virtual void	respond(SoConnection & connection, SoHTTP::Request & request) = 0;
 };
 
 /// \}
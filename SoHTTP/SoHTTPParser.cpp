@@ -0,0 +1,239 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#include "SoHTTPParser.h"
+
+#include <string.h>
+
+/// Gets the lower case of an ASCII character, without depending on the locale.
+/// \param[in]	c	The character.
+/// \return The lower case character.
+static inline char lowerASCII(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+
+bool	SoStringView::operator==(const char * str) const
+{
+	return strlen(str) == len && memcmp(data, str, len) == 0;
+}
+
+
+bool	SoStringView::equalsNoCase(const char * str) const
+{
+	// Compare each character, the string must end exactly at the end of the view
+	for (size_t i = 0; i < len; ++i)
+		if (!str[i] || lowerASCII(data[i]) != lowerASCII(str[i]))
+			return false;
+	return str[len] == 0;
+}
+
+
+SoHTTPParser::SoHTTPParser() :
+	_state(REQUEST_LINE), _size(0), _pos(0), _scan(0), _end(0), _bodyStart(0), _contentLength(0), _nbHeaders(0)
+{
+}
+
+
+SoHTTPParser::Status	SoHTTPParser::feed(const char * data, size_t len)
+{
+	// A request that does not fit in the buffer is refused
+	if (len > SOHTTPPARSER_BUFFER_SIZE - _size)
+	{
+		_state = FAILED;
+		return INVALID;
+	}
+
+	// Append the data to the buffer, as is: it may contain any byte
+	memcpy(_buf + _size, data, len);
+	_size += len;
+
+	// Parse what has been added
+	return parse();
+}
+
+
+SoHTTPParser::Status	SoHTTPParser::parse()
+{
+	// Parse the lines of the first line and of the headers
+	while (_state == REQUEST_LINE || _state == HEADERS)
+	{
+		// Look for the end of the current line, only in the bytes that have not been examined yet
+		const char * nl = (const char *)memchr(_buf + _scan, '\n', _size - _scan);
+		if (!nl)
+		{
+			_scan = _size;
+			return NEED_MORE;
+		}
+
+		// The line, without its ending \r as HTTP lines can end by \r\n or \n
+		const char * line = _buf + _pos;
+		size_t len = nl - line;
+		if (len > 0 && line[len - 1] == '\r')
+			--len;
+
+		// The next line starts after the \n
+		_pos = _scan = (nl - _buf) + 1;
+
+		// The first line
+		if (_state == REQUEST_LINE)
+		{
+			if (!_parseRequestLine(line, len))
+				_state = FAILED;
+			else
+				_state = HEADERS;
+		}
+		// An empty line ends the headers: the rest is the body
+		else if (len == 0)
+		{
+			_bodyStart = _pos;
+			_state = BODY;
+		}
+		// A header line
+		else
+			_state = _parseHeader(line, len);
+	}
+
+	// The body is complete once Content-Length bytes have been received
+	if (_state == BODY && _size - _bodyStart >= _contentLength)
+	{
+		_end = _bodyStart + _contentLength;
+		_state = DONE;
+	}
+
+	// Return the status corresponding to the state
+	if (_state == DONE)
+		return COMPLETE;
+	if (_state == FAILED)
+		return INVALID;
+	if (_state == REFUSED)
+		return UNSUPPORTED;
+	return NEED_MORE;
+}
+
+
+void	SoHTTPParser::reset()
+{
+	// Only a complete request can be forgotten, the bytes of a partial or incorrect one are dropped
+	size_t end = (_state == DONE) ? _end : _size;
+
+	// Move the bytes of the next request to the beginning of the buffer
+	memmove(_buf, _buf + end, _size - end);
+	_size -= end;
+
+	// Start the parsing of the next request
+	_state = REQUEST_LINE;
+	_pos = _scan = _end = _bodyStart = _contentLength = 0;
+	_nbHeaders = 0;
+	_method = _target = _version = SoStringView();
+}
+
+
+bool	SoHTTPParser::findHeader(const char * name, SoStringView & value) const
+{
+	// The header table is small: a linear search is faster than any map
+	for (int i = 0; i < _nbHeaders; ++i)
+		if (_headers[i].name.equalsNoCase(name))
+		{
+			value = _headers[i].value;
+			return true;
+		}
+
+	// The header has not been found
+	return false;
+}
+
+
+bool	SoHTTPParser::_parseRequestLine(const char * line, size_t len)
+{
+	// Charcter position indicator
+	size_t i = 0;
+
+	// Reading the first word: the method
+	while (i < len && ((line[i] >= 'A' && line[i] <= 'Z') || (line[i] >= 'a' && line[i] <= 'z')))
+		++i;
+	_method = SoStringView(line, i);
+
+	// Checking that there is a method followed by a space, and ignoring the spaces
+	if (i == 0 || i >= len || line[i] != ' ')
+		return false;
+	while (i < len && line[i] == ' ')
+		++i;
+
+	// Reading the second word: the target
+	size_t start = i;
+	while (i < len && line[i] != ' ')
+		++i;
+	_target = SoStringView(line + start, i - start);
+
+	// Checking that there is a space, and ignoring the spaces
+	if (i >= len)
+		return false;
+	while (i < len && line[i] == ' ')
+		++i;
+
+	// Reading the third word: the HTTP version
+	if (len - i < 5 || memcmp(line + i, "HTTP/", 5) != 0)
+		return false;
+	i += 5;
+	start = i;
+	while (i < len && line[i] != ' ')
+		++i;
+	_version = SoStringView(line + start, i - start);
+
+	// The rest of the line is ignored
+	return true;
+}
+
+
+SoHTTPParser::State	SoHTTPParser::_parseHeader(const char * line, size_t len)
+{
+	// Too many headers
+	if (_nbHeaders >= SOHTTPPARSER_MAX_HEADERS)
+		return FAILED;
+
+	// The name is all the characters before ':'
+	const char * colon = (const char *)memchr(line, ':', len);
+	if (!colon || colon == line)
+		return FAILED;
+
+	// The value is the rest of the line, without its leading and trailing spaces
+	size_t start = (colon - line) + 1;
+	while (start < len && (line[start] == ' ' || line[start] == '\t'))
+		++start;
+	size_t end = len;
+	while (end > start && (line[end - 1] == ' ' || line[end - 1] == '\t'))
+		--end;
+
+	// Add the header to the table
+	Header & h = _headers[_nbHeaders++];
+	h.name = SoStringView(line, colon - line);
+	h.value = SoStringView(line + start, end - start);
+
+	// The length of the body
+	if (h.name.equalsNoCase("content-length"))
+	{
+		_contentLength = 0;
+		for (size_t i = 0; i < h.value.len; ++i)
+		{
+			if (h.value.data[i] < '0' || h.value.data[i] > '9' || _contentLength > SOHTTPPARSER_BUFFER_SIZE)
+				return FAILED;
+			_contentLength = _contentLength * 10 + (h.value.data[i] - '0');
+		}
+	}
+
+	// The body is framed by a transfer coding, which is not implemented: the request is refused
+	// Ignoring it would take the body for the next request, whatever the Content-Length says
+	if (h.name.equalsNoCase("transfer-encoding"))
+		return REFUSED;
+
+	// The header is correct
+	return HEADERS;
+}
+
+/// \}
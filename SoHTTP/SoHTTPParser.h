@@ -0,0 +1,207 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// License LGPL
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+/// The size of the buffer in which a request (first line, headers and body) is parsed
+#define SOHTTPPARSER_BUFFER_SIZE	8192
+
+/// The maximum number of headers of a request
+#define SOHTTPPARSER_MAX_HEADERS	32
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// A view on characters that are owned by someone else (e.g. the buffer of a SoHTTPParser).
+/// It is not null terminated and is only valid as long as the characters it views are.
+struct SoStringView
+{
+	/// Constructor
+	/// Creates an empty view.
+	SoStringView() : data(0), len(0) {}
+
+	/// Constructor
+	/// \param[in]	data	The first character.
+	/// \param[in]	len		The number of characters.
+	SoStringView(const char * data, size_t len) : data(data), len(len) {}
+
+	/// Compares the view to a null terminated string, case sensitively.
+	/// \param[in]	str		The string.
+	/// \return Wether the view has the same characters as the string.
+	bool			operator==(const char * str) const;
+
+	/// Compares the view to a null terminated string, ignoring the case of ASCII letters.
+	/// \param[in]	str		The string.
+	/// \return Wether the view has the same characters as the string, ignoring the case.
+	bool			equalsNoCase(const char * str) const;
+
+	/// Copies the viewed characters in a new string.
+	/// \return The string.
+	std::string		str() const { return std::string(data, len); }
+
+	/// The first character
+	const char *	data;
+
+	/// The number of characters
+	size_t			len;
+};
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Resumable HTTP request parser.
+/// The received data is appended to a fixed buffer, in which the request is parsed in place as it arrives:
+/// each byte is examined once, whatever the number of calls it took to receive the request, and nothing is allocated.
+/// The method, target, version, headers and body are returned as views into the buffer.
+/// The body is delimited by its Content-Length and may contain any byte, including null characters.
+/// A body framed by a Transfer-Encoding (e.g. chunked) is not supported: the request is refused as UNSUPPORTED
+/// rather than being read as a request without body, which would parse the body as the next request.
+/// The bytes received after a complete request are kept, and parsed as the next request after reset.
+class SoHTTPParser
+{
+public:
+	/// The result of a parsing
+	enum Status
+	{
+		/// The request is not complete yet: more data is needed
+		NEED_MORE,
+
+		/// The request is complete
+		COMPLETE,
+
+		/// The request is malformed, or does not fit in the buffer
+		INVALID,
+
+		/// The request is well formed but uses a Transfer-Encoding, which the parser does not implement
+		UNSUPPORTED
+	};
+
+	/// A header of the request
+	struct Header
+	{
+		/// The name of the header, as sent by the client
+		SoStringView	name;
+
+		/// The value of the header, without leading and trailing spaces
+		SoStringView	value;
+	};
+
+	/// Constructor
+	SoHTTPParser();
+
+	/// Appends received data to the buffer and parses it.
+	/// \param[in]	data	The received data.
+	/// \param[in]	len		The number of bytes received.
+	/// \return The parsing status.
+	Status			feed(const char * data, size_t len);
+
+	/// Parses the data already in the buffer.
+	/// Used after reset to parse a request that was received with the previous one.
+	/// \return The parsing status.
+	Status			parse();
+
+	/// Forgets the parsed request, keeping the bytes that were received after it.
+	/// Every view on the previous request becomes invalid.
+	void			reset();
+
+	/// Gets the method of the request
+	/// \return the method
+	SoStringView	Method() const { return _method; }
+
+	/// Gets the target of the request: the resource with its get string
+	/// \return the target
+	SoStringView	Target() const { return _target; }
+
+	/// Gets the HTTP version of the request, without the "HTTP/" prefix
+	/// \return the version
+	SoStringView	Version() const { return _version; }
+
+	/// Gets the number of headers of the request
+	/// \return the number of headers
+	int				HeaderCount() const { return _nbHeaders; }
+
+	/// Gets a header of the request
+	/// \param[in]	i	The index of the header.
+	/// \return the header
+	const Header &	getHeader(int i) const { return _headers[i]; }
+
+	/// Finds a header by its name, ignoring its case.
+	/// \param[in]	name	The name of the header, in lower case.
+	/// \param[out]	value	Receives the value of the header, if it is found.
+	/// \return Wether the header has been found.
+	bool			findHeader(const char * name, SoStringView & value) const;
+
+	/// Gets the body of the request
+	/// \return the body
+	SoStringView	Body() const { return SoStringView(_buf + _bodyStart, _contentLength); }
+
+	/// Gets the number of bytes of the buffer that have not been parsed yet.
+	/// Once a request is complete, these are the bytes of the next request.
+	/// \return the number of bytes
+	size_t			Pending() const { return _size - _end; }
+
+	/// Gets the bytes of the buffer that have not been parsed yet.
+	/// \return the view on the bytes
+	SoStringView	Rest() const { return SoStringView(_buf + _end, _size - _end); }
+
+private:
+	/// The parsing states
+	enum State { REQUEST_LINE, HEADERS, BODY, DONE, FAILED, REFUSED };
+
+	/// Parses the first line of the request.
+	/// \param[in]	line	The first character of the line.
+	/// \param[in]	len		The length of the line, without its end of line characters.
+	/// \return Wether the line is correct.
+	bool			_parseRequestLine(const char * line, size_t len);
+
+	/// Parses a header line.
+	/// \param[in]	line	The first character of the line.
+	/// \param[in]	len		The length of the line, without its end of line characters.
+	/// \return The next parsing state: HEADERS if the line is correct, FAILED if it is malformed, REFUSED if it is a Transfer-Encoding.
+	State			_parseHeader(const char * line, size_t len);
+
+	/// The current parsing state
+	State			_state;
+
+	/// The buffer in which the requests are received and parsed
+	char			_buf[SOHTTPPARSER_BUFFER_SIZE];
+
+	/// The number of bytes in the buffer
+	size_t			_size;
+
+	/// The position of the first byte that has not been parsed yet: the start of the current line
+	size_t			_pos;
+
+	/// The position from which to look for the end of the current line, so that no byte is examined twice
+	size_t			_scan;
+
+	/// The end of the current request, which is the start of the next one
+	size_t			_end;
+
+	/// The position of the first byte of the body
+	size_t			_bodyStart;
+
+	/// The length of the body, given by the Content-Length header
+	size_t			_contentLength;
+
+	/// The method of the request
+	SoStringView	_method;
+
+	/// The target of the request
+	SoStringView	_target;
+
+	/// The HTTP version of the request
+	SoStringView	_version;
+
+	/// The headers of the request
+	Header			_headers[SOHTTPPARSER_MAX_HEADERS];
+
+	/// The number of headers of the request
+	int				_nbHeaders;
+};
+
+/// \}
@@ -0,0 +1,309 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+/// Standalone benchmark of SoHTTPParser against the parser it replaced, not part of the library.
+/// Each request is fed in segments of several sizes, as it would be received: whole, in 64 bytes segments, and byte by byte.
+/// SoHTTPParser is measured parsing only, then parsing and copying the request into strings as SoHTTPRequestHandler does.
+/// The previous parser is copied here as it was: it copies every line of the buffer and builds the request strings as it goes.
+/// Before timing, the two parsers are checked to read the same method, target, version, headers and body.
+/// Build it as a console program, from the SoHTTP directory:
+///     cl /EHsc /O2 SoHTTPParserBench.cpp SoHTTPParser.cpp
+/// Usage: SoHTTPParserBench [iterations]
+
+#include "SoHTTPParser.h"
+
+#include <ctype.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+
+/// The request parser of SoHTTPRequestHandler before SoHTTPParser, kept as the reference of the benchmark.
+class OldParser
+{
+public:
+	/// Constructor
+	OldParser() : _state(PARSING_FISRT_LINE), _contentLength(0) {}
+
+	/// Adds received data to the buffer and parses it.
+	/// \param[in]	data	The received data.
+	/// \param[in]	len		The number of bytes received.
+	/// \return -1 if the request is incorrect, 1 if it is complete, 0 if more data is needed.
+	int				feed(const char * data, size_t len)
+	{
+		_buffer.append(data, len);
+		if (!_parse())
+			return -1;
+		return _state == DISPATCHED ? 1 : 0;
+	}
+
+	/// The method
+	std::string							method;
+
+	/// The resource
+	std::string							resource;
+
+	/// The HTTP version
+	std::string							version;
+
+	/// The headers, whose names are in lower case
+	std::map<std::string, std::string>	headers;
+
+	/// The body
+	std::string							body;
+
+private:
+	/// Parses the buffer.
+	/// \return Wether the request is correct.
+	bool			_parse()
+	{
+		if (_state != READING_BODY)
+		{
+			size_t pos;
+			while (_state != READING_BODY && (pos = _buffer.find_first_of("\n")) != std::string::npos)
+			{
+				std::string line = _buffer.substr(0, pos);
+				_buffer = _buffer.substr(pos + 1);
+				if (!line.empty() && line[line.length() - 1] == '\r')
+					line = line.substr(0, line.length() - 1);
+				if (_state == PARSING_FISRT_LINE)
+				{
+					size_t i = 0;
+					for (; i < line.length() && isalpha((unsigned char)line[i]); ++i)
+						method += line[i];
+					if (i >= line.length() || line[i] != ' ')
+						return false;
+					while (line[i] == ' ')
+						++i;
+					for (; i < line.length() && line[i] != ' '; ++i)
+						resource += line[i];
+					if (i >= line.length() || line[i] != ' ')
+						return false;
+					while (line[i] == ' ')
+						++i;
+					if (line.substr(i, 5) != "HTTP/")
+						return false;
+					i += 5;
+					for (; i < line.length() && line[i] != ' '; ++i)
+						version += line[i];
+					_state = PARSING_HEADERS;
+				}
+				else if (line.empty())
+					_state = READING_BODY;
+				else
+				{
+					size_t i = 0;
+					std::string headerName;
+					for (; i < line.length() && line[i] != ':'; ++i)
+						headerName += (char)tolower((unsigned char)line[i]);
+					if (i >= line.length() || line[i] != ':')
+						return false;
+					++i;
+					while (line[i] == ' ')
+						++i;
+					headers[headerName] = line.substr(i);
+				}
+			}
+		}
+		if (_state == READING_BODY)
+		{
+			if (_contentLength == 0 && headers.find("content-length") != headers.end())
+				_contentLength = atoi(headers["content-length"].c_str());
+			body += _buffer;
+			_buffer = "";
+			if (body.length() >= _contentLength)
+				_state = DISPATCHED;
+		}
+		return true;
+	}
+
+	/// The parsing state
+	enum { PARSING_FISRT_LINE, PARSING_HEADERS, READING_BODY, DISPATCHED } _state;
+
+	/// The buffer of characters to parse
+	std::string		_buffer;
+
+	/// The content length given in the headers
+	unsigned int	_contentLength;
+};
+
+/// The requests of the benchmark: what a browser sends for the interface, a button press, and a WebSocket opening
+static const char * requests[] =
+{
+	"GET /mfd/Left.png?format=jpeg&quality=80 HTTP/1.1\r\n"
+	"Host: 192.168.1.10:8080\r\n"
+	"Connection: keep-alive\r\n"
+	"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+	"Accept: image/avif,image/webp,image/apng,image/*,*/*;q=0.8\r\n"
+	"Referer: http://192.168.1.10:8080/mfd.html\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"Accept-Language: en-US,en;q=0.9,fr;q=0.8\r\n"
+	"If-None-Match: \"5f2a-1c3b\"\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n",
+
+	"POST /btn HTTP/1.1\r\n"
+	"Host: 192.168.1.10:8080\r\n"
+	"Content-Type: application/x-www-form-urlencoded\r\n"
+	"Content-Length: 22\r\n"
+	"\r\n"
+	"key=Left&btn=3&press=1",
+
+	"GET /cockpit HTTP/1.1\r\n"
+	"Host: 192.168.1.10:8080\r\n"
+	"Upgrade: websocket\r\n"
+	"Connection: Upgrade\r\n"
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	"Sec-WebSocket-Version: 13\r\n"
+	"Origin: http://192.168.1.10:8080\r\n"
+	"\r\n",
+};
+
+/// The number of requests of the benchmark
+static const int nbRequests = sizeof(requests) / sizeof(*requests);
+
+/// The sizes of the segments in which the requests are fed. 0 feeds a request at once.
+static const size_t segments[] = { 0, 64, 1 };
+
+/// Prevents the compiler from removing the parsings whose results are not used
+static volatile size_t sink = 0;
+
+/// Feeds a request to SoHTTPParser in segments.
+/// \param[in,out]	parser	The parser, reset after the request.
+/// \param[in]		req		The request.
+/// \param[in]		len		The length of the request.
+/// \param[in]		segment	The size of the segments, 0 for one segment.
+/// \param[in]		copy	Wether to copy the request into strings once it is complete, as SoHTTPRequestHandler does.
+/// \return Wether the request is complete.
+static bool feedNew(SoHTTPParser & parser, const char * req, size_t len, size_t segment, bool copy)
+{
+	SoHTTPParser::Status status = SoHTTPParser::NEED_MORE;
+	for (size_t pos = 0; pos < len; pos += segment ? segment : len)
+		status = parser.feed(req + pos, (segment && len - pos > segment) ? segment : len - pos);
+	if (status != SoHTTPParser::COMPLETE)
+		return false;
+	if (copy)
+	{
+		std::map<std::string, std::string> headers;
+		for (int i = 0; i < parser.HeaderCount(); ++i)
+		{
+			std::string name = parser.getHeader(i).name.str();
+			for (std::string::iterator c = name.begin(); c != name.end(); ++c)
+				*c = (char)tolower((unsigned char)*c);
+			headers[name] = parser.getHeader(i).value.str();
+		}
+		std::string body = parser.Body().str();
+		sink += parser.Method().str().length() + parser.Target().str().length() + parser.Version().str().length() + headers.size() + body.length();
+	}
+	else
+		sink += parser.HeaderCount() + parser.Body().len;
+	parser.reset();
+	return true;
+}
+
+/// Feeds a request to the previous parser in segments.
+/// \param[in]	req		The request.
+/// \param[in]	len		The length of the request.
+/// \param[in]	segment	The size of the segments, 0 for one segment.
+/// \return Wether the request is complete.
+static bool feedOld(const char * req, size_t len, size_t segment)
+{
+	// The previous handler parsed one request per connection
+	OldParser parser;
+	int status = 0;
+	for (size_t pos = 0; pos < len && status == 0; pos += segment ? segment : len)
+		status = parser.feed(req + pos, (segment && len - pos > segment) ? segment : len - pos);
+	sink += parser.headers.size() + parser.body.length();
+	return status == 1;
+}
+
+/// Checks that the two parsers read the same request.
+/// \param[in]	req		The request.
+/// \return Wether they agree.
+static bool check(const char * req)
+{
+	size_t len = strlen(req);
+	SoHTTPParser * parser = new SoHTTPParser;
+	OldParser old;
+	bool ok = parser->feed(req, len) == SoHTTPParser::COMPLETE && old.feed(req, len) == 1
+		&& parser->Method().str() == old.method && parser->Target().str() == old.resource
+		&& parser->Version().str() == old.version && parser->Body().str() == old.body
+		&& (size_t)parser->HeaderCount() == old.headers.size();
+	for (int i = 0; ok && i < parser->HeaderCount(); ++i)
+	{
+		std::string name = parser->getHeader(i).name.str();
+		for (std::string::iterator c = name.begin(); c != name.end(); ++c)
+			*c = (char)tolower((unsigned char)*c);
+		ok = old.headers[name] == parser->getHeader(i).value.str();
+	}
+	delete parser;
+	return ok;
+}
+
+int main(int argc, char ** argv)
+{
+	int iterations = (argc > 1) ? atoi(argv[1]) : 200000;
+	if (iterations <= 0)
+	{
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 2;
+	}
+
+	// The parsers must agree before being compared
+	for (int r = 0; r < nbRequests; ++r)
+		if (!check(requests[r]))
+		{
+			fprintf(stderr, "FAIL: the parsers disagree on request %d\n", r);
+			return 1;
+		}
+
+	// The lengths and the total size of the requests
+	size_t lens[nbRequests];
+	size_t bytes = 0;
+	for (int r = 0; r < nbRequests; ++r)
+		bytes += lens[r] = strlen(requests[r]);
+
+	// The new parser is reused from one request to the next, as on a kept alive connection
+	SoHTTPParser * parser = new SoHTTPParser;
+
+	printf("%-10s %16s %16s %16s\n", "segment", "old ns/req", "new ns/req", "new+copy ns/req");
+	for (size_t s = 0; s < sizeof(segments) / sizeof(*segments); ++s)
+	{
+		// Byte by byte parsing is slow with the previous parser: fewer iterations keep the run short
+		int n = segments[s] == 1 ? iterations / 10 : iterations;
+		if (n == 0)
+			n = 1;
+		double ns[3];
+		for (int p = 0; p < 3; ++p)
+		{
+			clock_t start = clock();
+			for (int i = 0; i < n; ++i)
+				for (int r = 0; r < nbRequests; ++r)
+					if (!(p == 0 ? feedOld(requests[r], lens[r], segments[s]) : feedNew(*parser, requests[r], lens[r], segments[s], p == 2)))
+					{
+						fprintf(stderr, "FAIL: request %d is incomplete\n", r);
+						return 1;
+					}
+			ns[p] = (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / ((double)n * nbRequests);
+		}
+
+		char name[16];
+		if (segments[s])
+			sprintf(name, "%u bytes", (unsigned int)segments[s]);
+		else
+			strcpy(name, "whole");
+		printf("%-10s %16.0f %16.0f %16.0f\n", name, ns[0], ns[1], ns[2]);
+	}
+	printf("%d requests of %u bytes on average\n", nbRequests, (unsigned int)(bytes / nbRequests));
+
+	delete parser;
+	return 0;
+}
+
+/// \}
@@ -0,0 +1,288 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#include "SoReactor.h"
+
+/// I/O thread start function.
+/// Just launch the _loop method on the given SoReactor object pointer.
+DWORD WINAPI reactorLoop(LPVOID lpParameter)
+{
+	// Launch _loop
+	((SoReactor*)lpParameter)->_loop();
+
+	// Thread return value
+	return 0;
+}
+
+
+SoReactor::SoReactor() : _iocp(0), _stopping(false)
+{
+	// Create the mutex
+	_mutex = CreateMutex(NULL, FALSE, NULL);
+}
+
+
+SoReactor::~SoReactor()
+{
+	// Destroy the mutex
+	CloseHandle(_mutex);
+}
+
+
+bool	SoReactor::start(unsigned int nbThreads)
+{
+	// Create the I/O completion port, allowing nbThreads threads to run concurrently
+	_iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, nbThreads);
+	if (!_iocp)
+		return false;
+
+	_stopping = false;
+
+	// Create the I/O threads
+	for (unsigned int i = 0; i < nbThreads; ++i)
+		_threads.push_back(CreateThread(NULL, 0, reactorLoop, (LPVOID*)this, 0, NULL));
+
+	// The starting of the reactor has succeeded
+	return true;
+}
+
+
+void	SoReactor::stop()
+{
+	// Get all the opened connections, holding a reference on each of them so they are not destroyed while closing them
+	WaitForSingleObject(_mutex, INFINITE);
+	std::vector<SoConnection*> connections(_connections.begin(), _connections.end());
+	for (std::vector<SoConnection*>::iterator i = connections.begin(); i != connections.end(); ++i)
+		(*i)->AddRef();
+	ReleaseMutex(_mutex);
+
+	// Close all the connections
+	for (std::vector<SoConnection*>::iterator i = connections.begin(); i != connections.end(); ++i)
+	{
+		WaitForSingleObject((*i)->_mutex, INFINITE);
+		(*i)->_close();
+		ReleaseMutex((*i)->_mutex);
+		(*i)->Release();
+	}
+
+	// Ask all I/O threads to stop
+	// A completion packet with no connection and no overlapped structure is a stop order when _stopping is set
+	_stopping = true;
+	for (size_t i = 0; i < _threads.size(); ++i)
+		PostQueuedCompletionStatus(_iocp, 0, 0, NULL);
+
+	// Wait for the I/O threads to end
+	// The connections that still had operations pending are leaked, as they were with the thread that was terminated before
+	if (!_threads.empty())
+		WaitForMultipleObjects((DWORD)_threads.size(), &_threads[0], TRUE, 5000);
+	for (std::vector<HANDLE>::iterator i = _threads.begin(); i != _threads.end(); ++i)
+		CloseHandle(*i);
+	_threads.clear();
+
+	// Destroy the I/O completion port
+	CloseHandle(_iocp);
+	_iocp = 0;
+
+	// Forget the timers
+	WaitForSingleObject(_mutex, INFINITE);
+	_timers.clear();
+	ReleaseMutex(_mutex);
+}
+
+
+bool	SoReactor::add(SOCKET socket, SoConnectionHandler * handler)
+{
+	// Create the connection
+	SoConnection * connection = new SoConnection(*this, socket, handler);
+
+	// Associate the socket to the I/O completion port, using the connection as completion key
+	if (!CreateIoCompletionPort((HANDLE)socket, _iocp, (ULONG_PTR)connection, 0))
+	{
+		// The connection takes the ownership of the socket, so the socket is closed with it
+		connection->close();
+		return false;
+	}
+
+	// Register the connection
+	WaitForSingleObject(_mutex, INFINITE);
+	_connections.insert(connection);
+	ReleaseMutex(_mutex);
+
+	// Inform the handler, then start receiving data, holding a reference so that the connection is not destroyed while its mutex is held
+	connection->AddRef();
+	WaitForSingleObject(connection->_mutex, INFINITE);
+	if (!connection->_closed)
+	{
+		connection->_handler->onOpen(*connection);
+		connection->_endCallback();
+	}
+	connection->_postRecv();
+	ReleaseMutex(connection->_mutex);
+	connection->Release();
+
+	// The connection has been added
+	return true;
+}
+
+
+size_t	SoReactor::Connections()
+{
+	WaitForSingleObject(_mutex, INFINITE);
+	size_t ret = _connections.size();
+	ReleaseMutex(_mutex);
+
+	return ret;
+}
+
+
+void	SoReactor::_loop()
+{
+	// Loop on the I/O completion port
+	for (;;)
+	{
+		DWORD bytes = 0;
+		ULONG_PTR key = 0;
+		LPOVERLAPPED ov = NULL;
+
+		// Wait for an operation to complete, or for the next timer to expire
+		BOOL ok = GetQueuedCompletionStatus(_iocp, &bytes, &key, &ov, _nextTimeout());
+
+		// If there is no overlapped structure, this is either a timeout, a stop order or a timer update
+		if (!ov)
+		{
+			// If the I/O completion port has failed for another reason than a timeout, stop the thread
+			if (!ok && GetLastError() != WAIT_TIMEOUT)
+				break ;
+
+			// If the reactor is stopping, stop the thread
+			if (_stopping)
+				break ;
+		}
+		// An operation of a connection has completed
+		else
+			((SoConnection*)key)->_onCompletion((SoOverlapped*)ov, bytes, ok == TRUE);
+
+		// Call the connections whose timer has expired
+		_fireTimers();
+	}
+}
+
+
+DWORD	SoReactor::_nextTimeout()
+{
+	// The time to wait, infinite if there are no timers
+	DWORD timeout = INFINITE;
+
+	// The current time
+	DWORD now = GetTickCount();
+
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// For each armed timer, keep the smallest time to wait
+	// The difference is casted to a signed integer so that the tick count wrapping is handled
+	for (TimerMap::iterator i = _timers.begin(); i != _timers.end(); ++i)
+	{
+		LONG left = (LONG)(i->second - now);
+		if (left <= 0)
+		{
+			timeout = 0;
+			break ;
+		}
+		if ((DWORD)left < timeout)
+			timeout = (DWORD)left;
+	}
+
+	ReleaseMutex(_mutex);
+
+	return timeout;
+}
+
+
+void	SoReactor::_fireTimers()
+{
+	// The connections whose timer has expired
+	std::vector<SoConnection*> expired;
+
+	// The current time
+	DWORD now = GetTickCount();
+
+	// Remove the expired timers, keeping their reference to the connection
+	WaitForSingleObject(_mutex, INFINITE);
+	for (TimerMap::iterator i = _timers.begin(); i != _timers.end(); )
+		if ((LONG)(i->second - now) <= 0)
+		{
+			expired.push_back(i->first);
+			_timers.erase(i++);
+		}
+		else
+			++i;
+	ReleaseMutex(_mutex);
+
+	// Call each expired connection and release the reference that was held by the timer
+	for (std::vector<SoConnection*>::iterator i = expired.begin(); i != expired.end(); ++i)
+	{
+		(*i)->_onTimer();
+		(*i)->Release();
+	}
+}
+
+
+void	SoReactor::_setTimer(SoConnection * connection, DWORD ms)
+{
+	// Wether a reference on the connection has to be released (when the timer is cancelled)
+	bool release = false;
+
+	WaitForSingleObject(_mutex, INFINITE);
+
+	// Find the current timer of the connection
+	TimerMap::iterator i = _timers.find(connection);
+
+	// If the timer must be cancelled, remove it
+	if (ms == 0)
+	{
+		if (i != _timers.end())
+		{
+			_timers.erase(i);
+			release = true;
+		}
+	}
+	// The timer must be (re)armed
+	else
+	{
+		// The timer holds a reference on the connection
+		if (i == _timers.end())
+			connection->AddRef();
+		_timers[connection] = GetTickCount() + ms;
+	}
+
+	ReleaseMutex(_mutex);
+
+	// Wake an I/O thread so that it takes the new timer into account when computing its time to wait
+	if (ms != 0)
+		PostQueuedCompletionStatus(_iocp, 0, 0, NULL);
+
+	// Release the reference held by the cancelled timer
+	if (release)
+		connection->Release();
+}
+
+
+void	SoReactor::_postWake(SoConnection * connection)
+{
+	// Post a completion packet with the wake overlapped structure of the connection
+	PostQueuedCompletionStatus(_iocp, 0, (ULONG_PTR)connection, &connection->_wakeOv);
+}
+
+
+void	SoReactor::_remove(SoConnection * connection)
+{
+	WaitForSingleObject(_mutex, INFINITE);
+	_connections.erase(connection);
+	ReleaseMutex(_mutex);
+}
+
+/// \}
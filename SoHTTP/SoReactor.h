@@ -0,0 +1,118 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// License LGPL
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#pragma once
+
+#include "SoConnection.h"
+#include "SoCounter.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Event driven connection engine.
+/// Multiplexes all connections on a small fixed set of I/O threads instead of using one thread per connection.
+/// Each connection gives its events (data received, data sent, timer, wake) to its SoConnectionHandler.
+/// The Windows implementation sits on an I/O completion port.
+/// The engine only relies on the completion of receive, send and posted (wake) operations,
+/// so another backend (e.g. epoll) only needs to provide those three events.
+class SoReactor
+{
+public:
+	/// Constructor
+	SoReactor();
+
+	/// Destructor
+	~SoReactor();
+
+	/// Starts the I/O threads.
+	/// \param[in]	nbThreads	The number of I/O threads.
+	/// \return Wether the starting has succeeded or not.
+	bool			start(unsigned int nbThreads);
+
+	/// Closes all the connections and stops the I/O threads.
+	void			stop();
+
+	/// Adds a connected socket to the reactor.
+	/// The reactor starts receiving data on the socket immediately.
+	/// \param[in]	socket	The connected socket.
+	/// \param[in]	handler	The handler of the connection events. The connection takes its ownership.
+	/// \return Wether the socket has been added. If not, the handler has been destroyed and the socket closed.
+	bool			add(SOCKET socket, SoConnectionHandler * handler);
+
+	/// Gets the number of opened connections.
+	/// \return the number of connections
+	size_t			Connections();
+
+	/// Gets the number of bytes sent on all the connections since the reactor has been created.
+	/// Is counted without lock by the I/O threads.
+	/// \return the number of bytes sent
+	LONGLONG		BytesSent() const { return _bytesSent.Value(); }
+
+	/// Gets the number of bytes received on all the connections since the reactor has been created.
+	/// Is counted without lock by the I/O threads.
+	/// \return the number of bytes received
+	LONGLONG		BytesReceived() const { return _bytesReceived.Value(); }
+
+private:
+	/// The I/O loop of each I/O thread.
+	void			_loop();
+
+	/// Gets the time to wait until the next timer expires.
+	/// \return The time to wait in milliseconds, or INFINITE if there is no timer.
+	DWORD			_nextTimeout();
+
+	/// Calls the connections whose timer has expired.
+	void			_fireTimers();
+
+	/// Sets or cancels the timer of a connection.
+	/// \param[in]	connection	The connection.
+	/// \param[in]	ms			The time to wait, in milliseconds. 0 cancels the timer.
+	void			_setTimer(SoConnection * connection, DWORD ms);
+
+	/// Posts the wake operation of a connection.
+	/// \param[in]	connection	The connection.
+	void			_postWake(SoConnection * connection);
+
+	/// Removes a closed connection from the list of connections.
+	/// \param[in]	connection	The connection.
+	void			_remove(SoConnection * connection);
+
+	/// The I/O completion port.
+	HANDLE						_iocp;
+
+	/// The I/O threads.
+	std::vector<HANDLE>			_threads;
+
+	/// Wether the reactor is stopping.
+	volatile bool				_stopping;
+
+	/// The mutex to access _connections and _timers.
+	HANDLE						_mutex;
+
+	/// All opened connections, used to close them when stopping.
+	std::set<SoConnection*>		_connections;
+
+	typedef std::map<SoConnection*, DWORD> TimerMap;
+
+	/// The armed timers: each armed connection with the tick count at which its timer expires.
+	/// The reactor holds a reference on each armed connection.
+	TimerMap					_timers;
+
+	/// The number of bytes sent by the connections
+	SoCounter					_bytesSent;
+
+	/// The number of bytes received by the connections
+	SoCounter					_bytesReceived;
+
+	friend class SoConnection;
+	friend DWORD WINAPI reactorLoop(LPVOID lpParameter);
+};
+
+/// \}
@@ -0,0 +1,416 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#include "SoWebSocket.h"
+
+#include <Wincrypt.h>
+
+/// The GUID appended to the Sec-WebSocket-Key to compute the Sec-WebSocket-Accept value
+#define SOWEBSOCKET_GUID	"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/// Checks that a text is valid UTF-8, as required for the WebSocket text messages.
+/// Overlong encodings, surrogates and code points above U+10FFFF are rejected.
+/// \param[in]	data	The text.
+/// \param[in]	len		The number of bytes of the text.
+/// \return Wether the text is valid UTF-8.
+static bool isUtf8(const char * data, size_t len)
+{
+	const unsigned char * p = (const unsigned char *)data;
+	const unsigned char * end = p + len;
+	while (p < end)
+	{
+		// ASCII
+		if (*p < 0x80)
+		{
+			++p;
+			continue ;
+		}
+
+		// The number of continuation bytes and the smallest code point of the sequence
+		int count;
+		unsigned int cp;
+		unsigned int min;
+		if ((*p & 0xE0) == 0xC0)		{ count = 1; cp = *p & 0x1F; min = 0x80; }
+		else if ((*p & 0xF0) == 0xE0)	{ count = 2; cp = *p & 0x0F; min = 0x800; }
+		else if ((*p & 0xF8) == 0xF0)	{ count = 3; cp = *p & 0x07; min = 0x10000; }
+		else
+			return false;
+
+		// The continuation bytes
+		if (end - p <= count)
+			return false;
+		for (int i = 1; i <= count; ++i)
+		{
+			if ((p[i] & 0xC0) != 0x80)
+				return false;
+			cp = (cp << 6) | (p[i] & 0x3F);
+		}
+
+		// The code point
+		if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+			return false;
+
+		p += count + 1;
+	}
+	return true;
+}
+
+
+SoWebSocketParser::SoWebSocketParser(size_t maxSize) :
+	_maxSize(maxSize), _pos(0), _messageOpcode(CONTINUATION), _messageDone(false), _failure(NEED_MORE), _opcode(0), _data(0), _size(0)
+{
+}
+
+
+void	SoWebSocketParser::feed(const char * data, size_t len)
+{
+	// Forget the bytes that have already been parsed, when there are enough of them for the copy to be worth it
+	if (_pos == _buf.length())
+	{
+		_buf.clear();
+		_pos = 0;
+	}
+	else if (_pos >= SOWEBSOCKET_COMPACT_SIZE)
+	{
+		_buf.erase(0, _pos);
+		_pos = 0;
+	}
+
+	// Append the received bytes
+	_buf.append(data, len);
+}
+
+
+SoWebSocketParser::Status	SoWebSocketParser::next()
+{
+	// A failed parsing cannot be resumed
+	if (_failure != NEED_MORE)
+		return _failure;
+
+	// Forget the message that has been returned
+	if (_messageDone)
+	{
+		_message.clear();
+		_messageDone = false;
+	}
+
+	// Parse the complete frames, until a message is complete
+	for (;;)
+	{
+		const unsigned char * p = (const unsigned char *)_buf.data() + _pos;
+		size_t avail = _buf.length() - _pos;
+
+		// The first two bytes: FIN, RSV1-3, opcode, MASK and the first length byte
+		if (avail < 2)
+			return NEED_MORE;
+		bool fin = (p[0] & 0x80) != 0;
+		int opcode = p[0] & 0x0F;
+		bool control = (opcode & 0x08) != 0;
+		unsigned __int64 len = p[1] & 0x7F;
+		size_t head = 2;
+
+		// No extension is negotiated, so the RSV bits must be 0, and every client frame must be masked
+		if ((p[0] & 0x70) != 0 || (p[1] & 0x80) == 0)
+			return _failure = INVALID;
+
+		// The extended length, in network byte order
+		if (len == 126)
+		{
+			if (avail < 4)
+				return NEED_MORE;
+			len = ((unsigned int)p[2] << 8) | p[3];
+			head = 4;
+		}
+		else if (len == 127)
+		{
+			if (avail < 10)
+				return NEED_MORE;
+			len = 0;
+			for (int i = 2; i < 10; ++i)
+				len = (len << 8) | p[i];
+			head = 10;
+		}
+
+		// A control frame cannot be fragmented and has at most 125 bytes
+		if (control)
+		{
+			if (!fin || len > 125 || (opcode != CLOSE && opcode != PING && opcode != PONG))
+				return _failure = INVALID;
+		}
+		// A data frame either starts a message, when no message is being reassembled, or continues it
+		else
+		{
+			if (opcode != CONTINUATION && opcode != TEXT && opcode != BINARY)
+				return _failure = INVALID;
+			if ((opcode == CONTINUATION) != (_messageOpcode != CONTINUATION))
+				return _failure = INVALID;
+			if (len > _maxSize || _message.length() + len > _maxSize)
+				return _failure = TOO_BIG;
+		}
+
+		// Wait for the whole frame: its masking key and its payload
+		if (avail < head + 4 + len)
+			return NEED_MORE;
+		const unsigned char * mask = p + head;
+		const unsigned char * payload = mask + 4;
+
+		// Unmask the payload into the control data or at the end of the message
+		std::string & dest = control ? _control : _message;
+		size_t start = control ? 0 : _message.length();
+		dest.resize(start + (size_t)len);
+		for (size_t i = 0; i < (size_t)len; ++i)
+			dest[start + i] = (char)(payload[i] ^ mask[i & 3]);
+		_pos += head + 4 + (size_t)len;
+
+		// A control frame is returned right away
+		if (control)
+		{
+			_opcode = opcode;
+			_data = _control.data();
+			_size = _control.length();
+			return MESSAGE;
+		}
+
+		// The first frame of a message gives its opcode
+		if (opcode != CONTINUATION)
+			_messageOpcode = opcode;
+
+		// The last frame of a message completes it
+		if (fin)
+		{
+			_opcode = _messageOpcode;
+			_data = _message.data();
+			_size = _message.length();
+			_messageOpcode = CONTINUATION;
+			_messageDone = true;
+			return MESSAGE;
+		}
+	}
+}
+
+
+SoWebSocketHandler::SoWebSocketHandler(size_t maxSize) : _parser(maxSize), _closing(false)
+{
+}
+
+
+bool	SoWebSocketHandler::onReceive(SoConnection & connection, const char * data, int len)
+{
+	// Add the received data to the parser
+	_parser.feed(data, (size_t)len);
+
+	// Handle every complete message, until the close handshake starts
+	while (!_closing)
+	{
+		SoWebSocketParser::Status status = _parser.next();
+
+		// Wait for more data
+		if (status == SoWebSocketParser::NEED_MORE)
+			break ;
+
+		// The client does not respect the protocol: 1002 (protocol error)
+		if (status == SoWebSocketParser::INVALID)
+			close(connection, 1002);
+
+		// The message is too big: 1009 (message too big)
+		else if (status == SoWebSocketParser::TOO_BIG)
+			close(connection, 1009);
+
+		else switch (_parser.Opcode())
+		{
+		case SoWebSocketParser::TEXT:
+			// A text must be valid UTF-8: 1007 (invalid data)
+			if (!isUtf8(_parser.Data(), _parser.Size()))
+				close(connection, 1007);
+			else
+				onMessage(connection, SoWebSocketParser::TEXT, _parser.Data(), _parser.Size());
+			break ;
+
+		case SoWebSocketParser::BINARY:
+			onMessage(connection, SoWebSocketParser::BINARY, _parser.Data(), _parser.Size());
+			break ;
+
+		case SoWebSocketParser::PING:
+			// Answer with the same data
+			_sendFrame(connection, SoWebSocketParser::PONG, _parser.Data(), _parser.Size());
+			break ;
+
+		case SoWebSocketParser::PONG:
+			// Unsolicited pongs are ignored
+			break ;
+
+		case SoWebSocketParser::CLOSE:
+			{
+				// The status code, if any, must be a valid one, followed by a UTF-8 reason
+				const unsigned char * payload = (const unsigned char *)_parser.Data();
+				unsigned short code = 1000;
+				if (_parser.Size() == 1)
+					code = 1002;
+				else if (_parser.Size() >= 2)
+				{
+					code = (unsigned short)((payload[0] << 8) | payload[1]);
+					if (code < 1000 || (code > 1003 && code < 1007) || (code > 1011 && code < 3000) || code > 4999)
+						code = 1002;
+					else if (!isUtf8(_parser.Data() + 2, _parser.Size() - 2))
+						code = 1007;
+				}
+
+				// Answer the close handshake, with the code of the client if it is valid
+				close(connection, code);
+			}
+			break ;
+		}
+	}
+
+	// The connection is closed by close, once the close frame has been sent
+	return true;
+}
+
+
+void	SoWebSocketHandler::sendText(SoConnection & connection, const char * data, size_t len)
+{
+	_sendFrame(connection, SoWebSocketParser::TEXT, data, len);
+}
+
+
+void	SoWebSocketHandler::sendBinary(SoConnection & connection, const char * data, size_t len)
+{
+	_sendFrame(connection, SoWebSocketParser::BINARY, data, len);
+}
+
+
+bool	SoWebSocketHandler::sendBinary(SoConnection & connection, SoBuffer * const * parts, int count)
+{
+	// Nothing can be sent once the close frame has been sent
+	if (_closing)
+		return false;
+
+	// The header and the parts must be sent in one vectored write: a truncated message would break the framing of the WebSocket
+	if (count < 0 || count + 1 > SOCONNECTION_SEND_GATHER)
+		return false;
+
+	// The size of the message
+	size_t len = 0;
+	for (int i = 0; i < count; ++i)
+		len += parts[i]->Size();
+
+	// Send the frame header and the parts together
+	SoBuffer * buffers[SOCONNECTION_SEND_GATHER];
+	buffers[0] = CreateFrameHeader(SoWebSocketParser::BINARY, len);
+	for (int i = 0; i < count; ++i)
+		buffers[i + 1] = parts[i];
+	connection.send(buffers, count + 1);
+	buffers[0]->Release();
+	return true;
+}
+
+
+void	SoWebSocketHandler::close(SoConnection & connection, unsigned short code)
+{
+	// The close frame is only sent once
+	if (_closing)
+		return ;
+
+	// Send the close frame with its status code
+	char payload[2] = { (char)(code >> 8), (char)(code & 0xFF) };
+	_sendFrame(connection, SoWebSocketParser::CLOSE, payload, 2);
+	_closing = true;
+
+	// Close the connection once the close frame has been sent
+	connection.close();
+}
+
+
+SoBuffer *	SoWebSocketHandler::CreateFrameHeader(int opcode, size_t len)
+{
+	// FIN and the opcode, then the length on 1, 3 or 9 bytes, in network byte order
+	unsigned char head[10];
+	size_t size;
+	head[0] = (unsigned char)(0x80 | opcode);
+	if (len < 126)
+	{
+		head[1] = (unsigned char)len;
+		size = 2;
+	}
+	else if (len <= 0xFFFF)
+	{
+		head[1] = 126;
+		head[2] = (unsigned char)(len >> 8);
+		head[3] = (unsigned char)len;
+		size = 4;
+	}
+	else
+	{
+		head[1] = 127;
+		unsigned __int64 len64 = len;
+		for (int i = 9; i >= 2; --i, len64 >>= 8)
+			head[i] = (unsigned char)len64;
+		size = 10;
+	}
+	return SoBuffer::Create((const char *)head, size);
+}
+
+
+std::string	SoWebSocketHandler::AcceptKey(const std::string & key)
+{
+	// The string to hash
+	std::string str = key + SOWEBSOCKET_GUID;
+
+	// Getting a windows cryptography context
+	HCRYPTPROV hProv = 0;
+	if (!CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+		return "";
+
+	// Hashing the string with a windows SHA-1 Hash object
+	BYTE hash[20];
+	DWORD hashLen = 20;
+	HCRYPTHASH hHash = 0;
+	bool ok = CryptCreateHash(hProv, CALG_SHA1, 0, 0, &hHash)
+		&& CryptHashData(hHash, (const BYTE *)str.data(), (DWORD)str.length(), 0)
+		&& CryptGetHashParam(hHash, HP_HASHVAL, hash, &hashLen, 0);
+
+	// Destroying the Hash object and cryptographic context
+	if (hHash)
+		CryptDestroyHash(hHash);
+	CryptReleaseContext(hProv, 0);
+
+	if (!ok)
+		return "";
+
+	// Encoding the hash in base64
+	static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string accept;
+	for (int i = 0; i < 20; i += 3)
+	{
+		unsigned int n = hash[i] << 16;
+		if (i + 1 < 20)
+			n |= hash[i + 1] << 8;
+		if (i + 2 < 20)
+			n |= hash[i + 2];
+		accept += b64[(n >> 18) & 0x3F];
+		accept += b64[(n >> 12) & 0x3F];
+		accept += (i + 1 < 20) ? b64[(n >> 6) & 0x3F] : '=';
+		accept += (i + 2 < 20) ? b64[n & 0x3F] : '=';
+	}
+	return accept;
+}
+
+
+void	SoWebSocketHandler::_sendFrame(SoConnection & connection, int opcode, const char * data, size_t len)
+{
+	// Nothing can be sent once the close frame has been sent
+	if (_closing)
+		return ;
+
+	// Send the header and the payload together
+	SoBuffer * parts[2] = { CreateFrameHeader(opcode, len), SoBuffer::Create(data, len) };
+	connection.send(parts, 2);
+	parts[0]->Release();
+	parts[1]->Release();
+}
+
+/// \}
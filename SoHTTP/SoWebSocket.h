@@ -0,0 +1,205 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// License LGPL
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+#pragma once
+
+#include "SoConnection.h"
+
+#include <string>
+
+/// The maximum size of a message received on a WebSocket, in bytes. A bigger message closes the WebSocket.
+#define SOWEBSOCKET_MAX_MESSAGE_SIZE	65536
+
+/// The number of parsed bytes after which the reception buffer is compacted
+#define SOWEBSOCKET_COMPACT_SIZE		4096
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Resumable parser of the frames sent by a WebSocket client (RFC 6455).
+/// The received data is appended to a buffer, from which the frames are parsed as they are complete.
+/// The frames of a fragmented message are unmasked and reassembled, and the message is returned once its last frame has been received.
+/// The control frames (close, ping, pong), which can come between two fragments, are returned as soon as they are received.
+class SoWebSocketParser
+{
+public:
+	/// The frame opcodes
+	enum Opcode
+	{
+		/// A frame that continues a fragmented message
+		CONTINUATION = 0x0,
+		/// A text message, in UTF-8
+		TEXT = 0x1,
+		/// A binary message
+		BINARY = 0x2,
+		/// A close frame, which may contain a status code and a reason
+		CLOSE = 0x8,
+		/// A ping frame, that must be answered with a pong frame having the same data
+		PING = 0x9,
+		/// A pong frame
+		PONG = 0xA
+	};
+
+	/// The result of a parsing
+	enum Status
+	{
+		/// No message is complete: more data is needed
+		NEED_MORE,
+		/// A message or a control frame is complete (see Opcode, Data and Size)
+		MESSAGE,
+		/// The client does not respect the protocol
+		INVALID,
+		/// The message is bigger than the maximum size
+		TOO_BIG
+	};
+
+	/// Constructor
+	/// \param[in]	maxSize		The maximum size of a message, in bytes.
+	SoWebSocketParser(size_t maxSize = SOWEBSOCKET_MAX_MESSAGE_SIZE);
+
+	/// Appends received data to the buffer.
+	/// \param[in]	data	The received data.
+	/// \param[in]	len		The number of bytes received.
+	void			feed(const char * data, size_t len);
+
+	/// Parses the next message from the buffer.
+	/// Must be called until it returns NEED_MORE, as the buffer can contain several messages.
+	/// The previous message becomes invalid.
+	/// \return The parsing status. Once INVALID or TOO_BIG has been returned, it is always returned.
+	Status			next();
+
+	/// Gets the opcode of the parsed message: TEXT, BINARY, CLOSE, PING or PONG
+	/// \return the opcode
+	int				Opcode() const { return _opcode; }
+
+	/// Gets the data of the parsed message, unmasked
+	/// \return the data
+	const char *	Data() const { return _data; }
+
+	/// Gets the number of bytes of the parsed message
+	/// \return the size
+	size_t			Size() const { return _size; }
+
+private:
+	/// The maximum size of a message
+	size_t			_maxSize;
+
+	/// The received bytes
+	std::string		_buf;
+
+	/// The position of the first byte of the buffer that has not been parsed yet
+	size_t			_pos;
+
+	/// The data message being reassembled from its fragments
+	std::string		_message;
+
+	/// The opcode of the data message being reassembled, CONTINUATION if there is none
+	int				_messageOpcode;
+
+	/// Wether _message has been returned and must be emptied before the next parsing
+	bool			_messageDone;
+
+	/// The data of the last control frame
+	std::string		_control;
+
+	/// The failure status, NEED_MORE if the parsing has not failed
+	Status			_failure;
+
+	/// The opcode of the parsed message
+	int				_opcode;
+
+	/// The data of the parsed message
+	const char *	_data;
+
+	/// The size of the parsed message
+	size_t			_size;
+};
+
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Connection handler of a WebSocket (RFC 6455), to be given to SoHTTP::acceptWebSocket.
+/// Parses the client frames, answers the pings, handles the close handshake and the protocol errors,
+/// and gives the text and binary messages to its subclass through onMessage.
+/// The send methods must be called from the handler callbacks, as any method of a handler.
+class SoWebSocketHandler : public SoConnectionHandler
+{
+public:
+	/// Constructor
+	/// \param[in]	maxSize		The maximum size of a received message, in bytes.
+	SoWebSocketHandler(size_t maxSize = SOWEBSOCKET_MAX_MESSAGE_SIZE);
+
+	/// Parses the received frames, and handles the messages.
+	virtual bool	onReceive(SoConnection & connection, const char * data, int len);
+
+	/// Sends a text message.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	data		The text, in UTF-8.
+	/// \param[in]	len			The number of bytes of the text.
+	void			sendText(SoConnection & connection, const char * data, size_t len);
+
+	/// Sends a text message.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	text		The text, in UTF-8.
+	void			sendText(SoConnection & connection, const std::string & text) { sendText(connection, text.data(), text.length()); }
+
+	/// Sends a binary message.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	data		The data.
+	/// \param[in]	len			The number of bytes of the data.
+	void			sendBinary(SoConnection & connection, const char * data, size_t len);
+
+	/// Sends a binary message made of several buffers, without copying them.
+	/// The frame header and the buffers are sent in one vectored write.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	parts		The buffers, in order.
+	/// \param[in]	count		The number of buffers. Must be less than SOCONNECTION_SEND_GATHER, as the header takes one of the gathered buffers.
+	/// \return Wether the message has been queued. False if the close handshake has started, or if there are too many buffers: nothing is sent then.
+	bool			sendBinary(SoConnection & connection, SoBuffer * const * parts, int count);
+
+	/// Starts the close handshake: sends a close frame and closes the connection once it has been sent.
+	/// Nothing can be sent after.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	code		The status code (e.g. 1000 for a normal closure).
+	void			close(SoConnection & connection, unsigned short code);
+
+	/// Informs wether the close handshake has started: nothing can be sent anymore.
+	/// \return Wether the WebSocket is closing.
+	bool			isClosing() const { return _closing; }
+
+	/// Builds the header of a frame sent by the server (which is never masked).
+	/// \param[in]	opcode	The opcode of the frame.
+	/// \param[in]	len		The number of bytes of the payload.
+	/// \return The header, on which the caller holds the only reference.
+	static SoBuffer *	CreateFrameHeader(int opcode, size_t len);
+
+	/// Computes the Sec-WebSocket-Accept value of a handshake.
+	/// \param[in]	key		The Sec-WebSocket-Key value sent by the client.
+	/// \return The Sec-WebSocket-Accept value: the base64 encoded SHA-1 of the key followed by the WebSocket GUID, or an empty string if the SHA-1 could not be computed.
+	static std::string	AcceptKey(const std::string & key);
+
+protected:
+	/// Method to be implemented by the subclass to handle the messages.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	opcode		SoWebSocketParser::TEXT or SoWebSocketParser::BINARY.
+	/// \param[in]	data		The message. A text message has been checked to be valid UTF-8.
+	/// \param[in]	len			The number of bytes of the message.
+	virtual void	onMessage(SoConnection & connection, int opcode, const char * data, size_t len) = 0;
+
+private:
+	/// Sends a frame, unless the close handshake has started.
+	/// \param[in]	connection	The connection of the WebSocket.
+	/// \param[in]	opcode		The opcode of the frame.
+	/// \param[in]	data		The payload.
+	/// \param[in]	len			The number of bytes of the payload.
+	void			_sendFrame(SoConnection & connection, int opcode, const char * data, size_t len);
+
+	/// The parser of the received frames
+	SoWebSocketParser	_parser;
+
+	/// Wether the close handshake has started
+	bool				_closing;
+};
+
+/// \}
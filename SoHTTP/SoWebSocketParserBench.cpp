@@ -0,0 +1,310 @@
+/// \file
+/// Salomon Brys HHTP Library Header
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+
+/// \addtogroup SoHHTP
+/// \{
+
+/// Standalone test and benchmark of SoWebSocketParser, not part of the library.
+/// The test feeds client frames (masked, fragmented, with control frames between the fragments, oversized or breaking the protocol)
+/// whole and byte by byte, and checks the messages and statuses returned by the parser.
+/// The benchmark then measures the parsing of masked binary messages of several sizes, received in TCP sized segments.
+/// Build it as a console program, from the SoHTTP directory:
+///     cl /EHsc /O2 SoWebSocketParserBench.cpp SoWebSocket.cpp SoConnection.cpp SoReactor.cpp SoBuffer.cpp SoCounter.cpp ws2_32.lib advapi32.lib
+/// Usage: SoWebSocketParserBench [megabytes per size]
+
+#include "SoWebSocket.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+/// The size of the segments in which the benchmark feeds the frames: a TCP segment on Ethernet
+#define BENCH_SEGMENT	1460
+
+/// The number of failed checks
+static int failures = 0;
+
+/// Builds a frame as sent by a client, masked.
+/// \param[in]	fin		Wether this is the last frame of the message.
+/// \param[in]	opcode	The opcode of the frame.
+/// \param[in]	payload	The unmasked payload.
+/// \param[in]	masked	Wether to mask the frame, as a client must.
+/// \return The frame.
+static std::string frame(bool fin, int opcode, const std::string & payload, bool masked = true)
+{
+	// FIN and the opcode, then the MASK bit and the length on 1, 3 or 9 bytes
+	std::string f;
+	f += (char)((fin ? 0x80 : 0) | opcode);
+	unsigned char maskBit = masked ? 0x80 : 0;
+	size_t len = payload.length();
+	if (len < 126)
+		f += (char)(maskBit | len);
+	else if (len <= 0xFFFF)
+	{
+		f += (char)(maskBit | 126);
+		f += (char)(len >> 8);
+		f += (char)len;
+	}
+	else
+	{
+		f += (char)(maskBit | 127);
+		for (int i = 7; i >= 0; --i)
+			f += (char)(i < 4 ? (len >> (i * 8)) : 0);
+	}
+
+	// The masking key, which changes with the length so that the unmasking is really checked, and the masked payload
+	if (!masked)
+		return f + payload;
+	unsigned char mask[4] = { 0x37, 0xFA, 0x21, (unsigned char)(0x3D + len) };
+	f.append((const char *)mask, 4);
+	for (size_t i = 0; i < len; ++i)
+		f += (char)(payload[i] ^ mask[i & 3]);
+	return f;
+}
+
+/// An expected result of the parser
+struct Expected
+{
+	/// The status
+	SoWebSocketParser::Status	status;
+
+	/// The opcode of the message, for MESSAGE
+	int							opcode;
+
+	/// The data of the message, for MESSAGE
+	std::string					data;
+};
+
+/// Builds an expected message.
+/// \param[in]	opcode	The opcode of the message.
+/// \param[in]	data	The data of the message.
+/// \return The expected result.
+static Expected message(int opcode, const std::string & data)
+{
+	Expected e = { SoWebSocketParser::MESSAGE, opcode, data };
+	return e;
+}
+
+/// Builds an expected failure.
+/// \param[in]	status	INVALID or TOO_BIG.
+/// \return The expected result.
+static Expected failure(SoWebSocketParser::Status status)
+{
+	Expected e = { status, 0, "" };
+	return e;
+}
+
+/// Feeds a stream of frames to a new parser, in segments, and checks the results.
+/// \param[in]	name		The name of the case.
+/// \param[in]	stream		The frames.
+/// \param[in]	expected	The expected results, in order. A failure ends the results.
+/// \param[in]	segment		The size of the segments.
+/// \param[in]	maxSize		The maximum size of a message.
+static void check(const char * name, const std::string & stream, const std::vector<Expected> & expected, size_t segment, size_t maxSize = 1024)
+{
+	SoWebSocketParser parser(maxSize);
+	size_t got = 0;
+	for (size_t pos = 0; pos < stream.length(); pos += segment)
+	{
+		parser.feed(stream.data() + pos, (stream.length() - pos > segment) ? segment : stream.length() - pos);
+
+		// Take all the results of the segment
+		for (;;)
+		{
+			SoWebSocketParser::Status status = parser.next();
+			if (status == SoWebSocketParser::NEED_MORE)
+				break ;
+			if (got >= expected.size())
+			{
+				printf("FAIL: %s (segments of %u): unexpected result %d\n", name, (unsigned int)segment, status);
+				++failures;
+				return ;
+			}
+			const Expected & e = expected[got++];
+			if (status != e.status || (status == SoWebSocketParser::MESSAGE && (parser.Opcode() != e.opcode || std::string(parser.Data(), parser.Size()) != e.data)))
+			{
+				printf("FAIL: %s (segments of %u): result %u differs\n", name, (unsigned int)segment, (unsigned int)got - 1);
+				++failures;
+				return ;
+			}
+
+			// A failure is returned forever
+			if (status != SoWebSocketParser::MESSAGE)
+			{
+				if (parser.next() != status)
+				{
+					printf("FAIL: %s (segments of %u): the failure is not kept\n", name, (unsigned int)segment);
+					++failures;
+				}
+				return ;
+			}
+		}
+	}
+	if (got != expected.size())
+	{
+		printf("FAIL: %s (segments of %u): %u results, expected %u\n", name, (unsigned int)segment, (unsigned int)got, (unsigned int)expected.size());
+		++failures;
+	}
+}
+
+/// Runs a case whole and byte by byte.
+/// \param[in]	name		The name of the case.
+/// \param[in]	stream		The frames.
+/// \param[in]	expected	The expected results.
+/// \param[in]	maxSize		The maximum size of a message.
+static void test(const char * name, const std::string & stream, const std::vector<Expected> & expected, size_t maxSize = 1024)
+{
+	check(name, stream, expected, stream.length() ? stream.length() : 1, maxSize);
+	check(name, stream, expected, 1, maxSize);
+}
+
+/// Runs the test cases.
+static void runTests()
+{
+	std::vector<Expected> e;
+
+	// A masked text message in one frame
+	e.clear();
+	e.push_back(message(SoWebSocketParser::TEXT, "Hello"));
+	test("masked text", frame(true, SoWebSocketParser::TEXT, "Hello"), e);
+
+	// Binary messages whose lengths take the 16 bits extended length, and an empty one
+	e.clear();
+	e.push_back(message(SoWebSocketParser::BINARY, std::string(126, '\x01')));
+	e.push_back(message(SoWebSocketParser::BINARY, std::string(1000, '\xFE')));
+	e.push_back(message(SoWebSocketParser::BINARY, ""));
+	test("extended lengths", frame(true, SoWebSocketParser::BINARY, std::string(126, '\x01')) + frame(true, SoWebSocketParser::BINARY, std::string(1000, '\xFE'))
+		+ frame(true, SoWebSocketParser::BINARY, ""), e);
+
+	// A message whose length takes the 64 bits extended length
+	e.clear();
+	e.push_back(message(SoWebSocketParser::BINARY, std::string(70000, 'x')));
+	test("64 bits length", frame(true, SoWebSocketParser::BINARY, std::string(70000, 'x')), e, 100000);
+
+	// A fragmented message, reassembled, followed by another message
+	e.clear();
+	e.push_back(message(SoWebSocketParser::TEXT, "Hello world"));
+	e.push_back(message(SoWebSocketParser::BINARY, "next"));
+	test("fragmented", frame(false, SoWebSocketParser::TEXT, "Hel") + frame(false, SoWebSocketParser::CONTINUATION, "lo ")
+		+ frame(true, SoWebSocketParser::CONTINUATION, "world") + frame(true, SoWebSocketParser::BINARY, "next"), e);
+
+	// Control frames between the fragments are returned right away, the message once complete
+	e.clear();
+	e.push_back(message(SoWebSocketParser::PING, "ping"));
+	e.push_back(message(SoWebSocketParser::PONG, ""));
+	e.push_back(message(SoWebSocketParser::BINARY, "abcdef"));
+	e.push_back(message(SoWebSocketParser::CLOSE, "\x03\xE8"));
+	test("interleaved control", frame(false, SoWebSocketParser::BINARY, "ab") + frame(true, SoWebSocketParser::PING, "ping")
+		+ frame(false, SoWebSocketParser::CONTINUATION, "cd") + frame(true, SoWebSocketParser::PONG, "")
+		+ frame(true, SoWebSocketParser::CONTINUATION, "ef") + frame(true, SoWebSocketParser::CLOSE, "\x03\xE8"), e);
+
+	// A frame bigger than the maximum size is refused before its payload is received
+	e.clear();
+	e.push_back(failure(SoWebSocketParser::TOO_BIG));
+	test("oversized frame", frame(true, SoWebSocketParser::BINARY, std::string(1025, 'o')).substr(0, 8), e);
+
+	// A fragmented message whose fragments are bigger than the maximum size
+	e.clear();
+	e.push_back(failure(SoWebSocketParser::TOO_BIG));
+	test("oversized message", frame(false, SoWebSocketParser::TEXT, std::string(600, 'a')) + frame(true, SoWebSocketParser::CONTINUATION, std::string(600, 'b')), e);
+
+	// A message of exactly the maximum size is accepted
+	e.clear();
+	e.push_back(message(SoWebSocketParser::TEXT, std::string(1024, 'm')));
+	test("maximum size", frame(false, SoWebSocketParser::TEXT, std::string(1000, 'm')) + frame(true, SoWebSocketParser::CONTINUATION, std::string(24, 'm')), e);
+
+	// A client frame must be masked
+	e.clear();
+	e.push_back(failure(SoWebSocketParser::INVALID));
+	test("unmasked", frame(true, SoWebSocketParser::TEXT, "Hello", false), e);
+
+	// A control frame cannot be fragmented nor have more than 125 bytes
+	e.clear();
+	e.push_back(failure(SoWebSocketParser::INVALID));
+	test("fragmented control", frame(false, SoWebSocketParser::PING, "p"), e);
+	test("oversized control", frame(true, SoWebSocketParser::PING, std::string(126, 'p')), e);
+
+	// A continuation must continue a message, and a message cannot start before the previous one is complete
+	test("lone continuation", frame(true, SoWebSocketParser::CONTINUATION, "x"), e);
+	test("unfinished message", frame(false, SoWebSocketParser::TEXT, "a") + frame(true, SoWebSocketParser::TEXT, "b"), e);
+
+	// Reserved bits and opcodes
+	std::string rsv = frame(true, SoWebSocketParser::TEXT, "x");
+	rsv[0] |= 0x40;
+	test("reserved bit", rsv, e);
+	test("reserved opcode", frame(true, 0x3, "x"), e);
+}
+
+/// Measures the parsing of messages of a size.
+/// \param[in]	size		The size of the messages.
+/// \param[in]	fragments	The number of frames of each message.
+/// \param[in]	megabytes	The number of megabytes to parse.
+static void bench(size_t size, int fragments, int megabytes)
+{
+	// A batch of messages, fragmented as asked
+	std::string batch;
+	std::string payload(size / fragments, '\x5A');
+	int perBatch = (int)(65536 / size) + 1;
+	for (int m = 0; m < perBatch; ++m)
+		for (int f = 0; f < fragments; ++f)
+			batch += frame(f == fragments - 1, f ? SoWebSocketParser::CONTINUATION : SoWebSocketParser::BINARY, payload);
+
+	// Parse batches until the number of megabytes is reached, in TCP sized segments
+	int batches = (int)(((double)megabytes * 1024 * 1024) / batch.length()) + 1;
+	SoWebSocketParser parser(size + 1);
+	size_t messages = 0;
+	clock_t start = clock();
+	for (int b = 0; b < batches; ++b)
+		for (size_t pos = 0; pos < batch.length(); pos += BENCH_SEGMENT)
+		{
+			parser.feed(batch.data() + pos, (batch.length() - pos > BENCH_SEGMENT) ? BENCH_SEGMENT : batch.length() - pos);
+			SoWebSocketParser::Status status;
+			while ((status = parser.next()) == SoWebSocketParser::MESSAGE)
+				++messages;
+			if (status != SoWebSocketParser::NEED_MORE)
+			{
+				printf("FAIL: bench of %u bytes: status %d\n", (unsigned int)size, status);
+				++failures;
+				return ;
+			}
+		}
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (messages != (size_t)batches * perBatch)
+	{
+		printf("FAIL: bench of %u bytes: %u messages, expected %u\n", (unsigned int)size, (unsigned int)messages, (unsigned int)(batches * perBatch));
+		++failures;
+		return ;
+	}
+
+	double bytes = (double)batches * batch.length();
+	printf("%8u bytes in %2d frame(s): %10.1f MB/s %12.0f messages/s\n", (unsigned int)size, fragments,
+		seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0, seconds > 0 ? messages / seconds : 0.0);
+}
+
+int main(int argc, char ** argv)
+{
+	int megabytes = (argc > 1) ? atoi(argv[1]) : 256;
+	if (megabytes <= 0)
+	{
+		fprintf(stderr, "Usage: %s [megabytes per size]\n", argv[0]);
+		return 2;
+	}
+
+	// The parser must be correct before being measured
+	runTests();
+	if (failures)
+		return 1;
+	printf("OK: all the cases pass, whole and byte by byte\n");
+
+	// The messages of the interface: button presses and acknowledgements, then bigger binary messages
+	bench(16, 1, megabytes);
+	bench(1024, 1, megabytes);
+	bench(1024, 4, megabytes);
+	bench(60000, 1, megabytes);
+	return failures ? 1 : 0;
+}
+
+/// \}
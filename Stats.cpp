@@ -0,0 +1,268 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "Stats.h"
+#include "Server.h"
+
+#include <sstream>
+#include <stdio.h>
+#include <vector>
+
+volatile LONG Stats::_connections[Stats::CONNECTION_COUNT] = { 0 };
+
+/// The names of the types of connections, in the order of Stats::Connection
+static const char * connectionNames[Stats::CONNECTION_COUNT] = { "stream_png", "stream_jpeg", "stream_tiles", "btn_socket", "cockpit_socket", "btn_pending" };
+
+/// The names of the commands, in the order of Command::Type
+static const char * commandNames[Command::TYPE_COUNT] = { "register", "unregister", "refresh", "button" };
+
+/// The names of the timed operations of the main thread, in the order of Server::StepTiming
+static const char * stepNames[Server::TIMING_COUNT] = { "register", "unregister", "button", "refresh", "step", "button_latency" };
+
+/// The names of the formats, in the order of ServerMFD::Format
+static const char * formatNames[ServerMFD::FORMAT_COUNT] = { "png", "jpeg", "tiles" };
+
+/// Escapes a string to be written as a Prometheus label value.
+/// \param[in]	str		The string.
+/// \return the escaped string
+static std::string labelEscape(const std::string & str)
+{
+	std::string ret;
+	for (std::string::const_iterator i = str.begin(); i != str.end(); ++i)
+	{
+		if (*i == '\n')
+		{
+			ret += "\\n";
+			continue ;
+		}
+		if (*i == '"' || *i == '\\')
+			ret += '\\';
+		ret += *i;
+	}
+	return ret;
+}
+
+/// Writes a timing in JSON: its count, total, maximum and histogram.
+/// The bucket i counts the durations under 2^i microseconds that are not in the previous buckets (see TimingStats).
+/// \param[out]	out		The stream to write to.
+/// \param[in]	stats	The timing.
+static void jsonTiming(std::ostringstream & out, const TimingStats & stats)
+{
+	out << "{\"count\":" << stats.Count() << ",\"total_us\":" << stats.TotalUs() << ",\"max_us\":" << stats.MaxUs() << ",\"buckets\":[";
+	for (int b = 0; b < WEBMFD_TIMING_BUCKETS; ++b)
+		out << (b ? "," : "") << stats.Bucket(b);
+	out << "]}";
+}
+
+/// Renders the counters of the followers of a MFD in JSON.
+/// \param[in]	followers	The counters of the followers.
+/// \return the JSON array
+static std::string jsonFollowers(const std::vector<FollowerCounters> & followers)
+{
+	std::ostringstream out;
+	DWORD now = GetTickCount();
+	out << "[";
+	for (std::vector<FollowerCounters>::const_iterator i = followers.begin(); i != followers.end(); ++i)
+		out << (i != followers.begin() ? "," : "") << "{\"via\":\"" << i->via << "\",\"format\":\"" << Stats::JSONEscape(i->format) << "\""
+			<< ",\"seconds\":" << (now - i->since) / 1000 << ",\"delivered\":" << (unsigned int)i->delivered << ",\"dropped\":" << (unsigned int)i->dropped << "}";
+	out << "]";
+	return out.str();
+}
+
+/// Writes the TYPE line of a Prometheus metric.
+/// \param[out]	out		The stream to write to.
+/// \param[in]	name	The name of the metric.
+/// \param[in]	type	"counter", "gauge" or "histogram".
+static void promType(std::ostringstream & out, const char * name, const char * type)
+{
+	out << "# TYPE " << name << " " << type << "\n";
+}
+
+/// Writes a timing as a Prometheus histogram, in seconds.
+/// The buckets of a Prometheus histogram are cumulative, and their "le" bound is inclusive:
+/// each bucket is bounded by the longest whole microsecond duration it counts (see TimingStats::BucketLimit).
+/// The counters are read without lock while they are updated, so the +Inf bucket and the count are the cumulated sum of the buckets
+/// rather than TimingStats::Count, which could be smaller than the previous bucket.
+/// \param[out]	out		The stream to write to.
+/// \param[in]	name	The name of the metric.
+/// \param[in]	labels	The labels of the timing (e.g. op="step"), or an empty string.
+/// \param[in]	stats	The timing.
+static void promTiming(std::ostringstream & out, const char * name, const std::string & labels, const TimingStats & stats)
+{
+	// The labels of the buckets, before their bound, and of the sum and count
+	std::string bucketLabels = labels.empty() ? "" : labels + ",";
+	std::string totalLabels = labels.empty() ? "" : "{" + labels + "}";
+
+	unsigned int cumulated = 0;
+	for (int b = 0; b < WEBMFD_TIMING_BUCKETS - 1; ++b)
+	{
+		cumulated += stats.Bucket(b);
+		out << name << "_bucket{" << bucketLabels << "le=\"" << TimingStats::BucketLimit(b) / 1000000.0 << "\"} " << cumulated << "\n";
+	}
+
+	// The last bucket has no bound: all the durations are counted
+	cumulated += stats.Bucket(WEBMFD_TIMING_BUCKETS - 1);
+	out << name << "_bucket{" << bucketLabels << "le=\"+Inf\"} " << cumulated << "\n";
+	out << name << "_sum" << totalLabels << " " << stats.TotalUs() / 1000000.0 << "\n";
+	out << name << "_count" << totalLabels << " " << cumulated << "\n";
+}
+
+
+std::string Stats::JSONEscape(const std::string & str)
+{
+	std::string ret;
+	for (std::string::const_iterator i = str.begin(); i != str.end(); ++i)
+	{
+		if (*i == '"' || *i == '\\')
+			ret += '\\';
+		// The control characters are written as unicode escapes
+		else if ((unsigned char)*i < 0x20)
+		{
+			char escape[8];
+			sprintf_s(escape, sizeof(escape), "\\u%04x", (unsigned int)(unsigned char)*i);
+			ret += escape;
+			continue ;
+		}
+		ret += *i;
+	}
+	return ret;
+}
+
+
+std::string Stats::JSON()
+{
+	Server & server = Server::Instance();
+	std::ostringstream out;
+
+	// The connections, by type
+	out << "{\"connections\":{\"total\":" << server.OpenConnections();
+	for (int i = 0; i < CONNECTION_COUNT; ++i)
+		out << ",\"" << connectionNames[i] << "\":" << Connections((Connection)i);
+	out << "},";
+
+	// The bytes transfered by all connections
+	out << "\"bytes\":{\"sent\":" << server.BytesSent() << ",\"received\":" << server.BytesReceived() << "},";
+
+	// The depths of the queues
+	out << "\"queues\":{";
+	for (int i = 0; i < Command::TYPE_COUNT; ++i)
+		out << "\"" << commandNames[i] << "\":" << server.Commands().Pending((Command::Type)i) << ",";
+	out << "\"refresh_backlog\":" << server.RefreshBacklog() << ",\"encoder\":" << server.Encoders().QueueDepth()
+		<< ",\"encoder_rejected\":" << server.Encoders().Rejected() << "},";
+
+	// The timings of the main thread
+	out << "\"main_thread\":{\"budget_overruns\":" << server.BudgetOverruns();
+	for (int i = 0; i < Server::TIMING_COUNT; ++i)
+	{
+		out << ",\"" << stepNames[i] << "\":";
+		jsonTiming(out, server.StepTimings((Server::StepTiming)i));
+	}
+	out << "},";
+
+	// The timings of the encodings
+	out << "\"encode\":{";
+	for (int i = 0; i < ServerMFD::FORMAT_COUNT; ++i)
+	{
+		out << (i ? "," : "") << "\"" << formatNames[i] << "\":";
+		jsonTiming(out, server.Encoders().Timings((ServerMFD::Format)i));
+	}
+	out << "},";
+
+	// The waits on the locks of the MFD registry
+	out << "\"registry_lock\":{\"uncontended\":" << server.MFDs().LockFree() << ",\"waits\":";
+	jsonTiming(out, server.MFDs().LockWaits());
+	out << "},";
+
+	// The counters of each MFD
+	std::vector<MFDStats> mfds;
+	server.MFDs().collect(mfds);
+	out << "\"mfds\":[";
+	for (std::vector<MFDStats>::iterator i = mfds.begin(); i != mfds.end(); ++i)
+		out << (i != mfds.begin() ? "," : "") << "{\"key\":\"" << JSONEscape(i->key) << "\""
+			<< ",\"followers\":{\"png\":" << i->png << ",\"jpeg\":" << i->jpeg << ",\"tiles\":" << i->tiles << ",\"nox\":" << i->nox << "}"
+			<< ",\"encoded\":" << i->encoded << ",\"skipped\":" << i->skipped << ",\"delivered\":" << i->delivered << ",\"dropped\":" << i->dropped
+			<< ",\"bytes_out\":" << i->bytesOut << ",\"clients\":" << jsonFollowers(i->followers) << "}";
+	out << "]}";
+
+	return out.str();
+}
+
+
+std::string Stats::Prometheus()
+{
+	Server & server = Server::Instance();
+	std::ostringstream out;
+
+	// The connections, by type
+	promType(out, "webmfd_connections_open", "gauge");
+	out << "webmfd_connections_open " << server.OpenConnections() << "\n";
+	promType(out, "webmfd_connections", "gauge");
+	for (int i = 0; i < CONNECTION_COUNT; ++i)
+		out << "webmfd_connections{type=\"" << connectionNames[i] << "\"} " << Connections((Connection)i) << "\n";
+
+	// The bytes transfered by all connections
+	promType(out, "webmfd_bytes_sent_total", "counter");
+	out << "webmfd_bytes_sent_total " << server.BytesSent() << "\n";
+	promType(out, "webmfd_bytes_received_total", "counter");
+	out << "webmfd_bytes_received_total " << server.BytesReceived() << "\n";
+
+	// The depths of the queues
+	promType(out, "webmfd_commands_queued", "gauge");
+	for (int i = 0; i < Command::TYPE_COUNT; ++i)
+		out << "webmfd_commands_queued{type=\"" << commandNames[i] << "\"} " << server.Commands().Pending((Command::Type)i) << "\n";
+	promType(out, "webmfd_refresh_backlog", "gauge");
+	out << "webmfd_refresh_backlog " << server.RefreshBacklog() << "\n";
+	promType(out, "webmfd_encoder_queued", "gauge");
+	out << "webmfd_encoder_queued " << server.Encoders().QueueDepth() << "\n";
+	promType(out, "webmfd_encoder_rejected_total", "counter");
+	out << "webmfd_encoder_rejected_total " << server.Encoders().Rejected() << "\n";
+
+	// The timings of the main thread
+	promType(out, "webmfd_budget_overruns_total", "counter");
+	out << "webmfd_budget_overruns_total " << server.BudgetOverruns() << "\n";
+	promType(out, "webmfd_main_thread_seconds", "histogram");
+	for (int i = 0; i < Server::TIMING_COUNT; ++i)
+		promTiming(out, "webmfd_main_thread_seconds", std::string("op=\"") + stepNames[i] + "\"", server.StepTimings((Server::StepTiming)i));
+
+	// The timings of the encodings
+	promType(out, "webmfd_encode_seconds", "histogram");
+	for (int i = 0; i < ServerMFD::FORMAT_COUNT; ++i)
+		promTiming(out, "webmfd_encode_seconds", std::string("format=\"") + formatNames[i] + "\"", server.Encoders().Timings((ServerMFD::Format)i));
+
+	// The waits on the locks of the MFD registry
+	promType(out, "webmfd_registry_lock_uncontended_total", "counter");
+	out << "webmfd_registry_lock_uncontended_total " << server.MFDs().LockFree() << "\n";
+	promType(out, "webmfd_registry_lock_wait_seconds", "histogram");
+	promTiming(out, "webmfd_registry_lock_wait_seconds", "", server.MFDs().LockWaits());
+
+	// The counters of each MFD, labelled by key
+	std::vector<MFDStats> mfds;
+	server.MFDs().collect(mfds);
+	promType(out, "webmfd_mfd_followers", "gauge");
+	for (std::vector<MFDStats>::iterator i = mfds.begin(); i != mfds.end(); ++i)
+	{
+		std::string key = "key=\"" + labelEscape(i->key) + "\"";
+		out << "webmfd_mfd_followers{" << key << ",format=\"png\"} " << i->png << "\n";
+		out << "webmfd_mfd_followers{" << key << ",format=\"jpeg\"} " << i->jpeg << "\n";
+		out << "webmfd_mfd_followers{" << key << ",format=\"tiles\"} " << i->tiles << "\n";
+		out << "webmfd_mfd_followers{" << key << ",format=\"nox\"} " << i->nox << "\n";
+	}
+	promType(out, "webmfd_mfd_frames_total", "counter");
+	for (std::vector<MFDStats>::iterator i = mfds.begin(); i != mfds.end(); ++i)
+	{
+		std::string key = "key=\"" + labelEscape(i->key) + "\"";
+		out << "webmfd_mfd_frames_total{" << key << ",state=\"encoded\"} " << i->encoded << "\n";
+		out << "webmfd_mfd_frames_total{" << key << ",state=\"skipped\"} " << i->skipped << "\n";
+		out << "webmfd_mfd_frames_total{" << key << ",state=\"delivered\"} " << i->delivered << "\n";
+		out << "webmfd_mfd_frames_total{" << key << ",state=\"dropped\"} " << i->dropped << "\n";
+	}
+	// The counters of each follower are only rendered in JSON: a series per connection would never expire
+	promType(out, "webmfd_mfd_bytes_out_total", "counter");
+	for (std::vector<MFDStats>::iterator i = mfds.begin(); i != mfds.end(); ++i)
+		out << "webmfd_mfd_bytes_out_total{key=\"" << labelEscape(i->key) << "\"} " << i->bytesOut << "\n";
+
+	return out.str();
+}
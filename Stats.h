@@ -0,0 +1,82 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include "TimingStats.h"
+
+#include <Windows.h>
+#include <string>
+
+/// The performance counters of the server, served by the /stats route.
+/// The counters are kept where they are updated (the reactor, the MFDs, the encoder pool, the command queue, the MFD registry)
+/// without lock, or in striped counters for the hot ones, so that reading them never slows down the threads that update them.
+/// This class counts the opened connections by type, and renders all the counters in JSON or in the Prometheus text format.
+/// This is a static class: there is only one server.
+class Stats
+{
+public:
+	/// The types of connections
+	enum Connection
+	{
+		/// A motion PNG image stream (see MFDStream)
+		STREAM_PNG = 0,
+
+		/// A motion JPEG image stream (see MFDStream)
+		STREAM_JPEG,
+
+		/// A tiles stream (see MFDStream)
+		STREAM_TILES,
+
+		/// A button WebSocket (see BtnSocket)
+		BTN_SOCKET,
+
+		/// A cockpit WebSocket (see CockpitSocket)
+		COCKPIT_SOCKET,
+
+		/// A button classic HTTP request waiting for its press to be processed (see BtnResponse)
+		BTN_PENDING,
+
+		/// The number of types of connections
+		CONNECTION_COUNT
+	};
+
+	/// Counts an opened connection.
+	/// Can be called from any thread.
+	/// \param[in]	type	The type of the connection.
+	static void			opened(Connection type) { InterlockedIncrement(&_connections[type]); }
+
+	/// Counts a closed connection.
+	/// Can be called from any thread.
+	/// \param[in]	type	The type of the connection.
+	static void			closed(Connection type) { InterlockedDecrement(&_connections[type]); }
+
+	/// Gets the number of opened connections of a type.
+	/// \param[in]	type	The type of the connections.
+	/// \return the number of connections
+	static unsigned int	Connections(Connection type) { return (unsigned int)_connections[type]; }
+
+	/// Renders all the counters in JSON.
+	/// \return the JSON document
+	static std::string	JSON();
+
+	/// Renders all the counters in the Prometheus text exposition format (version 0.0.4).
+	/// \return the metrics
+	static std::string	Prometheus();
+
+	/// Escapes a string to be written between quotes in JSON.
+	/// The MFD keys are given by the clients, so they can contain any character.
+	/// \param[in]	str		The string.
+	/// \return the escaped string
+	static std::string	JSONEscape(const std::string & str);
+
+private:
+	/// The number of opened connections, by type. Is a LONG to be accessed with Interlocked functions.
+	static volatile LONG	_connections[CONNECTION_COUNT];
+};
+
+#endif // __STATS_H
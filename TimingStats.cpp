@@ -0,0 +1,83 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "TimingStats.h"
+
+#include <limits.h>
+
+/// Gets the frequency of the performance counter, which is fixed at system boot.
+/// \return the number of ticks per second
+static LONGLONG counterFrequency()
+{
+	static LONGLONG frequency = 0;
+	if (!frequency)
+	{
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		frequency = f.QuadPart;
+	}
+	return frequency;
+}
+
+
+TimingStats::TimingStats() : _count(0), _totalUs(0), _maxUs(0)
+{
+	// Empty the histogram
+	for (int i = 0; i < WEBMFD_TIMING_BUCKETS; ++i)
+		_buckets[i] = 0;
+}
+
+
+void TimingStats::record(LONGLONG us)
+{
+	// Find the bucket of the duration: the number of bits of the duration, capped to the last bucket
+	int bucket = 0;
+	for (LONGLONG d = us; d > 0 && bucket < WEBMFD_TIMING_BUCKETS - 1; d >>= 1)
+		++bucket;
+
+	InterlockedIncrement(&_count);
+	InterlockedIncrement(&_buckets[bucket]);
+
+	// Add the duration to the total, retrying if another thread has added its own meanwhile
+	// The exchange also writes the 64 bits atomically for the readers
+	LONGLONG total;
+	do
+		total = _totalUs;
+	while (InterlockedCompareExchange64(&_totalUs, total + us, total) != total);
+
+	// Keep the longest duration, unless another thread has recorded a longer one meanwhile
+	LONG capped = (us > LONG_MAX) ? LONG_MAX : (LONG)us;
+	LONG max;
+	while (capped > (max = _maxUs) && InterlockedCompareExchange(&_maxUs, capped, max) != max)
+		;
+}
+
+
+unsigned int TimingStats::BucketLimit(int bucket)
+{
+	// The last bucket has no upper bound
+	if (bucket >= WEBMFD_TIMING_BUCKETS - 1)
+		return UINT_MAX;
+
+	// The durations are whole microseconds: the bucket ends just before the next power of two
+	return (1U << bucket) - 1;
+}
+
+
+LONGLONG TimingStats::Now()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+
+LONGLONG TimingStats::ToMicroseconds(LONGLONG ticks)
+{
+	// Split the conversion so that the multiplication cannot overflow
+	LONGLONG frequency = counterFrequency();
+	return (ticks / frequency) * 1000000 + ((ticks % frequency) * 1000000) / frequency;
+}
@@ -0,0 +1,76 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __TIMINGSTATS_H
+#define __TIMINGSTATS_H
+
+#include <Windows.h>
+
+/// The number of buckets of a timing histogram.
+/// The durations are recorded in whole microseconds: bucket 0 counts the durations under 1 microsecond,
+/// bucket i those from 2^(i-1) to 2^i - 1 microseconds, and the last bucket all the durations of 2^(WEBMFD_TIMING_BUCKETS-2) microseconds (16 ms) and more.
+#define WEBMFD_TIMING_BUCKETS	16
+
+/// Counters and histogram of the durations of an operation, measured with the high resolution performance counter.
+/// Can be written and read from any thread without lock: each counter is updated and read atomically,
+/// but the counters are not a consistent snapshot.
+class TimingStats
+{
+public:
+	/// Constructor
+	TimingStats();
+
+	/// Records a duration.
+	/// Can be called from any thread, never blocks.
+	/// \param[in]	us		The duration, in microseconds.
+	void			record(LONGLONG us);
+
+	/// Gets the number of recorded durations.
+	/// \return the count
+	unsigned int	Count() const { return (unsigned int)_count; }
+
+	/// Gets the sum of the recorded durations.
+	/// \return the total, in microseconds
+	LONGLONG		TotalUs() const { return InterlockedCompareExchange64((volatile LONGLONG *)&_totalUs, 0, 0); }
+
+	/// Gets the longest recorded duration.
+	/// \return the maximum, in microseconds
+	unsigned int	MaxUs() const { return (unsigned int)_maxUs; }
+
+	/// Gets the number of durations in a bucket of the histogram.
+	/// \param[in]	bucket	The bucket, from 0 to WEBMFD_TIMING_BUCKETS - 1.
+	/// \return the count of the bucket
+	unsigned int	Bucket(int bucket) const { return (unsigned int)_buckets[bucket]; }
+
+	/// Gets the inclusive upper bound of a bucket of the histogram.
+	/// \param[in]	bucket	The bucket, from 0 to WEBMFD_TIMING_BUCKETS - 1.
+	/// \return the longest duration of the bucket, in whole microseconds: 2^bucket - 1. UINT_MAX for the last bucket, which has no bound.
+	static unsigned int	BucketLimit(int bucket);
+
+	/// Gets the current value of the high resolution performance counter.
+	/// \return the counter, in ticks
+	static LONGLONG	Now();
+
+	/// Converts a number of ticks of the performance counter to microseconds.
+	/// \param[in]	ticks	The number of ticks.
+	/// \return the number of microseconds
+	static LONGLONG	ToMicroseconds(LONGLONG ticks);
+
+private:
+	/// The number of recorded durations
+	volatile LONG		_count;
+
+	/// The sum of the recorded durations, in microseconds. Is accessed with InterlockedCompareExchange64 as it is 64 bits.
+	volatile LONGLONG	_totalUs;
+
+	/// The longest recorded duration, in microseconds
+	volatile LONG		_maxUs;
+
+	/// The histogram of the recorded durations
+	volatile LONG		_buckets[WEBMFD_TIMING_BUCKETS];
+};
+
+#endif // __TIMINGSTATS_H
@@ -0,0 +1,94 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#include "WebInterfaces.h"
+
+#include <list>
+
+typedef std::list<std::string> stringList;
+
+void	WebInterfaces::onLoad(const std::string & dir, AssetMap & assets)
+{
+	// Open an item list of the WebMFD directory
+	WIN32_FIND_DATA FindFileData;
+	HANDLE hFind = FindFirstFile((dir + "\\*").c_str(), &FindFileData);
+
+	// If the WebMFD directory cannot be listed, there is no page: the request will be answered with an error
+	if (hFind == INVALID_HANDLE_VALUE)
+		return ;
+
+	// The list in which all the WebMFD sub-directories names will be stored
+	stringList dirs;
+
+	// Browse the WebMFD directory...
+	do
+		// If the item is a directory and is not the current directory
+		if ((FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY && FindFileData.cFileName[0] != '.' && FindFileData.cFileName[0] != '_')
+			// Add it's name to the list
+			dirs.push_back(FindFileData.cFileName);
+	// ...While there are item to be found
+	while (FindNextFile(hFind, &FindFileData) != 0);
+
+	// close the item list
+	FindClose(hFind);
+
+	// The page is as new as the loading
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+
+	// The asset of the page
+	SoAsset * page;
+
+	// If only one subdirectoy has been found, the page is a redirection to this subdirectory
+	if (dirs.size() == 1)
+		page = new SoAsset("text/html", "", now, SoBuffer::Create(0), 0, dirs.front() + "/");
+
+	// There are more than one sub-directory: the page is the list of the interfaces
+	else
+	{
+		// The HTML header of the list
+		std::string html =
+			"<html>"
+				"<head>"
+					"<title>Interface list</title>"
+					"<link rel='Stylesheet' type='text/css' href='_InterfaceChoice.css' />"
+				"</head>"
+				"<body>"
+					"<h1>Choose an Interface</h1>";
+
+		// For each sub-directory name in the list
+		for (stringList::iterator i = dirs.begin(); i != dirs.end(); ++i)
+		{
+			// A HTML hyperlink for it
+			html += "<div class='interface'><h3><a href='" + *i + "/'>" + *i + "</a></h3>";
+
+			// If there is a description, it has been loaded with the files
+			AssetMap::iterator desc = assets.find(_key(*i + "/description.txt"));
+			if (desc != assets.end())
+			{
+				html += " <p class='desc'>";
+				html.append(desc->second->Body()->Data(), desc->second->Body()->Size());
+				html += "</p>";
+			}
+
+			html += "</div>";
+		}
+
+		// The HTML footer of the list
+		html +=
+					"<p class='footer'>Tip: if you are always using the same interface, delete all the others in the WebMFD directory to automatically use the remain one</p>"
+				"</body>"
+			"</html>";
+
+		page = CreateAsset("index.html", SoBuffer::Create(html.data(), html.length()), now);
+	}
+
+	// The page replaces the index.html file of the WebMFD directory, if any
+	AssetMap::iterator previous = assets.find("");
+	if (previous != assets.end())
+		previous->second->Release();
+	assets[""] = page;
+}
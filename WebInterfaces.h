@@ -0,0 +1,32 @@
+/// \file
+/// \author Salomon BRYS <salomon.brys@gmail.com>
+/// Copyright (C) 2006 Martin Schweiger
+/// Copyright (C) 2010 File authors
+/// License LGPL
+
+#ifndef __WEBINTERFACES_H
+#define __WEBINTERFACES_H
+
+#include "SoHTTP/SoAssetCache.h"
+
+/// The web interfaces, loaded in memory from the WebMFD directory.
+/// Each sub-directory of the WebMFD directory is a web interface.
+/// Along with their files, the cache holds the interface choice page, as the asset of the directory itself (the "" resource):
+///  - If there is only one interface, it is a redirection to this interface.
+///  - Else, it is the page that lists the interfaces with their description.
+/// The page is built each time the directory is loaded, so it is never built while answering a request.
+class WebInterfaces : public SoAssetCache
+{
+public:
+	/// Destructor
+	/// Stops watching the directory before the object is destroyed, as the watching thread calls onLoad.
+	virtual ~WebInterfaces() { stop(); }
+
+protected:
+	/// Builds the interface choice page from the loaded files.
+	/// \param[in]		dir		The path of the WebMFD directory.
+	/// \param[in,out]	assets	The loaded files, to which the page is added.
+	virtual void	onLoad(const std::string & dir, AssetMap & assets);
+};
+
+#endif // __WEBINTERFACES_H
@@ -37,7 +37,7 @@ public:
 	/// The parameter is ignored because unused
 	virtual void clbkSimulationStart(RenderMode)
 	{
-		Server::Instance().start(8042);
+		Server::Instance().start(8042, item->EncoderThreads(), item->EncoderQueue(), item->PngLevel(), item->WebMaxAge(), item->StepBudgetUs());
 	}
 
 	/// Orbiter callback to be called when the simulation ends